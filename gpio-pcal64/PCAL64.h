@@ -18,64 +18,179 @@
 #define __GPIO_PCAL64_H__
 
 #include "mbed-drivers/mbed.h"
-#include "wrd-utilities/I2CRegister.h"
+#include "gpio-pcal64/PCAL64RegisterMap.h"
+#include "gpio-pcal64/PCAL64Bus.h"
+#include "gpio-pcal64/PCAL64InterruptGroup.h"
+#include "gpio-pcal64/PCAL64SampleRing.h"
 
 using namespace mbed::util;
 
-class PCAL64
+/* Number of commands that can wait while the I/O expander is busy. */
+#ifndef YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE
+#define YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE 4
+#endif
+
+/* When the queue is full: 0 rejects the new command, 1 drops the oldest one
+   and reports it to the error handler, see PCAL64Expander::setErrorHandler.
+*/
+#ifndef YOTTA_CFG_GPIO_PCAL64_QUEUE_OVERWRITE_OLDEST
+#define YOTTA_CFG_GPIO_PCAL64_QUEUE_OVERWRITE_OLDEST 0
+#endif
+
+/* Operation counters and latency histograms, see PCAL64Expander::getStatistics. */
+#ifndef YOTTA_CFG_GPIO_PCAL64_STATISTICS
+#define YOTTA_CFG_GPIO_PCAL64_STATISTICS 0
+#endif
+
+/* Number of per-pin interrupt subscriptions, see PCAL64Expander::subscribe. */
+#ifndef YOTTA_CFG_GPIO_PCAL64_SUBSCRIPTIONS
+#define YOTTA_CFG_GPIO_PCAL64_SUBSCRIPTIONS 8
+#endif
+
+/**
+ * @brief Driver for the PCAL64 I/O expander family.
+ * @details The part is selected with its register map, see
+ *          PCAL64RegisterMap.h. Port count, buffer sizes and masks are
+ *          compile-time constants of the map, so every register bank is
+ *          moved in a single burst of PORTS bytes. The member functions are
+ *          instantiated in PCAL64.cpp for the maps listed at the end of this
+ *          file; use the typedefs rather than the template directly.
+ */
+template <class Map>
+class PCAL64Expander : public PCAL64BusClient, public PCAL64InterruptSource, public Map::Pins
 {
 public:
+    /* pin bitmap as passed through the API, LSB is P0_0 */
+    typedef typename Map::value_t value_t;
+
+    static constexpr uint8_t PORTS = Map::PORTS;
+
     typedef enum {
         PRIMARY_ADDRESS   = 0x40,
         SECONDARY_ADDRESS = 0x42
     } address_t;
 
-    typedef enum {
-        P0_0 = (1 <<  0),
-        P0_1 = (1 <<  1),
-        P0_2 = (1 <<  2),
-        P0_3 = (1 <<  3),
-        P0_4 = (1 <<  4),
-        P0_5 = (1 <<  5),
-        P0_6 = (1 <<  6),
-        P0_7 = (1 <<  7),
-
-        P1_0 = (1 <<  8),
-        P1_1 = (1 <<  9),
-        P1_2 = (1 << 10),
-        P1_3 = (1 << 11),
-        P1_4 = (1 << 12),
-        P1_5 = (1 << 13),
-        P1_6 = (1 << 14),
-        P1_7 = (1 << 15),
-        Pin_End
-    } pin_t;
-
-    PCAL64(PinName sda, PinName scl, uint16_t address, PinName irq = NC);
-    ~PCAL64(void);
+    /* The pin names, P0_0 and on, are those of the part, see
+       PCAL64RegisterMap.h; PCAL6524::P2_5 is the bitmap for P2_5.
+    */
+
+    /**
+     * @brief Bitmap for a pin on any port, e.g. pin(2, 5) for P2_5.
+     */
+    static constexpr value_t pin(uint8_t port, uint8_t index)
+    {
+        return ((value_t) 1) << (8 * port + index);
+    }
+
+    /**
+     * @brief I/O expander with an I2C bus of its own.
+     * @details Pass irq = NC when the INT output is shared with other
+     *          expanders and attach the expander to a PCAL64InterruptGroup.
+     */
+    PCAL64Expander(PinName sda, PinName scl, uint16_t address, PinName irq = NC);
+
+    /**
+     * @brief I/O expander sharing an I2C bus with other expanders.
+     * @details Transfers are arbitrated by the bus, see PCAL64Bus.
+     */
+    PCAL64Expander(PCAL64Bus& bus, uint16_t address, PinName irq = NC);
+
+    virtual ~PCAL64Expander(void);
 
     /**
      * @brief Read pin values.
      * @details The result is passed as a parameter in the callback function.
+     *          Reading the input port clears the interrupt status, so the
+     *          status is read first and kept for the interrupt handler. This
+     *          is skipped, and the read is a single transfer, when no
+     *          interrupt can be pending: no IRQ pin or group, or the shadow
+     *          registers show every input masked. See also setStatusPreRead.
      *
      * @param callback Function with pin values as parameter.
-     * @return Boolean result. True means command was accepted, False means it was not.
+     * @return Boolean result. True means command was accepted or queued, False means it was not.
+     */
+    bool bulkRead(FunctionPointer1<void, value_t> callback);
+
+    /**
+     * @brief Read the interrupt status and the pin values.
+     * @details Always two transfers. The status is still passed on to the
+     *          interrupt handler if the read raced with an interrupt.
+     *
+     * @param callback Function with the interrupt status and the pin values as parameters.
+     * @return Boolean result. True means command was accepted or queued, False means it was not.
      */
-    bool bulkRead(FunctionPointer1<void, uint32_t> callback);
+    bool bulkReadWithStatus(FunctionPointer2<void, value_t, value_t> callback);
 
     /**
-     * @brief Set direction and values for at most 32 pins.
-     * @details Pins are labeled LSB. For I/O expanders with less than 32 pins
-     *          the higher bits are ignored. I/O expanders with more than 32 pins
-     *          are not supported.
+     * @brief Choose whether bulkRead and the sampler protect the interrupt status.
+     * @details On by default. Turned off, reads are always a single transfer
+     *          and an interrupt that fires just before a read may go
+     *          unreported. For applications that do not use interrupts on
+     *          this expander, or that read after every interrupt anyway.
+     *
+     * @param enable False to skip the status pre-read.
+     */
+    void setStatusPreRead(bool enable);
+
+    typedef enum {
+        FAILURE_COMMAND,        // a command was abandoned
+        FAILURE_INTERRUPT,      // interrupt service was abandoned
+        FAILURE_OVERWRITTEN     // a queued command was dropped for a newer one
+    } failure_t;
+
+    /**
+     * @brief Transfer failure callback.
+     *
+     * @param uint16_t address
+     * @param failure_t what was abandoned
+     */
+    typedef FunctionPointer2<void, uint16_t, failure_t> ErrorCallback_t;
+
+    /**
+     * @brief Repeat failed transfers before giving up on a command.
+     * @details A transfer fails when I2CRegister refuses it or when it does
+     *          not complete within the bus timeout, see PCAL64Bus::setTimeout.
+     *          It is started again after backoff milliseconds, and the delay
+     *          doubles with every further attempt. Once the retries are used
+     *          up the command is abandoned: its callback is not called, the
+     *          error handler is, and the next command starts. Commands
+     *          merged into an abandoned write fail with it. An interrupt
+     *          service is given up the same way, the command it interrupted
+     *          carries on and the service is tried again while INT is held
+     *          low. With a bus
+     *          timeout every transfer, and so every command, ends within a
+     *          bounded time. Blocking calls retry at once.
+     *
+     * @param retries Attempts after the first, 0 (the default) gives up at once.
+     * @param backoff Delay before the first retry, in milliseconds.
+     */
+    void setRetryPolicy(uint8_t retries, uint16_t backoff);
+
+    /**
+     * @brief Set the callback for abandoned commands and interrupt service.
+     * @details With YOTTA_CFG_GPIO_PCAL64_QUEUE_OVERWRITE_OLDEST a full
+     *          queue drops its oldest command, together with the commands
+     *          merged into it. They never call their callback; the error
+     *          handler is called with FAILURE_OVERWRITTEN once for each.
+     *          Writes update the shadow before they reach the device, so
+     *          after a failure the shadow may be ahead of it;
+     *          resyncShadowRegisters brings it back in line.
+     *
+     * @param callback Called with every failure, may be empty.
+     */
+    void setErrorHandler(ErrorCallback_t callback);
+
+    /**
+     * @brief Set direction and values for all pins of the part.
+     * @details Pins are labeled LSB. Bits above the last port are ignored.
      *
      * @param pins The pins affected by this call are set high in bitmap (LSB).
      * @param directions Pin directions. 0 means input, 1 means output.
      * @param values Pin values. 0 means low, 1 means high.
      * @param callback Function to call when I/O expander is ready for next command.
-     * @return Boolean result. True means command was accepted, False means it was not.
+     * @return Boolean result. True means command was accepted or queued, False means it was not.
      */
-    bool bulkWrite(uint32_t pins, uint32_t directions, uint32_t values, FunctionPointer0<void> callback);
+    bool bulkWrite(value_t pins, value_t directions, value_t values, FunctionPointer0<void> callback);
 
     /**
      * @brief Toggles output on given pins.
@@ -83,9 +198,38 @@ public:
      *
      * @param pins The pins affected by this call are set high in bitmap (LSB).
      * @param callback Function to call when I/O expander is ready for next command.
-     * @return Boolean result. True means command was accepted, False means it was not.
+     * @return Boolean result. True means command was accepted or queued, False means it was not.
+     */
+    bool bulkToggle(value_t pins, FunctionPointer0<void> callback);
+
+    /**
+     * @brief Stage output values or directions without issuing a command.
+     * @details Staged changes are collected until the current scheduler
+     *          callback returns and then written with a single output
+     *          command, merged into a queued one where possible. Changes for
+     *          the same pin made later win. Nothing is rejected: if the
+     *          queue is full the write goes out once it has drained. Used by
+     *          PCAL64Pin.
+     *
+     * @param pins The pins affected by this call are set high in bitmap (LSB).
+     * @param values Pin values, or directions where 1 means output.
      */
-    bool bulkToggle(uint32_t pins, FunctionPointer0<void> callback);
+    void stageWrite(value_t pins, value_t values);
+    void stageDirection(value_t pins, value_t directions);
+
+    /**
+     * @brief Pin values from the most recent read of the input port.
+     * @details Updated by reads, interrupts and samples; nothing is read.
+     */
+    value_t getLastValues(void) const;
+
+    /**
+     * @brief Read the input port for getLastValues.
+     *
+     * @param callback Function to call when the values have been read.
+     * @return Boolean result. True means command was accepted or queued, False means it was not.
+     */
+    bool refreshValues(FunctionPointer0<void> callback);
 
     /**
      * @brief Set pins to be trigger interrupts.
@@ -94,9 +238,86 @@ public:
      * @param pins Pins affected by this call.
      * @param values Interrupt mask. 0 interrupt is disabled, 1 interrupt is enabled.
      * @param callback Function is called when next command can be send.
-     * @return Boolean result. True means command was accepted, False means it was not.
+     * @return Boolean result. True means command was accepted or queued, False means it was not.
+     */
+    bool bulkSetInterrupt(value_t pins, value_t values, FunctionPointer0<void> callback);
+
+    typedef enum {
+        DRIVE_QUARTER       = 0,
+        DRIVE_HALF          = 1,
+        DRIVE_THREE_QUARTER = 2,
+        DRIVE_FULL          = 3
+    } drive_t;
+
+    typedef enum {
+        PULL_NONE,
+        PULL_DOWN,
+        PULL_UP
+    } pull_t;
+
+    /**
+     * @brief Desired state of the PCAL-specific registers for a set of pins.
+     * @details Settings accumulate; pins and registers not mentioned are
+     *          left alone. A later setting for the same pin wins.
+     */
+    class Config
+    {
+    public:
+        Config(void);
+
+        Config& drive(value_t pins, drive_t strength);
+        Config& pull(value_t pins, pull_t pull);
+        Config& latch(value_t pins, bool enable);
+
+        /**
+         * @param ports Bitmap of ports, bit 0 is port 0.
+         * @param enable True for open-drain outputs, false for push-pull.
+         */
+        Config& openDrain(uint8_t ports, bool enable);
+
+    private:
+        friend class PCAL64Expander;
+
+        /* drive strength banks 0 and 1, input latch, pull-up/down enable
+           and selection; in register order, as in the shadow
+        */
+        static const uint8_t BANKS = 5;
+
+        value_t mask[BANKS];
+        value_t value[BANKS];
+        uint8_t portMask;
+        uint8_t portValue;
+    };
+
+    /**
+     * @brief Apply a configuration in as few transfers as possible.
+     * @details Registers that already hold the desired value are not
+     *          written. With the shadow enabled nothing is read; otherwise
+     *          the affected registers are read first. On parts with
+     *          auto-increment, adjacent registers are read and written in
+     *          one burst. The config is not copied and must remain valid
+     *          until the callback.
+     *
+     * @param config Desired state.
+     * @param callback Function to call when the configuration has been applied.
+     * @return Boolean result. True means command was accepted or queued, False means it was not.
      */
-    bool bulkSetInterrupt(uint32_t pins, uint32_t values, FunctionPointer0<void> callback);
+    bool configure(const Config& config, FunctionPointer0<void> callback);
+
+    /**
+     * @brief Blocking variants for startup code.
+     * @details Callable before the minar scheduler runs, e.g. from
+     *          app_start. The command runs over polled I2C and has completed
+     *          when the call returns; no callback is posted. Fails without
+     *          touching the device if a command of this expander, or a
+     *          transfer of any expander on the bus, is in progress or queued.
+     *
+     * @return Boolean result. True means the command completed, False means it was not run or a transfer failed.
+     */
+    bool bulkReadBlocking(value_t& values);
+    bool bulkWriteBlocking(value_t pins, value_t directions, value_t values);
+    bool bulkSetInterruptBlocking(value_t pins, value_t values);
+    bool configureBlocking(const Config& config);
 
     /**
      * @brief Interrupt callback function.
@@ -106,14 +327,17 @@ public:
      *          which pins have fired and what edge triggered the interrupt.
      *
      * @param uint16_t address
-     * @param uint32_t pins
-     * @param uint32_t values
+     * @param value_t pins
+     * @param value_t values
      */
-    typedef FunctionPointer3<void, uint16_t, uint32_t, uint32_t> IRQCallback_t;
+    typedef FunctionPointer3<void, uint16_t, value_t, value_t> IRQCallback_t;
 
     /**
      * @brief Callback function for when interrupts have fired.
      * @details The fired pins and values are passes as arguments in callback function.
+     *          At most one call is queued at a time. Interrupts serviced
+     *          before it runs are merged into it: the fired pins are OR'ed
+     *          together and the values are the most recent ones.
      *
      * @param callback Parameters: address, fired pins, and pin values.
      */
@@ -124,76 +348,802 @@ public:
      */
     void clearInterruptHandler(void);
 
+    typedef enum {
+        EDGE_RISING  = 0x01,
+        EDGE_FALLING = 0x02,
+        EDGE_BOTH    = 0x03
+    } edge_t;
+
+    /**
+     * @brief Pin subscription callback.
+     *
+     * @param uint8_t pin index, 0 is P0_0
+     * @param edge_t EDGE_RISING or EDGE_FALLING
+     */
+    typedef FunctionPointer2<void, uint8_t, edge_t> PinCallback_t;
+
+    /**
+     * @brief Call a function when an interrupt shows an edge on a single pin.
+     * @details Edges are found by comparing the pin values read in the
+     *          interrupt with those read in the previous interrupt, for the
+     *          pins whose interrupt status is set. Pulses shorter than the
+     *          interrupt service time are not reported. The interrupt itself
+     *          has to be enabled with bulkSetInterrupt. Subscriptions are
+     *          dispatched in addition to the setInterruptHandler callback.
+     *          The table holds YOTTA_CFG_GPIO_PCAL64_SUBSCRIPTIONS entries.
+     *
+     * @param pin Pin index, 0 is P0_0.
+     * @param edge Edges to report.
+     * @param callback Function called with the pin index and the edge.
+     * @return Subscription handle, or -1 if the pin is invalid or the table is full.
+     */
+    int8_t subscribe(uint8_t pin, edge_t edge, PinCallback_t callback);
+
+    /**
+     * @brief Remove a subscription.
+     * @param handle Value returned by subscribe.
+     */
+    void unsubscribe(int8_t handle);
+
+    /**
+     * @brief Debounce interrupts on the given pins.
+     * @details After the first edge the pin's interrupt is masked and the
+     *          edge is held back. When the period has passed the pins are
+     *          sampled once and their interrupt is unmasked again. An edge is
+     *          reported only if the sampled value differs from the value
+     *          before the first edge. Bounces in between cost no I2C traffic
+     *          and no handler calls. The interrupt has to be enabled with
+     *          bulkSetInterrupt; doing so again cancels a debounce in progress.
+     *
+     * @param pins Pins affected by this call.
+     * @param milliseconds Debounce period, 0 turns debouncing off.
+     */
+    void setDebounce(value_t pins, uint16_t milliseconds);
+
+    typedef enum {
+        STORM_DETECTED,         // pins masked and polled
+        STORM_CLEARED           // pins back on interrupts
+    } storm_t;
+
+    /**
+     * @brief Interrupt storm callback.
+     *
+     * @param uint16_t address
+     * @param storm_t transition
+     * @param value_t pins that made the transition
+     */
+    typedef FunctionPointer3<void, uint16_t, storm_t, value_t> StormCallback_t;
+
+    /**
+     * @brief Fall back to polling for pins that interrupt too often.
+     * @details A pin whose interrupt status is set more than limit times
+     *          within one window is masked and sampled every pollPeriod
+     *          milliseconds instead, so a faulty line cannot keep the bus
+     *          busy with interrupt service. Changes found by polling are
+     *          reported like interrupts. A polled pin that has not changed
+     *          for a whole window is unmasked again; polling only sees the
+     *          level at each sample, so a line toggling in step with the
+     *          poll period looks quiet. Debounced pins are
+     *          exempt, their interrupt is limited to one per period already.
+     *          Calling bulkSetInterrupt for a polled pin ends polling
+     *          without a report.
+     *
+     * @param limit Interrupts per pin and window, 0 turns protection off.
+     * @param window Window in milliseconds.
+     * @param pollPeriod Sampling period while polling, in milliseconds.
+     * @param callback Called with every transition, may be empty.
+     */
+    void setStormProtection(uint16_t limit, uint16_t window, uint16_t pollPeriod, StormCallback_t callback);
+
+    /**
+     * @brief Enable the write-through shadow register cache.
+     * @details The configuration, output, polarity, drive strength, input latch,
+     *          pull-up/down and interrupt mask registers are read once into a
+     *          local copy. While the shadow is enabled bulkWrite, bulkToggle and
+     *          bulkSetInterrupt only write to the device, and writes that would
+     *          not change a register are skipped altogether. The output port
+     *          configuration byte is read as well, for configure and
+     *          exportSnapshot.
+     *
+     * @param callback Function to call when the shadow has been loaded.
+     * @return Boolean result. True means command was accepted or queued, False means it was not.
+     */
+    bool enableShadowRegisters(FunctionPointer0<void> callback);
+
+    /**
+     * @brief Disable the shadow register cache.
+     * @details Subsequent commands read the device registers before modifying them.
+     */
+    void disableShadowRegisters(void);
+
+    /**
+     * @brief Reload the shadow register cache from the device.
+     * @details Must be called when the I/O expander has been reset behind the
+     *          driver's back, otherwise the shadow no longer matches the device.
+     *          The shadow is enabled when the reload has completed.
+     *
+     * @param callback Function to call when the shadow has been reloaded.
+     * @return Boolean result. True means command was accepted or queued, False means it was not.
+     */
+    bool resyncShadowRegisters(FunctionPointer0<void> callback);
+
+    /* banks in a snapshot: output, polarity, configuration, drive strength
+       0 and 1, input latch, pull-up/down enable and selection, interrupt mask
+    */
+    static const uint8_t SNAPSHOT_BANKS = 9;
+    static const uint8_t SNAPSHOT_VERSION = 1;
+
+    /**
+     * @brief Register state of the expander, for resume after a reset.
+     * @details Plain bytes, so it can be kept in retained RAM or flash as
+     *          is. Banks are in register order, port 0 first. The check
+     *          byte makes the sum of all bytes zero.
+     */
+    typedef struct {
+        uint8_t version;
+        uint8_t ports;
+        uint8_t banks[SNAPSHOT_BANKS][PORTS];
+        uint8_t outputPortConfiguration;
+        uint8_t check;
+    } snapshot_t;
+
+    /**
+     * @brief Copy the register state held by the shadow.
+     * @details Nothing is read from the device. Fails if the shadow is not
+     *          enabled, see enableShadowRegisters.
+     *
+     * @param snapshot Destination.
+     * @return Boolean result. True means the snapshot was taken.
+     */
+    bool exportSnapshot(snapshot_t& snapshot) const;
+
+    /**
+     * @brief Write a snapshot back to the device.
+     * @details Every register in the snapshot is written, without reading
+     *          first, in as few bursts as the register map allows. With
+     *          verify the registers are read back afterwards and compared.
+     *          The shadow is updated but not enabled. The snapshot is not
+     *          copied and must remain valid until the callback.
+     *
+     * @param snapshot State taken with exportSnapshot.
+     * @param verify Read the registers back.
+     * @param callback Called with true if the snapshot was written and, with
+     *        verify, read back unchanged.
+     * @return Boolean result. False if the snapshot is of another version,
+     *         another part or corrupt, or the command was not accepted.
+     */
+    bool restoreSnapshot(const snapshot_t& snapshot, bool verify, FunctionPointer1<void, bool> callback);
+    bool restoreSnapshotBlocking(const snapshot_t& snapshot, bool verify);
+
+    /**
+     * @brief Largest number of commands that have been waiting in the queue.
+     * @details Commands are queued when they are issued while the I/O expander
+     *          is busy and are started as soon as the previous one completes.
+     *          The queue depth is set with YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE.
+     *
+     * @return Queue high-water mark.
+     */
+    uint8_t getQueueHighWaterMark(void) const;
+
+    typedef PCAL64SampleRing<value_t> SampleRing_t;
+
+    /**
+     * @brief Read the pin values at a fixed rate into a ring buffer.
+     * @details Every period the input port is read in one burst and the
+     *          values are pushed into the ring with the time the read
+     *          started. There is no callback per sample; the application
+     *          drains the ring in batches. Samples are taken ahead of queued
+     *          commands. A sample that is still waiting for the bus when the
+     *          next one is due is taken only once and the missed period is
+     *          counted, see getSampleMisses. If interrupts are in use
+     *          the interrupt status is read first, as for bulkRead, so
+     *          sampling does not clear it unnoticed, see setStatusPreRead.
+     *
+     * @param ring Destination, must remain valid until stopSampling.
+     * @param period Sampling period in milliseconds.
+     * @return Boolean result. False if the period is zero.
+     */
+    bool startSampling(SampleRing_t& ring, uint32_t period);
+
+    /**
+     * @brief Stop the sampler started with startSampling.
+     * @details A read in progress completes but is not stored.
+     */
+    void stopSampling(void);
+
+    /**
+     * @brief Sample periods that were merged into the next one.
+     * @details A period is missed when its sample has not started by the
+     *          time the next one is due, because the bus is slow or busy.
+     *          No timestamp is stored for it. Samples that were taken but
+     *          did not fit in the ring are counted by the ring instead, see
+     *          PCAL64SampleRing::getOverruns. Reset by startSampling.
+     *
+     * @return Number of missed sample periods.
+     */
+    uint32_t getSampleMisses(void) const;
+
+    /**
+     * @brief Output pattern for playSequence, prepared ahead of time.
+     * @details prepare works out, for every frame, the output port bytes
+     *          and which ports change from the frame before, the last frame
+     *          wrapping around to the first. Pins outside the sequence keep
+     *          their values.
+     */
+    class Sequence
+    {
+    public:
+        typedef struct {
+            uint32_t delay;         // milliseconds after the previous frame
+            value_t values;         // output values of the sequence pins
+        } frame_t;
+
+        typedef struct {
+            minar::tick_t delay;
+            uint8_t changed;        // bitmap of ports
+            uint8_t bytes[PORTS];
+        } step_t;
+
+        /**
+         * @param steps Storage for capacity prepared frames.
+         */
+        Sequence(step_t* steps, uint16_t capacity);
+
+        /**
+         * @param frames Frames to prepare, only read during the call.
+         * @param count Number of frames.
+         * @param pins Pins driven by the sequence.
+         * @return Boolean result. False if count is zero or above the capacity.
+         */
+        bool prepare(const frame_t* frames, uint16_t count, value_t pins);
+
+    private:
+        friend class PCAL64Expander;
+
+        step_t* steps;
+        uint16_t capacity;
+        uint16_t count;
+        uint8_t portPins[PORTS];
+    };
+
+    /**
+     * @brief Play a prepared sequence on the output port.
+     * @details Each frame is a single write covering the ports that
+     *          changed, without a read, taken ahead of queued commands.
+     *          Deadlines are counted from the start, so late frames do not
+     *          delay the ones after. When a frame falls due before the one
+     *          before it has been written, the older frame is skipped and
+     *          counted as missed. The first frame writes every port. Needs
+     *          the shadow, see enableShadowRegisters, and the pins set to
+     *          output.
+     *
+     * @param sequence Prepared sequence, must remain valid until the callback or stopSequence.
+     * @param loop Start over after the last frame.
+     * @param callback Function to call when the last frame has been written, unless looping.
+     * @return Boolean result. False if the shadow is not enabled.
+     */
+    bool playSequence(const Sequence& sequence, bool loop, FunctionPointer0<void> callback);
+
+    /**
+     * @brief Stop the sequence, a write in progress completes.
+     */
+    void stopSequence(void);
+
+    /**
+     * @brief Number of frames skipped because the bus did not keep up,
+     *        or not written because the bus gave up on them.
+     */
+    uint32_t getFrameMisses(void) const;
+
+    typedef enum {
+        KEY_UP,
+        KEY_DOWN,
+        KEY_GHOSTING
+    } keypad_event_t;
+
+    /**
+     * @brief Key matrix callback function.
+     * @details Called with the row and column index, counted from the
+     *          lowest row and column pin, and the event. KEY_GHOSTING is
+     *          reported once when three or more keys make the matrix
+     *          ambiguous, with one of the ambiguous keys; the keys keep
+     *          their state until the matrix is unambiguous again.
+     *
+     * @param uint8_t row
+     * @param uint8_t column
+     * @param keypad_event_t event
+     */
+    typedef FunctionPointer3<void, uint8_t, uint8_t, keypad_event_t> KeypadCallback_t;
+
+    /**
+     * @brief Scan a key matrix of up to 8 rows and 8 columns.
+     * @details Rows are driven low and the column interrupts enabled with
+     *          the input latch off, so each scan read sees the live level;
+     *          the columns need pull-ups, see Config::pull. Nothing happens on
+     *          the bus until a column falls. The columns are then masked
+     *          and scanned with one configuration write and one input read
+     *          per row, each covering only the ports involved, and scanned
+     *          again every period while any key is held. When all keys are
+     *          up the column interrupts are enabled again. Column edges are
+     *          not passed on to the interrupt handler or subscriptions.
+     *          Needs the shadow, see enableShadowRegisters. Other interrupt
+     *          pins should not share a port with the columns, a scan clears
+     *          their status.
+     *
+     * @param rows Row pins.
+     * @param columns Column pins.
+     * @param period Scan period in milliseconds while keys are held.
+     * @param callback Called for every key event.
+     * @return Boolean result. False if the shadow is not enabled, the pins are invalid or the setup was not accepted.
+     */
+    bool startKeypad(value_t rows, value_t columns, uint16_t period, KeypadCallback_t callback);
+
+    /**
+     * @brief Stop scanning, the pins are left as they are.
+     */
+    void stopKeypad(void);
+
+#if YOTTA_CFG_GPIO_PCAL64_STATISTICS
+    /* Histogram bucket n counts latencies below 2^(n + 5) us, i.e. the first
+       bucket is below 64 us. The last bucket also holds everything longer.
+    */
+    static const uint8_t HISTOGRAM_BUCKETS = 12;
+
+    typedef struct {
+        uint32_t reads;
+        uint32_t writes;
+        uint32_t toggles;
+        uint32_t setInterrupts;
+        uint32_t shadowResyncs;
+        uint32_t configures;
+        uint32_t restores;
+
+        uint32_t transactions;
+        uint32_t queued;                // accepted while busy
+        uint32_t rejected;              // queue full or command abandoned
+        uint32_t overwritten;           // queued, then dropped for a newer command
+        uint32_t retries;               // transfers repeated after a failure
+
+        uint32_t irqs;
+        uint32_t irqBackupUsed;         // status was cleared by a concurrent read
+        uint32_t irqDeferred;           // arrived during a transfer
+        uint32_t irqCoalesced;          // merged into an event not yet delivered
+        uint32_t irqStorms;             // pins switched to polling
+
+        uint32_t commandLatency[HISTOGRAM_BUCKETS];
+        uint32_t irqLatency[HISTOGRAM_BUCKETS];
+    } statistics_t;
+
+    /**
+     * @brief Copy the statistics gathered since construction or the last reset.
+     * @details Only available when YOTTA_CFG_GPIO_PCAL64_STATISTICS is set.
+     *          Command latency runs from the API call to the completion callback
+     *          being posted, interrupt latency from the IRQ edge to the interrupt
+     *          callback being posted.
+     *
+     * @param snapshot Destination.
+     */
+    void getStatistics(statistics_t& snapshot) const;
+
+    /**
+     * @brief Zero all counters and histograms.
+     */
+    void resetStatistics(void);
+#endif
+
 private:
+    /* internal register width, one byte per port */
+    typedef typename Map::pins_t pins_t;
+
+    /* every bit of a register bank, and the bits of the pins that exist */
+    static constexpr pins_t ALL_BITS = (pins_t) (~0ULL >> (64 - 8 * PORTS));
+    static constexpr pins_t ALL_PINS = Map::ALL_PINS;
+
+    static_assert(PORTS <= PCAL64BusClient::MAX_TRANSFER, "register bank does not fit in a bus transfer");
+
+    static pins_t unpack(const uint8_t* buffer);
+    static void pack(uint8_t* buffer, pins_t value);
 
     void eventHandler(void);
     void internalHandlerIRQ(void);
     void internalHandlerTask(void);
+    bool serviceInterrupt(void);
+    bool servicingInterrupt(void) const;
+    bool interruptsInUse(void) const;
+    bool statusPreReadNeeded(void) const;
+
+    /* PCAL64BusClient */
+    virtual void transferDone(bool success);
+    virtual bool transferUrgent(void) const;
+
+    /* PCAL64InterruptSource */
+    virtual bool interruptPossible(void) const;
+    virtual void interruptRequest(void);
+
+    typedef enum {
+        SHADOW_OUTPUT,
+        SHADOW_POLARITY,
+        SHADOW_CONFIGURATION,
+        SHADOW_DRIVE_STRENGTH_0,
+        SHADOW_DRIVE_STRENGTH_1,
+        SHADOW_INPUT_LATCH,
+        SHADOW_PULL_UP_DOWN_ENABLE,
+        SHADOW_PULL_UP_DOWN_SELECTION,
+        SHADOW_INTERRUPT_MASK,
+        SHADOW_END
+    } shadow_t;
+
+    static const uint8_t shadowRegisters[SHADOW_END];
+    static const pins_t shadowDefaults[SHADOW_END];
+
+    /* Read-modify-write commands run a table of steps. Each step reads a
+       register bank, applies its rule to the pins of the command and writes
+       the bank back. A table ends with STEP_END.
+    */
+    typedef enum {
+        RULE_SET_ON_1,              // pins take the bits of param1
+        RULE_SET_ON_0,              // pins take the inverted bits of param1
+        RULE_DIRECTION_DELTA,       // (register & directionKeep) ^ directionFlip
+        RULE_OUTPUT_DELTA,          // (register & outputKeep) ^ outputFlip
+        RULE_RELEASE = 0x80         // flag: drop debounce and storm state of the pins
+    } rule_t;
+
+    typedef struct {
+        uint8_t reg;
+        uint8_t rule;
+    } step_t;
+
+    static const uint8_t STEP_END = 0xFF;
+
+    static const step_t outputSteps[];
+    static const step_t interruptSteps[];
+    static const step_t columnSteps[];
+    static const step_t maskSteps[];
+
+    typedef enum {
+        COMMAND_READ,
+        COMMAND_OUTPUT,
+        COMMAND_INTERRUPT,
+        COMMAND_SHADOW_SYNC,
+        COMMAND_NOTIFY,
+        COMMAND_CONFIGURE,
+        COMMAND_RESTORE,
+        COMMAND_COLUMNS,            // internal: key matrix columns, not latched
+        COMMAND_MASK,               // internal: set and clear interrupt mask bits
+        COMMAND_SAMPLE,             // internal: debounce and storm sample
+        COMMAND_STREAM,             // internal: sample for the ring
+        COMMAND_SEQUENCE,           // internal: sequence frame
+        COMMAND_SCAN                // internal: key matrix scan
+    } command_type_t;
 
-    I2CRegister i2c;
+    /* Output commands (bulkWrite and bulkToggle) are stored as register
+       deltas, register = (register & keep) ^ flip, so consecutive ones
+       can be merged into a single write.
+    */
+    typedef struct {
+        uint8_t type;
+        pins_t pins;
+        pins_t param1;
+        pins_t directionKeep;
+        pins_t directionFlip;
+        pins_t outputKeep;
+        pins_t outputFlip;
+        FunctionPointer0<void>          doneHandler;
+        FunctionPointer1<void, value_t> readHandler;
+        FunctionPointer2<void, value_t, value_t> statusReadHandler;
+        FunctionPointer1<void, bool>    restoreHandler;
+        const Config* config;
+        const snapshot_t* snapshot;
+#if YOTTA_CFG_GPIO_PCAL64_STATISTICS
+        uint32_t submitted;
+#endif
+    } command_t;
+
+    bool submit(const command_t& command);
+    bool submitPolled(const command_t& command);
+    void executePolled(void);
+    bool execute(const command_t& command);
+    void processQueue(void);
+    command_t* mergeTarget(const command_t& command);
+    bool dropOldest(void);
+    void merge(command_t& target, const command_t& command);
+
+    int8_t shadowSlot(uint8_t reg) const;
+    uint8_t shadowRun(uint8_t slot, uint16_t slots) const;
+    void configStep(void);
+    static pins_t configBits(uint8_t bank);
+    void restoreStep(void);
+    bool stepStart(const step_t* steps);
+    bool readRegister(uint8_t reg);
+    bool writeRegister(uint8_t reg, pins_t value);
+    bool readPorts(uint8_t reg, pins_t pins);
+    bool writePorts(uint8_t reg, pins_t pins, pins_t value);
+
+    /* A standalone expander builds its bus in ownBus, without the heap.
+       Expanders on a shared bus leave ownBus unused.
+    */
+    PCAL64Bus* bus;
+    alignas(PCAL64Bus) uint8_t ownBus[sizeof(PCAL64Bus)];
+    bool ownsBus;
     uint16_t address;
     InterruptIn irq;
+    bool irqConnected;
+    bool statusPreRead;
+
+    /* blocking call in progress: submit runs the command over polled I2C */
+    bool blocking;
+    bool transferFailed;
+
+    command_t current;
+    pins_t cache;
+
+    /* pins whose status a read has cleared, for the interrupt handler */
+    pins_t backupStatus;
+
+    /* most recent input port values, see getLastValues */
+    pins_t inputChanged(pins_t values, pins_t read);
+    static pins_t portsOf(pins_t pins);
+
+    pins_t inputValues;
+    bool inputValuesValid;
+
+    /* Output changes staged for the end of the scheduler callback, as an
+       output command. The flush is posted once per batch.
+    */
+    void stage(pins_t directionKeep, pins_t directionFlip, pins_t outputKeep, pins_t outputFlip);
+    void flushStaged(void);
+
+    command_t staged;
+    bool stagedPending;
+    bool stagedFlushPosted;
+
+    uint8_t readBuffer[PORTS];
+
+    /* configure: banks still to look at, banks to write and their values */
+    static_assert(Config::BANKS * PORTS <= PCAL64BusClient::MAX_TRANSFER, "configuration burst does not fit in a bus transfer");
+
+    uint8_t configBank;
+    uint8_t configRunBank;
+    uint8_t configRunCount;
+    uint8_t configChanged;
+    pins_t configValues[Config::BANKS];
+    uint8_t burstBuffer[Config::BANKS * PORTS];
+
+    pins_t shadow[SHADOW_END];
+    uint8_t shadowPortConfiguration;
+    bool shadowEnabled;
+    uint8_t shadowIndex;
+
+    /* restore: next slot to write or verify, size of the run in flight */
+    static_assert(SNAPSHOT_BANKS == SHADOW_END, "snapshot does not cover the shadow");
 
-    uint16_t pins;
-    uint16_t param1;
-    uint16_t param2;
-    uint16_t cache;
+    uint8_t restoreSlot;
+    uint8_t restoreRunCount;
+    bool restoreVerifying;
+    bool restoreMatch;
 
-    uint16_t backupStatus;
-    uint16_t backupValues;
+    command_t queue[YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE];
+    uint8_t queueHead;
+    uint8_t queueCount;
+    uint8_t queueHighWater;
 
-    uint8_t readBuffer[2];
+    /* Subscriptions for a pin are chained through next, starting at
+       subscriptionHead[pin]. Free entries are chained from subscriptionFree.
+    */
+    static const uint8_t PINS = 8 * PORTS;
+    static const uint8_t SUBSCRIPTION_NONE = 0xFF;
 
-    FunctionPointer0<void>                               externalDoneHandler;
-    FunctionPointer1<void, uint32_t>                     externalReadHandler;
-    FunctionPointer3<void, uint16_t, uint32_t, uint32_t> externalIRQHandler;
+    typedef struct {
+        PinCallback_t callback;
+        uint8_t edge;
+        uint8_t pin;
+        uint8_t next;
+    } subscription_t;
+
+    void updateSubscriptionMasks(void);
+    void dispatchSubscriptions(pins_t rising, pins_t falling, pins_t values);
+
+    subscription_t subscriptions[YOTTA_CFG_GPIO_PCAL64_SUBSCRIPTIONS];
+    uint8_t subscriptionHead[PINS];
+    uint8_t subscriptionFree;
+    pins_t subscribedRising;
+    pins_t subscribedFalling;
+
+    /* pin values read in the previous interrupt */
+    pins_t lastValues;
+    bool lastValuesValid;
+
+    /* Interrupt event waiting for deliverEvent. A single slot, interrupts
+       serviced before it is delivered are accumulated into it.
+    */
+    void queueEvent(pins_t status, pins_t values);
+    void deliverEvent(void);
+
+    pins_t eventStatus;
+    pins_t eventValues;
+    pins_t eventRising;
+    pins_t eventFalling;
+    bool eventPosted;
+
+    /* Interrupt mask changes and samples requested by debounce and storm
+       protection. They are carried out by processQueue ahead of queued
+       commands.
+    */
+    bool executeInternal(void);
+
+    pins_t maskPending;
+    pins_t unmaskPending;
+    bool samplePending;
+
+    /* Pins the application has masked. A status bit they set before the
+       mask took effect starts neither debounce nor polling, whose end
+       would unmask them again.
+    */
+    pins_t interruptsOff;
+
+    /* Debounce. Pins in debouncing are masked and wait for their deadline. */
+    pins_t debounceStart(pins_t status);
+    void debounceResolve(pins_t values);
+    void debounceArm(void);
+    void debounceTimeout(void);
+
+    uint16_t debouncePeriod[PINS];
+    minar::tick_t debounceDeadline[PINS];
+    pins_t debounceEnabled;
+    pins_t debouncing;
+    pins_t debounceUnknown;
+    minar::callback_handle_t debounceTimer;
+
+    /* Pins the interrupt path masked to debounce them. They debounce even
+       if debounce is turned off before the input read, or nothing would
+       unmask them.
+    */
+    pins_t debounceMasked;
+
+    /* Storm protection. Pins in storming are masked and polled. Interrupts
+       are counted per pin in fixed windows.
+    */
+    void stormCheck(pins_t status);
+    void stormPoll(pins_t values);
+    void stormRestore(pins_t pins);
+    void stormTimeout(void);
+    void stormReport(storm_t transition, pins_t pins);
+
+    uint16_t stormLimit;
+    uint16_t stormWindow;
+    uint16_t stormPollPeriod;
+    StormCallback_t stormHandler;
+    uint16_t stormCount[PINS];
+    minar::tick_t stormWindowStart;
+    pins_t storming;
+    pins_t stormChanged;            // polled pins that changed in the quiet window
+    minar::tick_t stormQuietStart;
+    minar::callback_handle_t stormTimer;
+
+    /* Sampler. One periodic minar callback, streamPending is set until the
+       sample has started.
+    */
+    void streamTimeout(void);
+
+    SampleRing_t* streamRing;
+    minar::callback_handle_t streamTimer;
+    uint32_t streamTimestamp;
+    bool streamPending;
+    uint32_t streamMissed;
+
+    /* Sequence player. sequenceNext is the frame the timer is set for,
+       sequenceFrame the latest due frame, sequencePorts the ports changed
+       by due frames not yet written. The shadow takes a frame once its
+       write has succeeded.
+    */
+    void sequenceTimeout(void);
+    void sequenceWrite(void);
+    void sequenceFrameEnd(bool written);
+
+    const Sequence* sequence;
+    FunctionPointer0<void> sequenceHandler;
+    minar::callback_handle_t sequenceTimer;
+    minar::tick_t sequenceDeadline;
+    uint16_t sequenceNext;
+    uint16_t sequenceFrame;
+    uint8_t sequencePorts;
+    uint8_t sequenceWriting;
+    pins_t sequenceOutput;
+    bool sequenceLoop;
+    bool sequencePending;
+    uint32_t sequenceMisses;
+
+    /* Key matrix. keypadScanning is set from the first column interrupt
+       until a scan finds all keys up; meanwhile the columns are masked.
+    */
+    static const uint8_t KEYPAD_LINES = 8;
+
+    pins_t keypadInterrupt(pins_t status);
+    void keypadStep(void);
+    void keypadResolve(void);
+    void keypadTimeout(void);
+
+    pins_t keypadRows;
+    pins_t keypadColumns;
+    uint8_t keypadRowCount;
+    uint8_t keypadColumnCount;
+    uint8_t keypadRowPin[KEYPAD_LINES];
+    uint8_t keypadColumnPin[KEYPAD_LINES];
+    uint16_t keypadPeriod;
+    KeypadCallback_t keypadHandler;
+    uint8_t keypadState[KEYPAD_LINES];      // columns down, per row
+    uint8_t keypadScan[KEYPAD_LINES];
+    uint8_t keypadRow;
+    bool keypadScanning;
+    bool keypadScanPending;
+    bool keypadGhosting;
+    minar::callback_handle_t keypadTimer;
+
+    /* Retry policy. retryCount counts the retries of the transfer in
+       flight, retryTimer is set while waiting for the next one.
+    */
+    void retryTimeout(void);
+    void reportFailure(failure_t failure);
+
+    uint8_t retryLimit;
+    uint8_t retryCount;
+    uint16_t retryBackoff;
+    ErrorCallback_t errorHandler;
+    minar::callback_handle_t retryTimer;
+
+    volatile bool irqPending;
+    volatile bool irqTaskPosted;
+
+#if YOTTA_CFG_GPIO_PCAL64_STATISTICS
+    void recordLatency(uint32_t* histogram, uint32_t since);
+
+    statistics_t statistics;
+    volatile uint32_t irqEdge;
+#endif
+
+    IRQCallback_t externalIRQHandler;
 
     typedef enum {
         STATE_READ_GET_STATUS,
         STATE_READ_GET_VALUES,
-        STATE_WRITE_GET_DIRECTIONS,
-        STATE_WRITE_SET_DIRECTIONS,
-        STATE_WRITE_GET_VALUES,
-        STATE_TOGGLE_GET_VALUES,
-        STATE_INTERRUPT_GET_DIRECTIONS,
-        STATE_INTERRUPT_SET_DIRECTIONS,
-        STATE_INTERRUPT_GET_LATCH,
-        STATE_INTERRUPT_SET_LATCH,
-        STATE_INTERRUPT_GET_MASK,
+        STATE_STEP_GET,
+        STATE_STEP_SET,
         STATE_INTERRUPT_GET_STATUS,
+        STATE_INTERRUPT_SET_MASK,
         STATE_INTERRUPT_GET_VALUES,
+        STATE_SHADOW_GET_REGISTER,
+        STATE_SHADOW_GET_PORTS,
+        STATE_CONFIG_GET_BANKS,
+        STATE_CONFIG_SET_BANKS,
+        STATE_CONFIG_GET_PORTS,
+        STATE_RESTORE_SET_BANKS,
+        STATE_RESTORE_SET_PORTS,
+        STATE_RESTORE_GET_BANKS,
+        STATE_RESTORE_GET_PORTS,
+        STATE_SEQUENCE_SET_PORTS,
+        STATE_KEYPAD_SET_ROW,
+        STATE_KEYPAD_GET_COLUMNS,
+        STATE_KEYPAD_SET_ROWS,
+        STATE_KEYPAD_GET_IDLE,
         STATE_SIGNAL_DONE,
         STATE_IDLE
     } state_t;
 
     state_t state;
 
-    typedef enum {
-        INPUT_PORT_0                    = 0x00,
-        INPUT_PORT_1                    = 0x01,
-        OUTPUT_PORT_0                   = 0x02,
-        OUTPUT_PORT_1                   = 0x03,
-        POLARITY_INVERSION_PORT_0       = 0x04,
-        POLARITY_INVERSION_PORT_1       = 0x05,
-        CONFIGURATION_PORT_0            = 0x06,
-        CONFIGURATION_PORT_1            = 0x07,
-
-        OUTPUT_DRIVE_STRENGTH_0_LOW     = 0x40,
-        OUTPUT_DRIVE_STRENGTH_0_HIGH    = 0x41,
-        OUTPUT_DRIVE_STRENGTH_1_LOW     = 0x42,
-        OUTPUT_DRIVE_STRENGTH_1_HIGH    = 0x43,
-        INPUT_LATCH_0                   = 0x44,
-        INPUT_LATCH_1                   = 0x45,
-        PULL_UP_DOWN_ENABLE_0           = 0x46,
-        PULL_UP_DOWN_ENABLE_1           = 0x47,
-        PULL_UP_DOWN_SELECTION_0        = 0x48,
-        PULL_UP_DOWN_SELECTION_1        = 0x49,
-        INTERRUPT_MASK_0                = 0x4A,
-        INTERRUPT_MASK_1                = 0x4B,
-        INTERRUPT_STATUS_0              = 0x4C,
-        INTERRUPT_STATUS_1              = 0x4D,
-        OUTPUT_PORT_CONFIGURATION       = 0x4F
-    } register_t;
+    /* step in progress of a read-modify-write command */
+    const step_t* step;
+
+    /* command parked while an interrupt is serviced */
+    state_t resumeState;
+    uint8_t resumeBuffer[PORTS];
+
+    /* the service has reported the status a parked read holds */
+    bool statusServiced;
 };
 
+typedef PCAL64Expander<PCAL6416AMap> PCAL64;
+typedef PCAL64Expander<PCAL6524Map> PCAL6524;
+typedef PCAL64Expander<PCAL6534Map> PCAL6534;
+
 #endif // __GPIO_PCAL64_H__
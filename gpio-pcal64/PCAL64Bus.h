@@ -0,0 +1,238 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __GPIO_PCAL64_BUS_H__
+#define __GPIO_PCAL64_BUS_H__
+
+#include "mbed-drivers/mbed.h"
+#include "wrd-utilities/I2CRegister.h"
+
+using namespace mbed::util;
+
+/* Transfer timeout in milliseconds, 0 for none. See PCAL64Bus::setTimeout. */
+/* The longest transfer, 25 data bytes, takes 2.6 ms at 100 kHz. */
+#ifndef YOTTA_CFG_GPIO_PCAL64_TRANSFER_TIMEOUT
+#define YOTTA_CFG_GPIO_PCAL64_TRANSFER_TIMEOUT 10
+#endif
+
+class PCAL64Bus;
+
+/**
+ * @brief Device side of the shared bus.
+ * @details A client has at most one transfer outstanding. The transfer
+ *          arguments are kept in the client until the bus grants it.
+ */
+class PCAL64BusClient
+{
+public:
+    /* largest transfer, five register banks of the widest part in one burst */
+    static const uint8_t MAX_TRANSFER = 25;
+
+    PCAL64BusClient(void);
+    virtual ~PCAL64BusClient(void) {}
+
+protected:
+    /**
+     * @brief Called from the bus when the client's transfer has completed.
+     * @param success False if the transfer was not accepted by I2CRegister
+     *        or did not complete within the bus timeout. The arguments are
+     *        kept, PCAL64Bus::retry starts the same transfer again.
+     */
+    virtual void transferDone(bool success) = 0;
+
+    /**
+     * @brief Transfers of urgent clients are granted before all others.
+     * @details Used for interrupt servicing.
+     */
+    virtual bool transferUrgent(void) const = 0;
+
+private:
+    friend class PCAL64Bus;
+
+    PCAL64BusClient* next;
+
+    bool pending;
+    bool isRead;
+    uint16_t address;
+    uint8_t reg;
+    uint8_t length;
+    uint8_t* readData;
+    uint8_t writeData[MAX_TRANSFER];
+};
+
+/**
+ * @brief Arbiter for several I/O expanders on one I2C bus.
+ * @details Every register access of every attached expander is one
+ *          transfer. When a transfer completes the next one is started
+ *          straight from the completion, so the bus is kept busy
+ *          back-to-back. Clients servicing an interrupt go first, otherwise
+ *          transfers are granted round-robin, one per client per turn, so a
+ *          long command on one expander cannot hold up the others.
+ *
+ *          The bus must outlive the expanders attached to it.
+ */
+class PCAL64Bus
+{
+public:
+    PCAL64Bus(PinName sda, PinName scl);
+    ~PCAL64Bus(void);
+
+    /**
+     * @brief Set the I2C clock. The default is 400 kHz.
+     */
+    void frequency(uint32_t hz);
+
+    /**
+     * @brief Give up on transfers that do not complete in time.
+     * @details A watchdog runs while the bus is busy and looks at the
+     *          transfer in progress once per timeout period, so a stuck
+     *          transfer is abandoned after one to two periods: it is
+     *          aborted, the bus is recovered and the client gets
+     *          transferDone(false). A completion that still arrives
+     *          afterwards is counted and ignored.
+     *          The default is YOTTA_CFG_GPIO_PCAL64_TRANSFER_TIMEOUT.
+     *
+     * @param milliseconds Timeout, 0 turns the watchdog off.
+     */
+    void setTimeout(uint16_t milliseconds);
+
+    /**
+     * @brief Free a slave that holds SDA low.
+     * @details SCL is clocked by hand, up to nine times, until the slave
+     *          lets go of SDA, then a STOP is generated and the pins are
+     *          handed back to the I2C peripheral. Called after a timeout;
+     *          may also be called at startup, while the bus is idle.
+     *
+     * @return Boolean result. True if SDA was released.
+     */
+    bool recover(void);
+
+    /**
+     * @brief Number of transfers abandoned by the watchdog.
+     */
+    uint32_t getTimeouts(void) const;
+
+    /**
+     * @brief Number of completions of abandoned transfers that arrived late.
+     */
+    uint32_t getStaleCompletions(void) const;
+
+    void attach(PCAL64BusClient* client);
+
+    /**
+     * @brief Remove a client, e.g. from its destructor.
+     * @details A transfer of the client in progress is aborted and its
+     *          completion or failure is not delivered. The next client
+     *          gets the bus.
+     */
+    void detach(PCAL64BusClient* client);
+
+    /**
+     * @brief Read from the device, or queue the read until it is the client's turn.
+     * @details The data buffer must remain valid until transferDone is called.
+     *
+     * @return Boolean result. False if length is over MAX_TRANSFER. A transfer
+     *         that I2CRegister refuses fails later, through transferDone.
+     */
+    bool read(PCAL64BusClient* client, uint16_t address, uint8_t reg, uint8_t* data, uint8_t length);
+
+    /**
+     * @brief Write to the device, or queue the write until it is the client's turn.
+     * @details The data is copied.
+     *
+     * @return Boolean result. False if length is over MAX_TRANSFER. A transfer
+     *         that I2CRegister refuses fails later, through transferDone.
+     */
+    bool write(PCAL64BusClient* client, uint16_t address, uint8_t reg, const uint8_t* data, uint8_t length);
+
+    /**
+     * @brief Run transfers with polled I2C while body is called.
+     * @details For use before the minar scheduler runs. A temporary mbed
+     *          I2C object on the bus pins carries every transfer started from
+     *          body, and each completion is delivered before the transfer
+     *          call returns, so a whole command runs to its end inside body.
+     *
+     * @return Boolean result. False if a transfer was in progress or waiting, body is not called then.
+     */
+    bool polled(FunctionPointer0<void> body);
+
+    /**
+     * @brief Start the client's last transfer again, after transferDone(false).
+     */
+    bool retry(PCAL64BusClient* client);
+
+private:
+    bool submit(PCAL64BusClient* client);
+    bool start(PCAL64BusClient* client);
+    bool startPolled(PCAL64BusClient* client);
+    PCAL64BusClient* nextClient(void) const;
+    void schedule(void);
+    void transferDone(void);
+    void transferFailed(void);
+    void watchdogTimeout(void);
+    void abort(void);
+
+    /* Completion target handed to I2CRegister, stamped with the transfer it
+       belongs to. A target stays taken until its completion arrives, so a
+       late completion of an abandoned transfer is not mistaken for that of
+       its retry. Once all are taken, by transfers that never completed, the
+       oldest is reused.
+    */
+    static const uint8_t COMPLETIONS = 4;
+
+    class Completion
+    {
+    public:
+        void done(void);
+
+        PCAL64Bus* bus;
+        uint32_t sequence;
+        bool taken;
+    };
+
+    Completion completions[COMPLETIONS];
+
+    I2CRegister i2c;
+    PinName sda;
+    PinName scl;
+    uint32_t hz;
+
+    /* set while polled() runs */
+    I2C* polledI2C;
+
+    /* attached clients, singly linked through PCAL64BusClient::next */
+    PCAL64BusClient* clients;
+
+    PCAL64BusClient* active;
+    PCAL64BusClient* last;
+
+    /* transferFailed posted for a transfer that was refused */
+    minar::callback_handle_t failedCallback;
+
+    /* a completion is being delivered, new transfers wait for schedule() */
+    bool dispatching;
+
+    /* transfers started asynchronously, the latest is the active one */
+    uint32_t sequence;
+    minar::tick_t started;
+
+    uint16_t timeout;
+    minar::callback_handle_t watchdogTimer;
+    uint32_t timeouts;
+    uint32_t staleCompletions;
+};
+
+#endif // __GPIO_PCAL64_BUS_H__
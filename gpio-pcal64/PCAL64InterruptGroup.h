@@ -0,0 +1,113 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __GPIO_PCAL64_INTERRUPT_GROUP_H__
+#define __GPIO_PCAL64_INTERRUPT_GROUP_H__
+
+#include "mbed-drivers/mbed.h"
+
+class PCAL64InterruptGroup;
+
+/**
+ * @brief Expander side of a shared interrupt line.
+ */
+class PCAL64InterruptSource
+{
+public:
+    PCAL64InterruptSource(void);
+    virtual ~PCAL64InterruptSource(void);
+
+protected:
+    /**
+     * @brief False only if the expander is known to have no unmasked input.
+     */
+    virtual bool interruptPossible(void) const = 0;
+
+    /**
+     * @brief Read the interrupt status and dispatch to the interrupt handler.
+     * @details Called in minar context. The expander must call
+     *          interruptServiced when it is done, also when it failed.
+     */
+    virtual void interruptRequest(void) = 0;
+
+    /**
+     * @brief Report back to the group.
+     * @param fired True if the interrupt status register had bits set.
+     */
+    void interruptServiced(bool fired);
+
+    /**
+     * @brief True while the source is attached to a group.
+     */
+    bool interruptAttached(void) const;
+
+private:
+    friend class PCAL64InterruptGroup;
+
+    PCAL64InterruptGroup* group;
+    PCAL64InterruptSource* next;
+
+    /* the group is waiting for interruptServiced */
+    bool requested;
+};
+
+/**
+ * @brief Several expanders with their INT outputs wired to one pin.
+ * @details The group owns the InterruptIn; attached expanders must be
+ *          constructed without an IRQ pin. On a falling edge the group asks
+ *          every expander that could have fired, judged by its shadow
+ *          configuration and interrupt mask, to read its interrupt status.
+ *          When all have reported back and the line is still low, the
+ *          round is repeated so no edge is lost. A round in which no
+ *          expander found status bits ends the sequence.
+ */
+class PCAL64InterruptGroup
+{
+public:
+    PCAL64InterruptGroup(PinName irq);
+    ~PCAL64InterruptGroup(void);
+
+    void attach(PCAL64InterruptSource& source);
+    void detach(PCAL64InterruptSource& source);
+
+    /**
+     * @brief Number of times the status registers were read in a round.
+     * @details One per expander asked, including rounds repeated because
+     *          the line was still asserted.
+     */
+    uint32_t getStatusReads(void) const;
+
+private:
+    friend class PCAL64InterruptSource;
+
+    void internalHandlerIRQ(void);
+    void internalHandlerTask(void);
+    void startRound(void);
+    void serviced(PCAL64InterruptSource& source, bool fired);
+
+    InterruptIn irq;
+
+    /* attached sources, singly linked through PCAL64InterruptSource::next */
+    PCAL64InterruptSource* sources;
+
+    uint8_t outstanding;
+    bool fired;
+    volatile bool edgePending;
+
+    uint32_t statusReads;
+};
+
+#endif // __GPIO_PCAL64_INTERRUPT_GROUP_H__
@@ -0,0 +1,93 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __GPIO_PCAL64_PIN_H__
+#define __GPIO_PCAL64_PIN_H__
+
+#include "gpio-pcal64/PCAL64.h"
+
+/**
+ * @brief DigitalInOut-style handle for a single expander pin.
+ * @details A reference to the expander and the pin bitmap, nothing else;
+ *          copy it freely. Writes are staged on the expander, so writes to
+ *          any number of pins within one scheduler callback become a
+ *          single output command. Reads return the value from the most
+ *          recent read of the input port, see refresh.
+ *
+ *          PCAL64Pin<PCAL64> led(expander, PCAL64::P0_3);
+ */
+template <class Expander>
+class PCAL64Pin
+{
+public:
+    typedef typename Expander::value_t value_t;
+
+    PCAL64Pin(Expander& _expander, value_t _pin)
+        :   expander(&_expander),
+            pin(_pin)
+    {
+    }
+
+    void output(void)
+    {
+        expander->stageDirection(pin, pin);
+    }
+
+    void input(void)
+    {
+        expander->stageDirection(pin, 0);
+    }
+
+    void write(int value)
+    {
+        expander->stageWrite(pin, value ? pin : 0);
+    }
+
+    /**
+     * @brief Level at the most recent read, 0 or 1.
+     */
+    int read(void) const
+    {
+        return (expander->getLastValues() & pin) ? 1 : 0;
+    }
+
+    /**
+     * @brief Read the input port, and with it every pin of the expander.
+     * @return Boolean result. True means command was accepted or queued, False means it was not.
+     */
+    bool refresh(FunctionPointer0<void> callback)
+    {
+        return expander->refreshValues(callback);
+    }
+
+    PCAL64Pin& operator=(int value)
+    {
+        write(value);
+
+        return *this;
+    }
+
+    operator int() const
+    {
+        return read();
+    }
+
+private:
+    Expander* expander;
+    value_t pin;
+};
+
+#endif // __GPIO_PCAL64_PIN_H__
@@ -0,0 +1,235 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __GPIO_PCAL64_REGISTER_MAP_H__
+#define __GPIO_PCAL64_REGISTER_MAP_H__
+
+#include <stdint.h>
+
+/* Register maps for the PCAL64 template.
+
+   Every register bank holds one byte per port and is transferred in a
+   single burst of PORTS bytes. Output drive strength uses two bits per pin
+   and is handled as two consecutive banks.
+
+   AUTO_INCREMENT is OR'ed into the command byte of every transfer. The
+   PCAL6416A has no auto-increment flag; bytes of a burst alternate between
+   the two registers of the addressed bank, which is exactly one bank. The
+   larger parts only move through the register file when bit 7 is set.
+
+   ALL_PINS holds the pins that exist. The last port of the PCAL6534 has two
+   pins; the other bits of its register banks are left as they are read.
+*/
+
+/**
+ * @brief Pin names of the PCAL6416A, see PCAL64Expander.
+ */
+struct PCAL6416APins
+{
+    typedef enum {
+        P0_0 = (1 <<  0),
+        P0_1 = (1 <<  1),
+        P0_2 = (1 <<  2),
+        P0_3 = (1 <<  3),
+        P0_4 = (1 <<  4),
+        P0_5 = (1 <<  5),
+        P0_6 = (1 <<  6),
+        P0_7 = (1 <<  7),
+
+        P1_0 = (1 <<  8),
+        P1_1 = (1 <<  9),
+        P1_2 = (1 << 10),
+        P1_3 = (1 << 11),
+        P1_4 = (1 << 12),
+        P1_5 = (1 << 13),
+        P1_6 = (1 << 14),
+        P1_7 = (1 << 15),
+        Pin_End
+    } pin_t;
+};
+
+/**
+ * @brief Pin names of the PCAL6524, see PCAL64Expander.
+ */
+struct PCAL6524Pins
+{
+    typedef enum {
+        P0_0 = (1 <<  0),
+        P0_1 = (1 <<  1),
+        P0_2 = (1 <<  2),
+        P0_3 = (1 <<  3),
+        P0_4 = (1 <<  4),
+        P0_5 = (1 <<  5),
+        P0_6 = (1 <<  6),
+        P0_7 = (1 <<  7),
+
+        P1_0 = (1 <<  8),
+        P1_1 = (1 <<  9),
+        P1_2 = (1 << 10),
+        P1_3 = (1 << 11),
+        P1_4 = (1 << 12),
+        P1_5 = (1 << 13),
+        P1_6 = (1 << 14),
+        P1_7 = (1 << 15),
+
+        P2_0 = (1 << 16),
+        P2_1 = (1 << 17),
+        P2_2 = (1 << 18),
+        P2_3 = (1 << 19),
+        P2_4 = (1 << 20),
+        P2_5 = (1 << 21),
+        P2_6 = (1 << 22),
+        P2_7 = (1 << 23),
+        Pin_End
+    } pin_t;
+};
+
+/**
+ * @brief Pin names of the PCAL6534, see PCAL64Expander.
+ */
+struct PCAL6534Pins
+{
+    typedef enum : uint64_t {
+        P0_0 = (1ULL <<  0),
+        P0_1 = (1ULL <<  1),
+        P0_2 = (1ULL <<  2),
+        P0_3 = (1ULL <<  3),
+        P0_4 = (1ULL <<  4),
+        P0_5 = (1ULL <<  5),
+        P0_6 = (1ULL <<  6),
+        P0_7 = (1ULL <<  7),
+
+        P1_0 = (1ULL <<  8),
+        P1_1 = (1ULL <<  9),
+        P1_2 = (1ULL << 10),
+        P1_3 = (1ULL << 11),
+        P1_4 = (1ULL << 12),
+        P1_5 = (1ULL << 13),
+        P1_6 = (1ULL << 14),
+        P1_7 = (1ULL << 15),
+
+        P2_0 = (1ULL << 16),
+        P2_1 = (1ULL << 17),
+        P2_2 = (1ULL << 18),
+        P2_3 = (1ULL << 19),
+        P2_4 = (1ULL << 20),
+        P2_5 = (1ULL << 21),
+        P2_6 = (1ULL << 22),
+        P2_7 = (1ULL << 23),
+
+        P3_0 = (1ULL << 24),
+        P3_1 = (1ULL << 25),
+        P3_2 = (1ULL << 26),
+        P3_3 = (1ULL << 27),
+        P3_4 = (1ULL << 28),
+        P3_5 = (1ULL << 29),
+        P3_6 = (1ULL << 30),
+        P3_7 = (1ULL << 31),
+
+        P4_0 = (1ULL << 32),
+        P4_1 = (1ULL << 33),
+        Pin_End
+    } pin_t;
+};
+
+/**
+ * @brief 16-bit PCAL6416A.
+ */
+struct PCAL6416AMap
+{
+    static constexpr uint8_t PORTS = 2;
+    static constexpr uint8_t AUTO_INCREMENT = 0x00;
+
+    typedef uint16_t pins_t;
+    typedef uint32_t value_t;
+    typedef PCAL6416APins Pins;
+
+    static constexpr pins_t ALL_PINS = 0xFFFF;
+
+    enum {
+        INPUT_PORT                  = 0x00,
+        OUTPUT_PORT                 = 0x02,
+        POLARITY_INVERSION          = 0x04,
+        CONFIGURATION               = 0x06,
+        OUTPUT_DRIVE_STRENGTH       = 0x40,
+        INPUT_LATCH                 = 0x44,
+        PULL_UP_DOWN_ENABLE         = 0x46,
+        PULL_UP_DOWN_SELECTION      = 0x48,
+        INTERRUPT_MASK              = 0x4A,
+        INTERRUPT_STATUS            = 0x4C,
+        OUTPUT_PORT_CONFIGURATION   = 0x4F
+    };
+};
+
+/**
+ * @brief 24-bit PCAL6524.
+ */
+struct PCAL6524Map
+{
+    static constexpr uint8_t PORTS = 3;
+    static constexpr uint8_t AUTO_INCREMENT = 0x80;
+
+    typedef uint32_t pins_t;
+    typedef uint32_t value_t;
+    typedef PCAL6524Pins Pins;
+
+    static constexpr pins_t ALL_PINS = 0xFFFFFF;
+
+    enum {
+        INPUT_PORT                  = 0x00,
+        OUTPUT_PORT                 = 0x04,
+        POLARITY_INVERSION          = 0x08,
+        CONFIGURATION               = 0x0C,
+        OUTPUT_DRIVE_STRENGTH       = 0x40,
+        INPUT_LATCH                 = 0x48,
+        PULL_UP_DOWN_ENABLE         = 0x4C,
+        PULL_UP_DOWN_SELECTION      = 0x50,
+        INTERRUPT_MASK              = 0x54,
+        INTERRUPT_STATUS            = 0x58,
+        OUTPUT_PORT_CONFIGURATION   = 0x5C
+    };
+};
+
+/**
+ * @brief 34-bit PCAL6534, five ports of which the last has two pins.
+ */
+struct PCAL6534Map
+{
+    static constexpr uint8_t PORTS = 5;
+    static constexpr uint8_t AUTO_INCREMENT = 0x80;
+
+    typedef uint64_t pins_t;
+    typedef uint64_t value_t;
+    typedef PCAL6534Pins Pins;
+
+    static constexpr pins_t ALL_PINS = 0x3FFFFFFFFULL;
+
+    enum {
+        INPUT_PORT                  = 0x00,
+        OUTPUT_PORT                 = 0x05,
+        POLARITY_INVERSION          = 0x0A,
+        CONFIGURATION               = 0x0F,
+        OUTPUT_DRIVE_STRENGTH       = 0x30,
+        INPUT_LATCH                 = 0x3A,
+        PULL_UP_DOWN_ENABLE         = 0x3F,
+        PULL_UP_DOWN_SELECTION      = 0x44,
+        INTERRUPT_MASK              = 0x49,
+        INTERRUPT_STATUS            = 0x4E,
+        OUTPUT_PORT_CONFIGURATION   = 0x53
+    };
+};
+
+#endif // __GPIO_PCAL64_REGISTER_MAP_H__
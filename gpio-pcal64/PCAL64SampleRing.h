@@ -0,0 +1,140 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __GPIO_PCAL64_SAMPLE_RING_H__
+#define __GPIO_PCAL64_SAMPLE_RING_H__
+
+#include <stdint.h>
+
+/**
+ * @brief Single-producer, single-consumer ring of timestamped pin samples.
+ * @details The storage is provided by the caller. The expander is the only
+ *          producer; one consumer drains samples in batches, from minar or
+ *          from an interrupt, without locking. When the ring is full new
+ *          samples are dropped and counted as overruns, the producer never
+ *          touches the read index.
+ */
+template <typename V>
+class PCAL64SampleRing
+{
+public:
+    typedef struct {
+        uint32_t timestamp;         // us_ticker_read() when the read started
+        V values;
+    } sample_t;
+
+    /**
+     * @param buffer Storage for capacity samples.
+     * @param capacity Number of slots. One slot is kept free, so the ring
+     *        holds capacity - 1 samples.
+     */
+    PCAL64SampleRing(sample_t* _buffer, uint16_t _capacity)
+        :   buffer(_buffer),
+            capacity(_capacity),
+            head(0),
+            tail(0),
+            overruns(0)
+    {
+    }
+
+    /**
+     * @brief Producer side, append a sample.
+     * @return False if the ring was full and the sample was dropped.
+     */
+    bool push(uint32_t timestamp, V values)
+    {
+        uint16_t write = head;
+        uint16_t next = (write + 1 == capacity) ? 0 : write + 1;
+
+        if (next == tail)
+        {
+            overruns++;
+
+            return false;
+        }
+
+        sample_t& sample = buffer[write];
+        sample.timestamp = timestamp;
+        sample.values = values;
+
+        /* the sample must be complete before the consumer can see it */
+        __sync_synchronize();
+
+        head = next;
+
+        return true;
+    }
+
+    /**
+     * @brief Consumer side, move up to max samples out of the ring, oldest first.
+     * @return Number of samples copied.
+     */
+    uint16_t pop(sample_t* destination, uint16_t max)
+    {
+        uint16_t read = tail;
+        uint16_t write = head;
+        uint16_t count = 0;
+
+        /* do not read slots ahead of the head that was loaded */
+        __sync_synchronize();
+
+        while ((read != write) && (count < max))
+        {
+            destination[count++] = buffer[read];
+
+            read = (read + 1 == capacity) ? 0 : read + 1;
+        }
+
+        /* the copies must be done before the producer may reuse the slots */
+        __sync_synchronize();
+
+        tail = read;
+
+        return count;
+    }
+
+    /**
+     * @brief Number of samples waiting.
+     */
+    uint16_t available(void) const
+    {
+        uint16_t write = head;
+        uint16_t read = tail;
+
+        return (write >= read) ? write - read : capacity - read + write;
+    }
+
+    /**
+     * @brief Number of samples dropped because the ring was full.
+     */
+    uint32_t getOverruns(void) const
+    {
+        return overruns;
+    }
+
+private:
+    sample_t* buffer;
+    uint16_t capacity;
+
+    /* slot indexes, head is written by the producer only, tail by the
+       consumer only. head == tail is empty.
+    */
+    volatile uint16_t head;
+    volatile uint16_t tail;
+    volatile uint32_t overruns;
+};
+
+#endif // __GPIO_PCAL64_SAMPLE_RING_H__
@@ -16,147 +16,2711 @@
 
 #include "gpio-pcal64/PCAL64.h"
 
-PCAL64::PCAL64(PinName sda, PinName scl, uint16_t _address, PinName _irq)
-    :   i2c(sda, scl),
+#include <new>
+
+#if YOTTA_CFG_GPIO_PCAL64_STATISTICS
+#define STATISTICS(x) x
+#else
+#define STATISTICS(x)
+#endif
+
+template <class Map>
+constexpr uint8_t PCAL64Expander<Map>::PORTS;
+
+template <class Map>
+constexpr typename PCAL64Expander<Map>::pins_t PCAL64Expander<Map>::ALL_BITS;
+
+template <class Map>
+constexpr typename PCAL64Expander<Map>::pins_t PCAL64Expander<Map>::ALL_PINS;
+
+/* Registers kept in the shadow, in shadow_t order, and their power-on values.
+   Drive strength has two bits per pin and is kept as two banks.
+*/
+template <class Map>
+const uint8_t PCAL64Expander<Map>::shadowRegisters[PCAL64Expander<Map>::SHADOW_END] = {
+    Map::OUTPUT_PORT,
+    Map::POLARITY_INVERSION,
+    Map::CONFIGURATION,
+    Map::OUTPUT_DRIVE_STRENGTH,
+    Map::OUTPUT_DRIVE_STRENGTH + Map::PORTS,
+    Map::INPUT_LATCH,
+    Map::PULL_UP_DOWN_ENABLE,
+    Map::PULL_UP_DOWN_SELECTION,
+    Map::INTERRUPT_MASK
+};
+
+template <class Map>
+const typename PCAL64Expander<Map>::pins_t PCAL64Expander<Map>::shadowDefaults[PCAL64Expander<Map>::SHADOW_END] = {
+    ALL_BITS, 0, ALL_BITS, ALL_BITS, ALL_BITS, 0, 0, ALL_BITS, ALL_BITS
+};
+
+/* Read-modify-write step tables. bulkToggle leaves the directions alone
+   and starts at the second step of outputSteps.
+*/
+template <class Map>
+const typename PCAL64Expander<Map>::step_t PCAL64Expander<Map>::outputSteps[] = {
+    { Map::CONFIGURATION,   RULE_DIRECTION_DELTA },
+    { Map::OUTPUT_PORT,     RULE_OUTPUT_DELTA },
+    { STEP_END,             0 }
+};
+
+template <class Map>
+const typename PCAL64Expander<Map>::step_t PCAL64Expander<Map>::interruptSteps[] = {
+    { Map::CONFIGURATION,   RULE_SET_ON_1 },
+    { Map::INPUT_LATCH,     RULE_SET_ON_1 },
+    { Map::INTERRUPT_MASK,  RULE_SET_ON_0 | RULE_RELEASE },
+    { STEP_END,             0 }
+};
+
+/* Key matrix columns are read while they are masked, so they are not
+   latched: a glitch between scan steps would be read for the next row.
+*/
+template <class Map>
+const typename PCAL64Expander<Map>::step_t PCAL64Expander<Map>::columnSteps[] = {
+    { Map::CONFIGURATION,   RULE_SET_ON_1 },
+    { Map::INPUT_LATCH,     RULE_SET_ON_0 },
+    { Map::INTERRUPT_MASK,  RULE_SET_ON_0 | RULE_RELEASE },
+    { STEP_END,             0 }
+};
+
+template <class Map>
+const typename PCAL64Expander<Map>::step_t PCAL64Expander<Map>::maskSteps[] = {
+    { Map::INTERRUPT_MASK,  RULE_SET_ON_1 },
+    { STEP_END,             0 }
+};
+
+/* Register banks are little-endian, port 0 first. */
+template <class Map>
+typename PCAL64Expander<Map>::pins_t PCAL64Expander<Map>::unpack(const uint8_t* buffer)
+{
+    pins_t value = 0;
+
+    for (uint8_t port = PORTS; port > 0; port--)
+    {
+        value = (value << 8) | buffer[port - 1];
+    }
+
+    return value;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::pack(uint8_t* buffer, pins_t value)
+{
+    for (uint8_t port = 0; port < PORTS; port++)
+    {
+        buffer[port] = value >> (8 * port);
+    }
+}
+
+template <class Map>
+PCAL64Expander<Map>::PCAL64Expander(PinName sda, PinName scl, uint16_t _address, PinName _irq)
+    :   PCAL64Expander(*new (ownBus) PCAL64Bus(sda, scl), _address, _irq)
+{
+    ownsBus = true;
+}
+
+template <class Map>
+PCAL64Expander<Map>::PCAL64Expander(PCAL64Bus& _bus, uint16_t _address, PinName _irq)
+    :   bus(&_bus),
+        ownsBus(false),
         address(_address),
         irq(_irq),
+        irqConnected(_irq != NC),
+        statusPreRead(true),
+        blocking(false),
+        transferFailed(false),
         backupStatus(0),
-        backupValues(0),
-        state(STATE_IDLE)
+        inputValues(0),
+        inputValuesValid(false),
+        stagedPending(false),
+        stagedFlushPosted(false),
+        shadowPortConfiguration(0),
+        shadowEnabled(false),
+        shadowIndex(0),
+        restoreSlot(0),
+        restoreRunCount(0),
+        restoreVerifying(false),
+        restoreMatch(false),
+        queueHead(0),
+        queueCount(0),
+        queueHighWater(0),
+        subscriptionFree(0),
+        subscribedRising(0),
+        subscribedFalling(0),
+        lastValues(0),
+        lastValuesValid(false),
+        eventStatus(0),
+        eventValues(0),
+        eventRising(0),
+        eventFalling(0),
+        eventPosted(false),
+        maskPending(0),
+        unmaskPending(0),
+        samplePending(false),
+        interruptsOff(0),
+        debounceEnabled(0),
+        debouncing(0),
+        debounceUnknown(0),
+        debounceTimer(NULL),
+        debounceMasked(0),
+        stormLimit(0),
+        stormWindow(0),
+        stormPollPeriod(0),
+        stormWindowStart(0),
+        storming(0),
+        stormChanged(0),
+        stormQuietStart(0),
+        stormTimer(NULL),
+        streamRing(NULL),
+        streamTimer(NULL),
+        streamTimestamp(0),
+        streamPending(false),
+        streamMissed(0),
+        sequence(NULL),
+        sequenceTimer(NULL),
+        sequenceDeadline(0),
+        sequenceNext(0),
+        sequenceFrame(0),
+        sequencePorts(0),
+        sequenceWriting(0),
+        sequenceOutput(0),
+        sequenceLoop(false),
+        sequencePending(false),
+        sequenceMisses(0),
+        keypadRows(0),
+        keypadColumns(0),
+        keypadRowCount(0),
+        keypadColumnCount(0),
+        keypadPeriod(0),
+        keypadRow(0),
+        keypadScanning(false),
+        keypadScanPending(false),
+        keypadGhosting(false),
+        keypadTimer(NULL),
+        retryLimit(0),
+        retryCount(0),
+        retryBackoff(0),
+        retryTimer(NULL),
+        irqPending(false),
+        irqTaskPosted(false),
+        state(STATE_IDLE),
+        step(NULL),
+        resumeState(STATE_IDLE),
+        statusServiced(false)
+{
+    bus->attach(this);
+
+    for (uint8_t index = 0; index < SHADOW_END; index++)
+    {
+        shadow[index] = shadowDefaults[index];
+    }
+
+    for (uint8_t index = 0; index < YOTTA_CFG_GPIO_PCAL64_SUBSCRIPTIONS; index++)
+    {
+        subscriptions[index].pin = PINS;
+        subscriptions[index].next = index + 1;
+    }
+
+    subscriptions[YOTTA_CFG_GPIO_PCAL64_SUBSCRIPTIONS - 1].next = SUBSCRIPTION_NONE;
+
+    memset(subscriptionHead, SUBSCRIPTION_NONE, sizeof(subscriptionHead));
+    memset(debouncePeriod, 0, sizeof(debouncePeriod));
+    memset(stormCount, 0, sizeof(stormCount));
+
+    STATISTICS(resetStatistics());
+
+    if (_irq != NC)
+    {
+        irq.fall(this, &PCAL64Expander::internalHandlerIRQ);
+    }
+}
+
+template <class Map>
+PCAL64Expander<Map>::~PCAL64Expander()
+{
+    irq.fall(NULL);
+
+    if (debounceTimer)
+    {
+        minar::Scheduler::cancelCallback(debounceTimer);
+    }
+
+    if (stormTimer)
+    {
+        minar::Scheduler::cancelCallback(stormTimer);
+    }
+
+    if (retryTimer)
+    {
+        minar::Scheduler::cancelCallback(retryTimer);
+    }
+
+    stopSampling();
+    stopSequence();
+    stopKeypad();
+
+    bus->detach(this);
+
+    if (ownsBus)
+    {
+        bus->~PCAL64Bus();
+    }
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::bulkRead(FunctionPointer1<void, value_t> callback)
+{
+    command_t command = command_t();
+    command.type = COMMAND_READ;
+    command.readHandler = callback;
+
+    STATISTICS(statistics.reads++);
+    STATISTICS(command.submitted = us_ticker_read());
+
+    return submit(command);
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::bulkReadWithStatus(FunctionPointer2<void, value_t, value_t> callback)
+{
+    command_t command = command_t();
+    command.type = COMMAND_READ;
+    command.statusReadHandler = callback;
+
+    STATISTICS(statistics.reads++);
+    STATISTICS(command.submitted = us_ticker_read());
+
+    return submit(command);
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::bulkReadBlocking(value_t& values)
+{
+    blocking = true;
+    bool result = bulkRead(FunctionPointer1<void, value_t>());
+    blocking = false;
+
+    /* the read leaves the pin values behind, see getLastValues */
+    if (result)
+    {
+        values = inputValues;
+    }
+
+    return result;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::bulkWriteBlocking(value_t pins, value_t directions, value_t values)
+{
+    blocking = true;
+    bool result = bulkWrite(pins, directions, values, FunctionPointer0<void>());
+    blocking = false;
+
+    return result;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::bulkSetInterruptBlocking(value_t pins, value_t values)
+{
+    blocking = true;
+    bool result = bulkSetInterrupt(pins, values, FunctionPointer0<void>());
+    blocking = false;
+
+    return result;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::configureBlocking(const Config& config)
+{
+    blocking = true;
+    bool result = configure(config, FunctionPointer0<void>());
+    blocking = false;
+
+    return result;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::setStatusPreRead(bool enable)
+{
+    statusPreRead = enable;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::setRetryPolicy(uint8_t retries, uint16_t backoff)
+{
+    retryLimit = retries;
+    retryBackoff = backoff;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::setErrorHandler(ErrorCallback_t callback)
+{
+    errorHandler = callback;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::bulkWrite(value_t _pins, value_t directions, value_t values, FunctionPointer0<void> callback)
+{
+    pins_t pins = _pins & ALL_PINS;
+
+    command_t command = command_t();
+    command.type = COMMAND_OUTPUT;
+
+    /* NOTE: the PCAL64 defines 0 to be output and 1 to be input.
+       This is opposite from the gpio-expander API, hence the invesion.
+    */
+    command.directionKeep = ALL_BITS & ~pins;
+    command.directionFlip = pins & ~directions;
+    command.outputKeep = ALL_BITS & ~pins;
+    command.outputFlip = pins & values;
+    command.doneHandler = callback;
+
+    STATISTICS(statistics.writes++);
+    STATISTICS(command.submitted = us_ticker_read());
+
+    return submit(command);
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::bulkToggle(value_t _pins, FunctionPointer0<void> callback)
+{
+    command_t command = command_t();
+    command.type = COMMAND_OUTPUT;
+    command.directionKeep = ALL_BITS;
+    command.directionFlip = 0;
+    command.outputKeep = ALL_BITS;
+    command.outputFlip = _pins & ALL_PINS;
+    command.doneHandler = callback;
+
+    STATISTICS(statistics.toggles++);
+    STATISTICS(command.submitted = us_ticker_read());
+
+    return submit(command);
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stageWrite(value_t _pins, value_t values)
+{
+    pins_t pins = _pins & ALL_PINS;
+
+    stage(ALL_BITS, 0, ALL_BITS & ~pins, pins & values);
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stageDirection(value_t _pins, value_t directions)
+{
+    pins_t pins = _pins & ALL_PINS;
+
+    /* 1 is input on the device, see bulkWrite */
+    stage(ALL_BITS & ~pins, pins & ~directions, ALL_BITS, 0);
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stage(pins_t directionKeep, pins_t directionFlip, pins_t outputKeep, pins_t outputFlip)
+{
+    command_t command = command_t();
+    command.directionKeep = directionKeep;
+    command.directionFlip = directionFlip;
+    command.outputKeep = outputKeep;
+    command.outputFlip = outputFlip;
+
+    if (stagedPending)
+    {
+        merge(staged, command);
+    }
+    else
+    {
+        staged = command;
+        staged.type = COMMAND_OUTPUT;
+        stagedPending = true;
+    }
+
+    /* runs after the caller's scheduler callback and any already posted */
+    if (!stagedFlushPosted)
+    {
+        stagedFlushPosted = true;
+
+        minar::Scheduler::postCallback(FunctionPointer0<void>(this, &PCAL64Expander::flushStaged))
+            .tolerance(1);
+    }
+}
+
+template <class Map>
+void PCAL64Expander<Map>::flushStaged(void)
+{
+    stagedFlushPosted = false;
+
+    if (!stagedPending)
+    {
+        return;
+    }
+
+    STATISTICS(statistics.writes++);
+    STATISTICS(staged.submitted = us_ticker_read());
+
+    /* cleared first, submit can run the command to completion */
+    stagedPending = false;
+
+    /* with the queue full, processQueue tries again when it has drained */
+    if (!submit(staged))
+    {
+        stagedPending = true;
+    }
+}
+
+template <class Map>
+typename PCAL64Expander<Map>::value_t PCAL64Expander<Map>::getLastValues(void) const
+{
+    return inputValues;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::refreshValues(FunctionPointer0<void> callback)
+{
+    command_t command = command_t();
+    command.type = COMMAND_READ;
+    command.doneHandler = callback;
+
+    STATISTICS(statistics.reads++);
+    STATISTICS(command.submitted = us_ticker_read());
+
+    return submit(command);
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::bulkSetInterrupt(value_t _pins, value_t values, FunctionPointer0<void> callback)
+{
+    command_t command = command_t();
+    command.type = COMMAND_INTERRUPT;
+    command.pins = _pins & ALL_PINS;
+    command.param1 = values & ALL_PINS;
+    command.doneHandler = callback;
+
+    STATISTICS(statistics.setInterrupts++);
+    STATISTICS(command.submitted = us_ticker_read());
+
+    return submit(command);
+}
+
+template <class Map>
+PCAL64Expander<Map>::Config::Config(void)
+    :   portMask(0),
+        portValue(0)
+{
+    memset(mask, 0, sizeof(mask));
+    memset(value, 0, sizeof(value));
+}
+
+/* Drive strength has two bits per pin. The first bank holds the lower half
+   of the pins, four per byte.
+*/
+template <class Map>
+typename PCAL64Expander<Map>::Config& PCAL64Expander<Map>::Config::drive(value_t pins, drive_t strength)
+{
+    pins &= ALL_PINS;
+
+    for (uint8_t pin = 0; pin < PINS; pin++)
+    {
+        if ((pins >> pin) & 1)
+        {
+            uint8_t bank = pin / (PINS / 2);
+            uint8_t shift = 2 * (pin % (PINS / 2));
+
+            mask[bank] |= ((value_t) 3) << shift;
+            value[bank] = (value[bank] & ~(((value_t) 3) << shift)) | (((value_t) strength) << shift);
+        }
+    }
+
+    return *this;
+}
+
+template <class Map>
+typename PCAL64Expander<Map>::Config& PCAL64Expander<Map>::Config::pull(value_t pins, pull_t pull)
+{
+    pins &= ALL_PINS;
+
+    /* enable in bank 3, selection in bank 4 where 1 is pull-up */
+    mask[3] |= pins;
+    value[3] = (pull == PULL_NONE) ? (value[3] & ~pins) : (value[3] | pins);
+
+    if (pull != PULL_NONE)
+    {
+        mask[4] |= pins;
+        value[4] = (pull == PULL_UP) ? (value[4] | pins) : (value[4] & ~pins);
+    }
+
+    return *this;
+}
+
+template <class Map>
+typename PCAL64Expander<Map>::Config& PCAL64Expander<Map>::Config::latch(value_t pins, bool enable)
+{
+    pins &= ALL_PINS;
+
+    mask[2] |= pins;
+    value[2] = enable ? (value[2] | pins) : (value[2] & ~pins);
+
+    return *this;
+}
+
+template <class Map>
+typename PCAL64Expander<Map>::Config& PCAL64Expander<Map>::Config::openDrain(uint8_t ports, bool enable)
+{
+    ports &= (1 << PORTS) - 1;
+
+    portMask |= ports;
+    portValue = enable ? (portValue | ports) : (portValue & ~ports);
+
+    return *this;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::configure(const Config& config, FunctionPointer0<void> callback)
+{
+    command_t command = command_t();
+    command.type = COMMAND_CONFIGURE;
+    command.config = &config;
+    command.doneHandler = callback;
+
+    STATISTICS(statistics.configures++);
+    STATISTICS(command.submitted = us_ticker_read());
+
+    return submit(command);
+}
+
+/* The drive strength banks hold 2 bits per pin, the others one. */
+template <class Map>
+typename PCAL64Expander<Map>::pins_t PCAL64Expander<Map>::configBits(uint8_t bank)
+{
+    return (bank < 2) ? ALL_BITS : ALL_PINS;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::configStep(void)
+{
+    const Config& config = *current.config;
+
+    /* The banks have consecutive shadow slots. A run is a series of banks
+       at consecutive addresses, one burst on parts with auto-increment.
+    */
+    const uint8_t first = SHADOW_DRIVE_STRENGTH_0;
+
+    for (;;)
+    {
+        /* write what has been found to differ */
+        if (configChanged)
+        {
+            uint8_t bank = __builtin_ctz(configChanged);
+            uint8_t count = shadowRun(first + bank, configChanged << first);
+
+            for (uint8_t index = 0; index < count; index++)
+            {
+                shadow[first + bank + index] = configValues[bank + index];
+                pack(burstBuffer + index * PORTS, configValues[bank + index]);
+            }
+
+            configChanged &= ~(((1 << count) - 1) << bank);
+
+            state = STATE_CONFIG_SET_BANKS;
+
+            STATISTICS(statistics.transactions++);
+
+            bus->write(this, address, shadowRegisters[first + bank] | Map::AUTO_INCREMENT, burstBuffer, count * PORTS);
+            return;
+        }
+
+        while ((configBank < Config::BANKS) && !(config.mask[configBank] & configBits(configBank)))
+        {
+            configBank++;
+        }
+
+        if (configBank >= Config::BANKS)
+        {
+            break;
+        }
+
+        if (shadowEnabled)
+        {
+            /* compare against the shadow, nothing to read */
+            for (; configBank < Config::BANKS; configBank++)
+            {
+                pins_t mask = config.mask[configBank] & configBits(configBank);
+                pins_t held = shadow[first + configBank];
+                pins_t desired = (held & ~mask) | (config.value[configBank] & mask);
+
+                if (desired != held)
+                {
+                    configValues[configBank] = desired;
+                    configChanged |= 1 << configBank;
+                }
+            }
+
+            continue;
+        }
+
+        /* read the next run of requested banks */
+        uint16_t requested = 0;
+
+        for (uint8_t bank = configBank; bank < Config::BANKS; bank++)
+        {
+            if (config.mask[bank] & configBits(bank))
+            {
+                requested |= 1 << (first + bank);
+            }
+        }
+
+        configRunBank = configBank;
+        configRunCount = shadowRun(first + configBank, requested);
+
+        configBank += configRunCount;
+
+        state = STATE_CONFIG_GET_BANKS;
+
+        STATISTICS(statistics.transactions++);
+
+        bus->read(this, address, shadowRegisters[first + configRunBank] | Map::AUTO_INCREMENT, burstBuffer, configRunCount * PORTS);
+        return;
+    }
+
+    /* output port configuration is a single byte, one bit per port */
+    if (config.portMask)
+    {
+        state = STATE_CONFIG_GET_PORTS;
+
+        if (shadowEnabled)
+        {
+            burstBuffer[0] = shadowPortConfiguration;
+
+            eventHandler();
+            return;
+        }
+
+        STATISTICS(statistics.transactions++);
+
+        bus->read(this, address, Map::OUTPUT_PORT_CONFIGURATION | Map::AUTO_INCREMENT, burstBuffer, 1);
+        return;
+    }
+
+    state = STATE_SIGNAL_DONE;
+
+    eventHandler();
+}
+
+template <class Map>
+void PCAL64Expander<Map>::setInterruptHandler(IRQCallback_t callback)
+{
+    externalIRQHandler = callback;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::clearInterruptHandler(void)
+{
+    externalIRQHandler.clear();
+}
+
+template <class Map>
+int8_t PCAL64Expander<Map>::subscribe(uint8_t pin, edge_t edge, PinCallback_t callback)
+{
+    if ((pin >= PINS) || !((ALL_PINS >> pin) & 1) || (subscriptionFree == SUBSCRIPTION_NONE))
+    {
+        return -1;
+    }
+
+    uint8_t index = subscriptionFree;
+    subscription_t& subscription = subscriptions[index];
+
+    subscriptionFree = subscription.next;
+
+    subscription.callback = callback;
+    subscription.edge = edge;
+    subscription.pin = pin;
+    subscription.next = subscriptionHead[pin];
+    subscriptionHead[pin] = index;
+
+    updateSubscriptionMasks();
+
+    return index;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::unsubscribe(int8_t handle)
+{
+    if ((handle < 0) || (handle >= YOTTA_CFG_GPIO_PCAL64_SUBSCRIPTIONS))
+    {
+        return;
+    }
+
+    subscription_t& subscription = subscriptions[handle];
+
+    if (subscription.pin >= PINS)
+    {
+        return;
+    }
+
+    for (uint8_t* link = &subscriptionHead[subscription.pin];
+         *link != SUBSCRIPTION_NONE;
+         link = &subscriptions[*link].next)
+    {
+        if (*link == handle)
+        {
+            *link = subscription.next;
+            break;
+        }
+    }
+
+    subscription.callback.clear();
+    subscription.pin = PINS;
+    subscription.next = subscriptionFree;
+    subscriptionFree = handle;
+
+    updateSubscriptionMasks();
+}
+
+template <class Map>
+void PCAL64Expander<Map>::updateSubscriptionMasks(void)
+{
+    subscribedRising = 0;
+    subscribedFalling = 0;
+
+    for (uint8_t pin = 0; pin < PINS; pin++)
+    {
+        for (uint8_t index = subscriptionHead[pin]; index != SUBSCRIPTION_NONE; index = subscriptions[index].next)
+        {
+            if (subscriptions[index].edge & EDGE_RISING)
+            {
+                subscribedRising |= ((pins_t) 1) << pin;
+            }
+
+            if (subscriptions[index].edge & EDGE_FALLING)
+            {
+                subscribedFalling |= ((pins_t) 1) << pin;
+            }
+        }
+    }
+}
+
+template <class Map>
+void PCAL64Expander<Map>::queueEvent(pins_t status, pins_t values)
+{
+    /* Pins waiting in a coalesced event are delivered with these values,
+       so their edges are found against them too. Debounced pins keep the
+       value from before their first edge.
+    */
+    pins_t pending = status | (eventStatus & ~debouncing);
+
+    /* without a previous snapshot every pin with status set counts */
+    pins_t changed = lastValuesValid ? pending & (values ^ lastValues) : status;
+
+    if (lastValuesValid)
+    {
+        lastValues = (lastValues & ~pending) | (values & pending);
+    }
+    else
+    {
+        lastValues = (lastValues & debouncing) | (values & ~debouncing);
+        lastValuesValid = true;
+    }
+
+    eventStatus |= status;
+    eventValues = values;
+    eventRising |= changed & values & subscribedRising;
+    eventFalling |= changed & ~values & subscribedFalling;
+
+    if (eventPosted)
+    {
+        STATISTICS(statistics.irqCoalesced++);
+        return;
+    }
+
+    eventPosted = true;
+
+    minar::Scheduler::postCallback(this, &PCAL64Expander::deliverEvent)
+        .tolerance(1);
+}
+
+template <class Map>
+void PCAL64Expander<Map>::deliverEvent(void)
+{
+    pins_t status = eventStatus;
+    pins_t rising = eventRising;
+    pins_t falling = eventFalling;
+
+    eventStatus = 0;
+    eventRising = 0;
+    eventFalling = 0;
+    eventPosted = false;
+
+    if (externalIRQHandler)
+    {
+        externalIRQHandler.call(address, status, eventValues);
+    }
+
+    dispatchSubscriptions(rising, falling, eventValues);
+}
+
+template <class Map>
+void PCAL64Expander<Map>::dispatchSubscriptions(pins_t rising, pins_t falling, pins_t values)
+{
+    pins_t fired = rising | falling;
+
+    /* only pins with an edge are visited, lowest pin first */
+    while (fired)
+    {
+        uint8_t pin = __builtin_ctzll(fired);
+        fired &= fired - 1;
+
+        pins_t bit = ((pins_t) 1) << pin;
+
+        /* A pin that went both ways in coalesced interrupts gets both
+           edges, the one matching its present value last.
+        */
+        edge_t edges[2];
+        uint8_t count = 0;
+
+        if ((rising & falling & bit) && (values & bit))
+        {
+            edges[count++] = EDGE_FALLING;
+            edges[count++] = EDGE_RISING;
+        }
+        else if (rising & falling & bit)
+        {
+            edges[count++] = EDGE_RISING;
+            edges[count++] = EDGE_FALLING;
+        }
+        else
+        {
+            edges[count++] = (rising & bit) ? EDGE_RISING : EDGE_FALLING;
+        }
+
+        for (uint8_t edge = 0; edge < count; edge++)
+        {
+            for (uint8_t index = subscriptionHead[pin]; index != SUBSCRIPTION_NONE; )
+            {
+                subscription_t& subscription = subscriptions[index];
+
+                /* the callback may unsubscribe itself */
+                index = subscription.next;
+
+                if (subscription.edge & edges[edge])
+                {
+                    subscription.callback.call(pin, edges[edge]);
+                }
+            }
+        }
+    }
+}
+
+template <class Map>
+void PCAL64Expander<Map>::setDebounce(value_t pins, uint16_t milliseconds)
+{
+    for (uint8_t pin = 0; pin < PINS; pin++)
+    {
+        if ((pins >> pin) & 1)
+        {
+            debouncePeriod[pin] = milliseconds;
+        }
+    }
+
+    if (milliseconds)
+    {
+        debounceEnabled |= pins & ALL_PINS;
+    }
+    else
+    {
+        debounceEnabled &= ~pins;
+    }
+}
+
+template <class Map>
+typename PCAL64Expander<Map>::pins_t PCAL64Expander<Map>::debounceStart(pins_t status)
+{
+    /* status of a pin already debouncing was captured before its mask took effect */
+    pins_t bouncing = status & (debounceEnabled | debounceMasked) & ~debouncing & ~interruptsOff;
+
+    debounceMasked = 0;
+
+    if (bouncing)
+    {
+        /* the value before the edge is only known from an earlier snapshot */
+        if (!lastValuesValid)
+        {
+            debounceUnknown |= bouncing;
+        }
+
+        minar::tick_t now = minar::getTime();
+
+        for (pins_t pending = bouncing; pending; pending &= pending - 1)
+        {
+            uint8_t pin = __builtin_ctzll(pending);
+
+            debounceDeadline[pin] = now + minar::milliseconds(debouncePeriod[pin]);
+        }
+
+        debouncing |= bouncing;
+
+        /* not needed if the interrupt path has masked them already */
+        maskPending |= bouncing & ~(shadowEnabled ? shadow[SHADOW_INTERRUPT_MASK] : 0);
+        unmaskPending &= ~bouncing;
+
+        debounceArm();
+    }
+
+    return status & ~debounceEnabled & ~debouncing;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::debounceResolve(pins_t values)
+{
+    minar::tick_t now = minar::getTime();
+    pins_t resolved = 0;
+
+    for (pins_t pending = debouncing; pending; pending &= pending - 1)
+    {
+        uint8_t pin = __builtin_ctzll(pending);
+
+        if ((int32_t) (now - debounceDeadline[pin]) >= 0)
+        {
+            resolved |= ((pins_t) 1) << pin;
+        }
+    }
+
+    debouncing &= ~resolved;
+    maskPending &= ~resolved;
+    unmaskPending |= resolved;
+
+    /* with no value from before the edge, the edge led to where it settled */
+    pins_t unknown = resolved & debounceUnknown;
+    debounceUnknown &= ~resolved;
+    lastValues = (lastValues & ~unknown) | (~values & unknown);
+
+    /* one clean edge, or nothing if the pin settled where it started */
+    pins_t settled = resolved & (values ^ lastValues);
+
+    if (settled)
+    {
+        queueEvent(settled, values);
+    }
+
+    debounceArm();
+}
+
+template <class Map>
+void PCAL64Expander<Map>::debounceArm(void)
+{
+    if (debounceTimer)
+    {
+        minar::Scheduler::cancelCallback(debounceTimer);
+        debounceTimer = NULL;
+    }
+
+    if (!debouncing)
+    {
+        return;
+    }
+
+    /* one timer for the earliest deadline */
+    minar::tick_t now = minar::getTime();
+    int32_t wait = INT32_MAX;
+
+    for (pins_t pending = debouncing; pending; pending &= pending - 1)
+    {
+        uint8_t pin = __builtin_ctzll(pending);
+        int32_t remaining = (int32_t) (debounceDeadline[pin] - now);
+
+        if (remaining < wait)
+        {
+            wait = remaining;
+        }
+    }
+
+    debounceTimer = minar::Scheduler::postCallback(this, &PCAL64Expander::debounceTimeout)
+                        .delay((wait > 0) ? wait : 0)
+                        .tolerance(1)
+                        .getHandle();
+}
+
+template <class Map>
+void PCAL64Expander<Map>::debounceTimeout(void)
+{
+    debounceTimer = NULL;
+    samplePending = true;
+
+    if (state == STATE_IDLE)
+    {
+        processQueue();
+    }
+}
+
+template <class Map>
+void PCAL64Expander<Map>::setStormProtection(uint16_t limit, uint16_t window, uint16_t pollPeriod, StormCallback_t callback)
+{
+    stormLimit = limit;
+    stormWindow = window;
+    stormPollPeriod = pollPeriod;
+    stormHandler = callback;
+
+    memset(stormCount, 0, sizeof(stormCount));
+    stormWindowStart = minar::getTime();
+
+    /* with protection off nothing would bring the polled pins back */
+    if ((limit == 0) && storming)
+    {
+        stormRestore(storming);
+
+        if (state == STATE_IDLE)
+        {
+            processQueue();
+        }
+    }
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stormCheck(pins_t status)
+{
+    pins_t counted = status & ~debounceEnabled & ~storming & ~interruptsOff;
+
+    if ((stormLimit == 0) || !counted)
+    {
+        return;
+    }
+
+    minar::tick_t now = minar::getTime();
+
+    if ((minar::tick_t) (now - stormWindowStart) >= minar::milliseconds(stormWindow))
+    {
+        memset(stormCount, 0, sizeof(stormCount));
+        stormWindowStart = now;
+    }
+
+    pins_t noisy = 0;
+
+    for (pins_t pending = counted; pending; pending &= pending - 1)
+    {
+        uint8_t pin = __builtin_ctzll(pending);
+
+        if (++stormCount[pin] > stormLimit)
+        {
+            noisy |= ((pins_t) 1) << pin;
+        }
+    }
+
+    if (!noisy)
+    {
+        return;
+    }
+
+    STATISTICS(statistics.irqStorms++);
+
+    storming |= noisy;
+
+    /* a pin has to stay quiet for a whole window, starting now */
+    stormChanged |= noisy;
+    maskPending |= noisy & ~(shadowEnabled ? shadow[SHADOW_INTERRUPT_MASK] : 0);
+    unmaskPending &= ~noisy;
+
+    if (stormTimer == NULL)
+    {
+        stormQuietStart = now;
+
+        stormTimer = minar::Scheduler::postCallback(this, &PCAL64Expander::stormTimeout)
+                        .delay(minar::milliseconds(stormPollPeriod))
+                        .tolerance(1)
+                        .getHandle();
+    }
+
+    stormReport(STORM_DETECTED, noisy);
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stormPoll(pins_t values)
+{
+    if (!storming)
+    {
+        return;
+    }
+
+    pins_t changed = storming & (values ^ lastValues);
+
+    if (changed)
+    {
+        stormChanged |= changed;
+
+        queueEvent(changed, values);
+    }
+
+    minar::tick_t now = minar::getTime();
+
+    if ((minar::tick_t) (now - stormQuietStart) >= minar::milliseconds(stormWindow))
+    {
+        pins_t calm = storming & ~stormChanged;
+
+        stormChanged = 0;
+        stormQuietStart = now;
+
+        if (calm)
+        {
+            stormRestore(calm);
+        }
+    }
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stormRestore(pins_t pins)
+{
+    storming &= ~pins;
+    stormChanged &= ~pins;
+    maskPending &= ~pins;
+    unmaskPending |= pins;
+
+    for (pins_t pending = pins; pending; pending &= pending - 1)
+    {
+        stormCount[__builtin_ctzll(pending)] = 0;
+    }
+
+    if (!storming && stormTimer)
+    {
+        minar::Scheduler::cancelCallback(stormTimer);
+        stormTimer = NULL;
+    }
+
+    stormReport(STORM_CLEARED, pins);
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stormTimeout(void)
+{
+    stormTimer = NULL;
+    samplePending = true;
+
+    /* bounded rate: the next poll is timed from this one, not from its sample */
+    if (storming)
+    {
+        stormTimer = minar::Scheduler::postCallback(this, &PCAL64Expander::stormTimeout)
+                        .delay(minar::milliseconds(stormPollPeriod))
+                        .tolerance(1)
+                        .getHandle();
+    }
+
+    if (state == STATE_IDLE)
+    {
+        processQueue();
+    }
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stormReport(storm_t transition, pins_t pins)
+{
+    if (stormHandler)
+    {
+        minar::Scheduler::postCallback(stormHandler.bind(address, transition, pins))
+            .tolerance(1);
+    }
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::startSampling(SampleRing_t& ring, uint32_t period)
+{
+    if (period == 0)
+    {
+        return false;
+    }
+
+    stopSampling();
+
+    streamRing = &ring;
+    streamMissed = 0;
+    streamTimer = minar::Scheduler::postCallback(this, &PCAL64Expander::streamTimeout)
+                    .delay(minar::milliseconds(period))
+                    .period(minar::milliseconds(period))
+                    .tolerance(1)
+                    .getHandle();
+
+    return true;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stopSampling(void)
+{
+    if (streamTimer)
+    {
+        minar::Scheduler::cancelCallback(streamTimer);
+        streamTimer = NULL;
+    }
+
+    streamRing = NULL;
+    streamPending = false;
+}
+
+template <class Map>
+uint32_t PCAL64Expander<Map>::getSampleMisses(void) const
+{
+    return streamMissed;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::streamTimeout(void)
+{
+    /* the previous period has not started yet and is merged into this one */
+    if (streamPending)
+    {
+        streamMissed++;
+    }
+
+    streamPending = true;
+
+    if (state == STATE_IDLE)
+    {
+        processQueue();
+    }
+}
+
+template <class Map>
+PCAL64Expander<Map>::Sequence::Sequence(step_t* _steps, uint16_t _capacity)
+    :   steps(_steps),
+        capacity(_capacity),
+        count(0)
+{
+    memset(portPins, 0, sizeof(portPins));
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::Sequence::prepare(const frame_t* frames, uint16_t _count, value_t pins)
+{
+    if ((_count == 0) || (_count > capacity))
+    {
+        return false;
+    }
+
+    count = _count;
+    pack(portPins, pins & ALL_PINS);
+
+    for (uint16_t index = 0; index < count; index++)
+    {
+        step_t& step = steps[index];
+        pins_t value = frames[index].values & pins & ALL_PINS;
+        pins_t previous = frames[(index + count - 1) % count].values & pins & ALL_PINS;
+        pins_t changed = value ^ previous;
+
+        step.delay = minar::milliseconds(frames[index].delay);
+        step.changed = 0;
+
+        for (uint8_t port = 0; port < PORTS; port++)
+        {
+            if ((changed >> (8 * port)) & 0xFF)
+            {
+                step.changed |= 1 << port;
+            }
+        }
+
+        pack(step.bytes, value);
+    }
+
+    return true;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::playSequence(const Sequence& _sequence, bool loop, FunctionPointer0<void> callback)
+{
+    /* frames are written without reading the other pins of their ports */
+    if (!shadowEnabled || (_sequence.count == 0))
+    {
+        return false;
+    }
+
+    stopSequence();
+
+    sequence = &_sequence;
+    sequenceHandler = callback;
+    sequenceLoop = loop;
+    sequenceNext = 0;
+    sequencePorts = (1 << PORTS) - 1;
+    sequenceDeadline = minar::getTime() + sequence->steps[0].delay;
+
+    sequenceTimer = minar::Scheduler::postCallback(this, &PCAL64Expander::sequenceTimeout)
+                        .delay(sequence->steps[0].delay)
+                        .tolerance(1)
+                        .getHandle();
+
+    return true;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stopSequence(void)
+{
+    if (sequenceTimer)
+    {
+        minar::Scheduler::cancelCallback(sequenceTimer);
+        sequenceTimer = NULL;
+    }
+
+    sequence = NULL;
+    sequencePending = false;
+}
+
+template <class Map>
+uint32_t PCAL64Expander<Map>::getFrameMisses(void) const
+{
+    return sequenceMisses;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::sequenceTimeout(void)
+{
+    sequenceTimer = NULL;
+
+    if (!sequence)
+    {
+        return;
+    }
+
+    sequenceFrame = sequenceNext;
+    sequencePorts |= sequence->steps[sequenceFrame].changed;
+
+    if (sequencePorts)
+    {
+        /* the previous frame has not gone out, this one replaces it */
+        if (sequencePending)
+        {
+            sequenceMisses++;
+        }
+
+        sequencePending = true;
+    }
+
+    sequenceNext++;
+
+    if ((sequenceNext == sequence->count) && sequenceLoop)
+    {
+        sequenceNext = 0;
+    }
+
+    if (sequenceNext < sequence->count)
+    {
+        /* timed from the deadline, not from now, so lateness does not add up */
+        sequenceDeadline += sequence->steps[sequenceNext].delay;
+
+        minar::tick_t now = minar::getTime();
+        minar::tick_t wait = ((int32_t) (sequenceDeadline - now) > 0) ? sequenceDeadline - now : 0;
+
+        sequenceTimer = minar::Scheduler::postCallback(this, &PCAL64Expander::sequenceTimeout)
+                            .delay(wait)
+                            .tolerance(1)
+                            .getHandle();
+    }
+    else if (!sequencePending && (state != STATE_SEQUENCE_SET_PORTS))
+    {
+        /* the last frame changed nothing */
+        sequence = NULL;
+
+        if (sequenceHandler)
+        {
+            minar::Scheduler::postCallback(sequenceHandler)
+                .tolerance(1);
+        }
+    }
+
+    if (state == STATE_IDLE)
+    {
+        processQueue();
+    }
+}
+
+/* One burst from the first to the last changed port. Pins outside the
+   sequence come from the shadow.
+*/
+template <class Map>
+void PCAL64Expander<Map>::sequenceWrite(void)
+{
+    const typename Sequence::step_t& step = sequence->steps[sequenceFrame];
+    uint8_t first = __builtin_ctz(sequencePorts);
+    uint8_t last = 31 - __builtin_clz(sequencePorts);
+    uint8_t held[PORTS];
+
+    pack(held, shadow[SHADOW_OUTPUT]);
+
+    for (uint8_t port = first; port <= last; port++)
+    {
+        held[port] = (held[port] & ~sequence->portPins[port]) | step.bytes[port];
+    }
+
+    sequenceOutput = unpack(held);
+    sequenceWriting = sequencePorts;
+    sequencePorts = 0;
+
+    memcpy(burstBuffer, held + first, last - first + 1);
+
+    state = STATE_SEQUENCE_SET_PORTS;
+
+    STATISTICS(statistics.transactions++);
+
+    if (!bus->write(this, address, (Map::OUTPUT_PORT + first) | Map::AUTO_INCREMENT, burstBuffer, last - first + 1))
+    {
+        state = STATE_IDLE;
+
+        sequenceFrameEnd(false);
+    }
+}
+
+/* A frame that was not written counts as missed, and the next frame
+   writes its ports too. After the last frame the sequence ends either way.
+*/
+template <class Map>
+void PCAL64Expander<Map>::sequenceFrameEnd(bool written)
+{
+    if (written)
+    {
+        shadow[SHADOW_OUTPUT] = sequenceOutput;
+    }
+    else
+    {
+        sequenceMisses++;
+        sequencePorts |= sequenceWriting;
+    }
+
+    sequenceWriting = 0;
+
+    /* the last frame of a sequence that does not loop */
+    if (sequence && !sequenceTimer && !sequencePending)
+    {
+        sequence = NULL;
+
+        if (sequenceHandler)
+        {
+            minar::Scheduler::postCallback(sequenceHandler)
+                .tolerance(1);
+        }
+    }
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::startKeypad(value_t _rows, value_t _columns, uint16_t period, KeypadCallback_t callback)
+{
+    pins_t rows = _rows & ALL_PINS;
+    pins_t columns = _columns & ALL_PINS;
+
+    if (!shadowEnabled || !rows || !columns || (rows & columns) || (period == 0) ||
+        (__builtin_popcountll(rows) > KEYPAD_LINES) ||
+        (__builtin_popcountll(columns) > KEYPAD_LINES))
+    {
+        return false;
+    }
+
+    stopKeypad();
+
+    keypadRowCount = 0;
+    keypadColumnCount = 0;
+
+    for (uint8_t pin = 0; pin < PINS; pin++)
+    {
+        if ((rows >> pin) & 1)
+        {
+            keypadRowPin[keypadRowCount++] = pin;
+        }
+        else if ((columns >> pin) & 1)
+        {
+            keypadColumnPin[keypadColumnCount++] = pin;
+        }
+    }
+
+    memset(keypadState, 0, sizeof(keypadState));
+
+    keypadPeriod = period;
+    keypadHandler = callback;
+    keypadGhosting = false;
+
+    /* idle: rows driven low, a key press pulls its column down */
+    command_t command = command_t();
+    command.type = COMMAND_COLUMNS;
+    command.pins = columns;
+    command.param1 = columns;
+
+    STATISTICS(command.submitted = us_ticker_read());
+
+    if (!bulkWrite(rows | columns, rows, 0, FunctionPointer0<void>()) ||
+        !submit(command))
+    {
+        return false;
+    }
+
+    keypadRows = rows;
+    keypadColumns = columns;
+
+    return true;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::stopKeypad(void)
+{
+    if (keypadTimer)
+    {
+        minar::Scheduler::cancelCallback(keypadTimer);
+        keypadTimer = NULL;
+    }
+
+    keypadRows = 0;
+    keypadColumns = 0;
+    keypadScanning = false;
+    keypadScanPending = false;
+}
+
+/* Column edges start a scan instead of being reported. */
+template <class Map>
+typename PCAL64Expander<Map>::pins_t PCAL64Expander<Map>::keypadInterrupt(pins_t status)
+{
+    if ((status & keypadColumns) && !keypadScanning)
+    {
+        keypadScanning = true;
+        keypadScanPending = true;
+
+        maskPending |= keypadColumns & ~shadow[SHADOW_INTERRUPT_MASK];
+        unmaskPending &= ~keypadColumns;
+    }
+
+    return status & ~keypadColumns;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::keypadTimeout(void)
+{
+    keypadTimer = NULL;
+    keypadScanPending = true;
+
+    if (state == STATE_IDLE)
+    {
+        processQueue();
+    }
+}
+
+/* Select each row in turn by making it the only row that is an output,
+   then drive all rows again.
+*/
+template <class Map>
+void PCAL64Expander<Map>::keypadStep(void)
+{
+    pins_t directions = shadow[SHADOW_CONFIGURATION] & ~keypadRows;
+
+    /* stopped during the scan */
+    if (!keypadRows)
+    {
+        state = STATE_IDLE;
+        return;
+    }
+
+    if (keypadRow < keypadRowCount)
+    {
+        state = STATE_KEYPAD_SET_ROW;
+
+        /* inputs are 1 */
+        directions |= keypadRows & ~(((pins_t) 1) << keypadRowPin[keypadRow]);
+    }
+    else
+    {
+        state = STATE_KEYPAD_SET_ROWS;
+    }
+
+    if (!writePorts(Map::CONFIGURATION, keypadRows, directions))
+    {
+        state = STATE_IDLE;
+    }
+}
+
+template <class Map>
+void PCAL64Expander<Map>::keypadResolve(void)
+{
+    /* Three keys on the corners of a rectangle make the fourth corner read
+       as down as well: two rows with two or more columns in common.
+    */
+    for (uint8_t first = 0; first < keypadRowCount; first++)
+    {
+        for (uint8_t second = first + 1; second < keypadRowCount; second++)
+        {
+            uint8_t common = keypadScan[first] & keypadScan[second];
+
+            if (__builtin_popcount(common) >= 2)
+            {
+                if (!keypadGhosting && keypadHandler)
+                {
+                    minar::Scheduler::postCallback(keypadHandler.bind(first, __builtin_ctz(common), KEY_GHOSTING))
+                        .tolerance(1);
+                }
+
+                keypadGhosting = true;
+                return;
+            }
+        }
+    }
+
+    keypadGhosting = false;
+
+    for (uint8_t row = 0; row < keypadRowCount; row++)
+    {
+        for (uint8_t changed = keypadState[row] ^ keypadScan[row]; changed; changed &= changed - 1)
+        {
+            uint8_t column = __builtin_ctz(changed);
+            keypad_event_t event = ((keypadScan[row] >> column) & 1) ? KEY_DOWN : KEY_UP;
+
+            if (keypadHandler)
+            {
+                minar::Scheduler::postCallback(keypadHandler.bind(row, column, event))
+                    .tolerance(1);
+            }
+        }
+
+        keypadState[row] = keypadScan[row];
+    }
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::executeInternal(void)
+{
+    command_t command = command_t();
+
+    if (maskPending || unmaskPending)
+    {
+        command.type = COMMAND_MASK;
+        command.pins = maskPending | unmaskPending;
+        command.param1 = maskPending;
+
+        maskPending = 0;
+        unmaskPending = 0;
+    }
+    else if (sequencePending)
+    {
+        command.type = COMMAND_SEQUENCE;
+
+        sequencePending = false;
+    }
+    else if (keypadScanPending)
+    {
+        command.type = COMMAND_SCAN;
+
+        keypadScanPending = false;
+    }
+    else if (samplePending)
+    {
+        command.type = COMMAND_SAMPLE;
+
+        samplePending = false;
+    }
+    else if (streamPending)
+    {
+        command.type = COMMAND_STREAM;
+
+        streamPending = false;
+    }
+    else
+    {
+        return false;
+    }
+
+    STATISTICS(command.submitted = us_ticker_read());
+
+    execute(command);
+
+    return true;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::enableShadowRegisters(FunctionPointer0<void> callback)
+{
+    return resyncShadowRegisters(callback);
+}
+
+template <class Map>
+void PCAL64Expander<Map>::disableShadowRegisters(void)
+{
+    shadowEnabled = false;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::resyncShadowRegisters(FunctionPointer0<void> callback)
+{
+    command_t command = command_t();
+    command.type = COMMAND_SHADOW_SYNC;
+    command.doneHandler = callback;
+
+    STATISTICS(statistics.shadowResyncs++);
+    STATISTICS(command.submitted = us_ticker_read());
+
+    return submit(command);
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::exportSnapshot(snapshot_t& snapshot) const
+{
+    if (!shadowEnabled)
+    {
+        return false;
+    }
+
+    snapshot.version = SNAPSHOT_VERSION;
+    snapshot.ports = PORTS;
+
+    for (uint8_t slot = 0; slot < SHADOW_END; slot++)
+    {
+        pack(snapshot.banks[slot], shadow[slot]);
+    }
+
+    snapshot.outputPortConfiguration = shadowPortConfiguration;
+
+    /* two's complement of the sum of everything before it */
+    const uint8_t* bytes = (const uint8_t*) &snapshot;
+    uint8_t sum = 0;
+
+    for (uint16_t index = 0; index < sizeof(snapshot_t) - 1; index++)
+    {
+        sum += bytes[index];
+    }
+
+    snapshot.check = -sum;
+
+    return true;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::restoreSnapshot(const snapshot_t& snapshot, bool verify, FunctionPointer1<void, bool> callback)
+{
+    const uint8_t* bytes = (const uint8_t*) &snapshot;
+    uint8_t sum = 0;
+
+    for (uint16_t index = 0; index < sizeof(snapshot_t); index++)
+    {
+        sum += bytes[index];
+    }
+
+    if ((snapshot.version != SNAPSHOT_VERSION) || (snapshot.ports != PORTS) || sum)
+    {
+        return false;
+    }
+
+    command_t command = command_t();
+    command.type = COMMAND_RESTORE;
+    command.snapshot = &snapshot;
+    command.param1 = verify;
+    command.restoreHandler = callback;
+
+    STATISTICS(statistics.restores++);
+    STATISTICS(command.submitted = us_ticker_read());
+
+    return submit(command);
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::restoreSnapshotBlocking(const snapshot_t& snapshot, bool verify)
+{
+    blocking = true;
+    bool result = restoreSnapshot(snapshot, verify, FunctionPointer1<void, bool>());
+    blocking = false;
+
+    return result && restoreMatch;
+}
+
+/* Write all banks in runs, then the output port configuration. With verify
+   the same runs are read back afterwards.
+*/
+template <class Map>
+void PCAL64Expander<Map>::restoreStep(void)
+{
+    const snapshot_t& snapshot = *current.snapshot;
+
+    if (restoreSlot < SHADOW_END)
+    {
+        uint8_t slot = restoreSlot;
+
+        restoreRunCount = shadowRun(slot, (1 << SHADOW_END) - 1);
+        restoreSlot += restoreRunCount;
+
+        STATISTICS(statistics.transactions++);
+
+        if (restoreVerifying)
+        {
+            state = STATE_RESTORE_GET_BANKS;
+
+            bus->read(this, address, shadowRegisters[slot] | Map::AUTO_INCREMENT, burstBuffer, restoreRunCount * PORTS);
+        }
+        else
+        {
+            for (uint8_t index = 0; index < restoreRunCount; index++)
+            {
+                shadow[slot + index] = unpack(snapshot.banks[slot + index]);
+                memcpy(burstBuffer + index * PORTS, snapshot.banks[slot + index], PORTS);
+            }
+
+            /* pins the snapshot unmasks interrupt again */
+            if ((slot <= SHADOW_INTERRUPT_MASK) && (SHADOW_INTERRUPT_MASK < restoreSlot))
+            {
+                interruptsOff &= shadow[SHADOW_INTERRUPT_MASK];
+            }
+
+            state = STATE_RESTORE_SET_BANKS;
+
+            bus->write(this, address, shadowRegisters[slot] | Map::AUTO_INCREMENT, burstBuffer, restoreRunCount * PORTS);
+        }
+        return;
+    }
+
+    STATISTICS(statistics.transactions++);
+
+    if (restoreVerifying)
+    {
+        state = STATE_RESTORE_GET_PORTS;
+
+        bus->read(this, address, Map::OUTPUT_PORT_CONFIGURATION | Map::AUTO_INCREMENT, burstBuffer, 1);
+    }
+    else
+    {
+        shadowPortConfiguration = snapshot.outputPortConfiguration;
+        burstBuffer[0] = snapshot.outputPortConfiguration;
+
+        state = STATE_RESTORE_SET_PORTS;
+
+        bus->write(this, address, Map::OUTPUT_PORT_CONFIGURATION | Map::AUTO_INCREMENT, burstBuffer, 1);
+    }
+}
+
+template <class Map>
+uint8_t PCAL64Expander<Map>::getQueueHighWaterMark(void) const
+{
+    return queueHighWater;
+}
+
+#if YOTTA_CFG_GPIO_PCAL64_STATISTICS
+template <class Map>
+void PCAL64Expander<Map>::getStatistics(statistics_t& snapshot) const
+{
+    snapshot = statistics;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::resetStatistics(void)
+{
+    memset(&statistics, 0, sizeof(statistics_t));
+}
+
+template <class Map>
+void PCAL64Expander<Map>::recordLatency(uint32_t* histogram, uint32_t since)
+{
+    uint32_t elapsed = (us_ticker_read() - since) >> 6;
+    uint8_t bucket = 0;
+
+    /* bucket = floor(log2(us / 64)) + 1, clamped to the last bucket */
+    if (elapsed)
+    {
+        bucket = 32 - __builtin_clz(elapsed);
+
+        if (bucket >= HISTOGRAM_BUCKETS)
+        {
+            bucket = HISTOGRAM_BUCKETS - 1;
+        }
+    }
+
+    histogram[bucket]++;
+}
+#endif
+
+/*****************************************************************************/
+/* Command queue                                                             */
+/*****************************************************************************/
+
+template <class Map>
+bool PCAL64Expander<Map>::submit(const command_t& command)
+{
+    if (blocking)
+    {
+        return submitPolled(command);
+    }
+
+    /* start right away if nothing is ahead of this command */
+    if ((state == STATE_IDLE) && (queueCount == 0))
+    {
+        return execute(command);
+    }
+
+    STATISTICS(statistics.queued++);
+
+    command_t* target = mergeTarget(command);
+
+    /* without a callback the command disappears into the queued one */
+    if (target && !command.doneHandler)
+    {
+        merge(*target, command);
+
+        return true;
+    }
+
+    if (queueCount == YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE)
+    {
+#if YOTTA_CFG_GPIO_PCAL64_QUEUE_OVERWRITE_OLDEST
+        if (!dropOldest())
+        {
+            STATISTICS(statistics.rejected++);
+            return false;
+        }
+
+        target = mergeTarget(command);
+#else
+        STATISTICS(statistics.rejected++);
+        return false;
+#endif
+    }
+
+    uint8_t tail = (queueHead + queueCount) % YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE;
+
+    if (target)
+    {
+        /* the register delta goes into the queued command, only the
+           callback is kept in order so it fires after the merged write.
+        */
+        merge(*target, command);
+
+        queue[tail] = command_t();
+        queue[tail].type = COMMAND_NOTIFY;
+        queue[tail].doneHandler = command.doneHandler;
+    }
+    else
+    {
+        queue[tail] = command;
+    }
+
+    queueCount++;
+
+    if (queueCount > queueHighWater)
+    {
+        queueHighWater = queueCount;
+    }
+
+    return true;
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::submitPolled(const command_t& command)
+{
+    /* a blocking command never overtakes or interleaves with others */
+    if ((state != STATE_IDLE) || (queueCount > 0))
+    {
+        STATISTICS(statistics.rejected++);
+        return false;
+    }
+
+    current = command;
+    transferFailed = false;
+
+    if (!bus->polled(FunctionPointer0<void>(this, &PCAL64Expander::executePolled)))
+    {
+        STATISTICS(statistics.rejected++);
+        return false;
+    }
+
+    return !transferFailed && (state == STATE_IDLE);
+}
+
+template <class Map>
+void PCAL64Expander<Map>::executePolled(void)
+{
+    /* every transfer completes before it returns, and so does the command */
+    execute(current);
+}
+
+/* Make room in a full queue by dropping the oldest queued command and the
+   callbacks of the commands merged into it. Callbacks at the head of the
+   queue belong to the command in progress, whose write still happens, and
+   are kept. Every dropped command is reported to the error handler.
+*/
+template <class Map>
+bool PCAL64Expander<Map>::dropOldest(void)
+{
+    uint8_t first = 0;
+
+    while ((first < queueCount) &&
+           (queue[(queueHead + first) % YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE].type == COMMAND_NOTIFY))
+    {
+        first++;
+    }
+
+    /* nothing but callbacks of the command in progress */
+    if (first == queueCount)
+    {
+        return false;
+    }
+
+    uint8_t end = first + 1;
+
+    while ((end < queueCount) &&
+           (queue[(queueHead + end) % YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE].type == COMMAND_NOTIFY))
+    {
+        end++;
+    }
+
+    for (uint8_t index = first; index < end; index++)
+    {
+        STATISTICS(statistics.overwritten++);
+
+        reportFailure(FAILURE_OVERWRITTEN);
+    }
+
+    /* close the gap, the commands behind move up */
+    uint8_t dropped = end - first;
+
+    for (uint8_t index = end; index < queueCount; index++)
+    {
+        queue[(queueHead + index - dropped) % YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE] =
+            queue[(queueHead + index) % YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE];
+    }
+
+    queueCount -= dropped;
+
+    return true;
+}
+
+template <class Map>
+typename PCAL64Expander<Map>::command_t* PCAL64Expander<Map>::mergeTarget(const command_t& command)
+{
+    if (command.type != COMMAND_OUTPUT)
+    {
+        return NULL;
+    }
+
+    /* Only merge into the last queued register command, so the merged
+       write never moves ahead of a read or interrupt command.
+    */
+    for (uint8_t count = queueCount; count > 0; count--)
+    {
+        command_t& queued = queue[(queueHead + count - 1) % YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE];
+
+        if (queued.type != COMMAND_NOTIFY)
+        {
+            return (queued.type == COMMAND_OUTPUT) ? &queued : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::merge(command_t& target, const command_t& command)
+{
+    /* Both commands are of the form register = (register & keep) ^ flip
+       so applying one after the other is another command of that form.
+    */
+    target.directionFlip = (target.directionFlip & command.directionKeep) ^ command.directionFlip;
+    target.directionKeep &= command.directionKeep;
+
+    target.outputFlip = (target.outputFlip & command.outputKeep) ^ command.outputFlip;
+    target.outputKeep &= command.outputKeep;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::processQueue(void)
+{
+    /* masking noisy pins goes first, it is what ends an interrupt storm */
+    if ((state == STATE_IDLE) && maskPending)
+    {
+        executeInternal();
+    }
+
+    /* pending interrupts are serviced before any queued command */
+    if ((state == STATE_IDLE) && irqPending)
+    {
+        STATISTICS(statistics.irqDeferred++);
+
+        serviceInterrupt();
+    }
+
+    /* followed by the driver's own mask changes and samples */
+    while ((state == STATE_IDLE) && executeInternal())
+    {
+    }
+
+    while ((state == STATE_IDLE) && (queueCount > 0))
+    {
+        command_t& command = queue[queueHead];
+
+        queueHead = (queueHead + 1) % YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE;
+        queueCount--;
+
+        execute(command);
+    }
+
+    /* staged writes that did not fit into the queue */
+    if ((state == STATE_IDLE) && stagedPending && !stagedFlushPosted)
+    {
+        flushStaged();
+    }
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::execute(const command_t& command)
+{
+    bool result = false;
+
+    current = command;
+
+    switch (command.type)
+    {
+        case COMMAND_READ:
+            if (!command.statusReadHandler && !statusPreReadNeeded())
+            {
+                /* nothing can clear a status that somebody is waiting for */
+                state = STATE_READ_GET_VALUES;
+                result = readRegister(Map::INPUT_PORT);
+                break;
+            }
+            /* fall through */
+
+        case COMMAND_SAMPLE:
+            {
+                state = STATE_READ_GET_STATUS;
+
+                /* Read the interrupt status register before reading the input register.
+                   This is to prevent accidentally erasing the interrupt status register
+                   before the interrupt handler has had a chance to read it.
+
+                   The status and input values are cached in case the interrupt handler
+                   needs them.
+                */
+                result = readRegister(Map::INTERRUPT_STATUS);
+            }
+            break;
+
+        case COMMAND_STREAM:
+            {
+                streamTimestamp = us_ticker_read();
+
+                /* one burst when no interrupt status can be lost */
+                if (statusPreReadNeeded())
+                {
+                    state = STATE_READ_GET_STATUS;
+                    result = readRegister(Map::INTERRUPT_STATUS);
+                }
+                else
+                {
+                    state = STATE_READ_GET_VALUES;
+                    result = readRegister(Map::INPUT_PORT);
+                }
+            }
+            break;
+
+        case COMMAND_SEQUENCE:
+            {
+                sequenceWrite();
+
+                result = (state != STATE_IDLE);
+            }
+            break;
+
+        case COMMAND_SCAN:
+            {
+                keypadRow = 0;
+
+                keypadStep();
+
+                result = (state != STATE_IDLE);
+            }
+            break;
+
+        case COMMAND_CONFIGURE:
+            {
+                configBank = 0;
+                configChanged = 0;
+
+                configStep();
+
+                result = true;
+            }
+            break;
+
+        case COMMAND_RESTORE:
+            {
+                restoreSlot = 0;
+                restoreVerifying = false;
+                restoreMatch = true;
+
+                restoreStep();
+
+                result = true;
+            }
+            break;
+
+        case COMMAND_OUTPUT:
+            if ((command.directionKeep == ALL_BITS) && (command.directionFlip == 0))
+            {
+                // directions are unchanged, e.g. toggle
+                result = stepStart(outputSteps + 1);
+            }
+            else
+            {
+                result = stepStart(outputSteps);
+            }
+            break;
+
+        case COMMAND_INTERRUPT:
+            result = stepStart(interruptSteps);
+            break;
+
+        case COMMAND_COLUMNS:
+            result = stepStart(columnSteps);
+            break;
+
+        case COMMAND_MASK:
+            result = stepStart(maskSteps);
+            break;
+
+        case COMMAND_SHADOW_SYNC:
+            {
+                state = STATE_SHADOW_GET_REGISTER;
+
+                /* read from the device while reloading */
+                shadowEnabled = false;
+                shadowIndex = 0;
+
+                result = readRegister(shadowRegisters[0]);
+            }
+            break;
+
+        case COMMAND_NOTIFY:
+            /* the write of a command merged into an earlier one has landed */
+            STATISTICS(recordLatency(statistics.commandLatency, command.submitted));
+
+            if (command.doneHandler)
+            {
+                minar::Scheduler::postCallback(command.doneHandler)
+                    .tolerance(1);
+            }
+            result = true;
+            break;
+
+        default:
+            break;
+    }
+
+    /* the transfer was not accepted, give up on this command */
+    if (!result)
+    {
+        STATISTICS(statistics.rejected++);
+        state = STATE_IDLE;
+    }
+
+    return result;
+}
+
+template <class Map>
+int8_t PCAL64Expander<Map>::shadowSlot(uint8_t reg) const
+{
+    for (uint8_t index = 0; index < SHADOW_END; index++)
+    {
+        if (shadowRegisters[index] == reg)
+        {
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+/* Number of slots from slot on that are all in the slots bitmap and sit at
+   consecutive addresses, i.e. move in one burst on parts with auto-increment.
+   Limited by the burst buffer.
+*/
+template <class Map>
+uint8_t PCAL64Expander<Map>::shadowRun(uint8_t slot, uint16_t slots) const
+{
+    uint8_t count = 1;
+
+    while (Map::AUTO_INCREMENT &&
+           (count < sizeof(burstBuffer) / PORTS) &&
+           (slot + count < SHADOW_END) &&
+           ((slots >> (slot + count)) & 1) &&
+           (shadowRegisters[slot + count] == shadowRegisters[slot] + count * PORTS))
+    {
+        count++;
+    }
+
+    return count;
+}
+
+/* Begin a read-modify-write command at the first step of a table, the
+   rest is run by STATE_STEP_GET and STATE_STEP_SET.
+*/
+template <class Map>
+bool PCAL64Expander<Map>::stepStart(const step_t* steps)
+{
+    step = steps;
+    state = STATE_STEP_GET;
+
+    return readRegister(step->reg);
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::readRegister(uint8_t reg)
+{
+    int8_t slot = shadowSlot(reg);
+
+    /* Serve the read from the shadow and continue the state machine
+       immediately instead of waiting for the bus.
+    */
+    if (shadowEnabled && (slot >= 0))
+    {
+        pack(readBuffer, shadow[slot]);
+
+        eventHandler();
+
+        return true;
+    }
+
+    STATISTICS(statistics.transactions++);
+
+    return bus->read(this, address, reg | Map::AUTO_INCREMENT, readBuffer, PORTS);
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::writeRegister(uint8_t reg, pins_t value)
+{
+    int8_t slot = shadowSlot(reg);
+
+    if (slot >= 0)
+    {
+        /* the device already holds this value, skip the write */
+        if (shadowEnabled && (shadow[slot] == value))
+        {
+            eventHandler();
+
+            return true;
+        }
+
+        shadow[slot] = value;
+    }
+
+    uint8_t writeBuffer[PORTS];
+    pack(writeBuffer, value);
+
+    STATISTICS(statistics.transactions++);
+
+    return bus->write(this, address, reg | Map::AUTO_INCREMENT, writeBuffer, PORTS);
+}
+
+/* Reading the input port clears the interrupt status of every pin that
+   has changed since the previous read. Returns those that can interrupt,
+   so their edges are not lost, and keeps the values for the next time.
+*/
+template <class Map>
+typename PCAL64Expander<Map>::pins_t PCAL64Expander<Map>::inputChanged(pins_t values, pins_t read)
 {
-    i2c.frequency(400000);
+    pins_t changed = (values ^ inputValues) & read &
+                     shadow[SHADOW_CONFIGURATION] & ~shadow[SHADOW_INTERRUPT_MASK];
 
-    if (_irq != NC)
+    inputValues = (inputValues & ~read) | (values & read);
+
+    if (!inputValuesValid)
     {
-        irq.fall(this, &PCAL64::internalHandlerIRQ);
+        inputValuesValid = (read == ALL_BITS);
+
+        return 0;
     }
+
+    return changed;
 }
 
-PCAL64::~PCAL64()
+/* All pins of the ports from the first to the last that hold pins. */
+template <class Map>
+typename PCAL64Expander<Map>::pins_t PCAL64Expander<Map>::portsOf(pins_t pins)
 {
-    irq.fall(NULL);
+    uint8_t first = __builtin_ctzll(pins) / 8;
+    uint8_t last = (63 - __builtin_clzll(pins)) / 8;
+
+    return (ALL_BITS >> (8 * (PORTS - 1 - last))) & (ALL_BITS << (8 * first));
 }
 
-bool PCAL64::bulkRead(FunctionPointer1<void, uint32_t> callback)
+/* Burst over the ports that hold pins only, from the first to the last. */
+template <class Map>
+bool PCAL64Expander<Map>::readPorts(uint8_t reg, pins_t pins)
 {
-    bool result = false;
-
-    if (state == STATE_IDLE)
-    {
-        state = STATE_READ_GET_STATUS;
-        externalReadHandler = callback;
+    uint8_t first = __builtin_ctzll(pins) / 8;
+    uint8_t last = (63 - __builtin_clzll(pins)) / 8;
 
-        /* Read the interrupt status register before reading the input register.
-           This is to prevent accidentally erasing the interrupt status register
-           before the interrupt handler has had a chance to read it.
+    memset(burstBuffer, 0, PORTS);
 
-           The status and input values are cached in case the interrupt handler
-           needs them.
-        */
-        FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-        result = i2c.read(address, INTERRUPT_STATUS_0, readBuffer, 2, fp);
-    }
+    STATISTICS(statistics.transactions++);
 
-    return result;
+    return bus->read(this, address, (reg + first) | Map::AUTO_INCREMENT, burstBuffer + first, last - first + 1);
 }
 
-bool PCAL64::bulkWrite(uint32_t _pins, uint32_t directions, uint32_t values, FunctionPointer0<void> callback)
+template <class Map>
+bool PCAL64Expander<Map>::writePorts(uint8_t reg, pins_t pins, pins_t value)
 {
-    bool result = false;
+    uint8_t first = __builtin_ctzll(pins) / 8;
+    uint8_t last = (63 - __builtin_clzll(pins)) / 8;
+    int8_t slot = shadowSlot(reg);
 
-    if (state == STATE_IDLE)
+    if (slot >= 0)
     {
-        state = STATE_WRITE_GET_DIRECTIONS;
-        externalDoneHandler = callback;
-
-        pins = _pins;
+        shadow[slot] = value;
+    }
 
-        /* NOTE: the PCAL64 defines 0 to be output and 1 to be input.
-           This is opposite from the gpio-expander API, hence the invesion.
-        */
-        param1 = ~directions;
-        param2 = values;
+    pack(burstBuffer, value);
 
-        FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-        result = i2c.read(address, CONFIGURATION_PORT_0, readBuffer, 2, fp);
-    }
+    STATISTICS(statistics.transactions++);
 
-    return result;
+    return bus->write(this, address, (reg + first) | Map::AUTO_INCREMENT, burstBuffer + first, last - first + 1);
 }
 
-bool PCAL64::bulkToggle(uint32_t _pins, FunctionPointer0<void> callback)
+template <class Map>
+void PCAL64Expander<Map>::transferDone(bool success)
 {
-    bool result = false;
+    if (success)
+    {
+        retryCount = 0;
 
-    if (state == STATE_IDLE)
+        eventHandler();
+    }
+    else if (retryCount < retryLimit)
+    {
+        /* the bus kept the transfer, the state machine waits where it is */
+        STATISTICS(statistics.retries++);
+
+        if (blocking)
+        {
+            /* no scheduler yet, go again at once */
+            retryCount++;
+
+            bus->retry(this);
+        }
+        else
+        {
+            uint8_t shift = (retryCount < 7) ? retryCount : 7;
+            retryCount++;
+
+            retryTimer = minar::Scheduler::postCallback(this, &PCAL64Expander::retryTimeout)
+                            .delay(minar::milliseconds((uint32_t) retryBackoff << shift))
+                            .tolerance(1)
+                            .getHandle();
+        }
+    }
+    else if (servicingInterrupt())
     {
-        state = STATE_TOGGLE_GET_VALUES;
-        externalDoneHandler = callback;
+        /* out of retries, give up on the interrupt but not on the command
+           it interrupted
+        */
+        retryCount = 0;
 
-        pins = _pins;
+        reportFailure(FAILURE_INTERRUPT);
+        interruptServiced(false);
 
-        FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-        result = i2c.read(address, OUTPUT_PORT_0, readBuffer, 2, fp);
+        /* the status was not read, INT is still asserted and no new edge
+           will come. Try again from the scheduler.
+        */
+        if (irqConnected && (irq.read() == 0))
+        {
+            internalHandlerIRQ();
+        }
+
+        state = resumeState;
+        resumeState = STATE_IDLE;
+
+        if (state != STATE_IDLE)
+        {
+            memcpy(readBuffer, resumeBuffer, PORTS);
+
+            eventHandler();
+        }
+        else
+        {
+            processQueue();
+        }
     }
+    else
+    {
+        /* out of retries, give up on the command */
+        STATISTICS(statistics.rejected++);
 
-    return result;
+        retryCount = 0;
+        transferFailed = true;
+
+        reportFailure(FAILURE_COMMAND);
+
+        /* commands merged into the write fail with it */
+        if (current.type == COMMAND_OUTPUT)
+        {
+            while ((queueCount > 0) && (queue[queueHead].type == COMMAND_NOTIFY))
+            {
+                queueHead = (queueHead + 1) % YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE;
+                queueCount--;
+
+                reportFailure(FAILURE_COMMAND);
+            }
+        }
+
+        if (state == STATE_SEQUENCE_SET_PORTS)
+        {
+            state = STATE_IDLE;
+
+            sequenceFrameEnd(false);
+        }
+
+        state = STATE_IDLE;
+        resumeState = STATE_IDLE;
+
+        processQueue();
+    }
 }
 
-bool PCAL64::bulkSetInterrupt(uint32_t _pins, uint32_t values, FunctionPointer0<void> callback)
+template <class Map>
+void PCAL64Expander<Map>::reportFailure(failure_t failure)
 {
-    bool result = false;
-
-    if (state == STATE_IDLE)
+    if (errorHandler)
     {
-        state = STATE_INTERRUPT_GET_DIRECTIONS;
-        externalDoneHandler = callback;
+        minar::Scheduler::postCallback(errorHandler.bind(address, failure))
+            .tolerance(1);
+    }
+}
 
-        pins = _pins;
-        param1 = values;
+template <class Map>
+void PCAL64Expander<Map>::retryTimeout(void)
+{
+    retryTimer = NULL;
 
-        FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-        result = i2c.read(address, CONFIGURATION_PORT_0, readBuffer, 2, fp);
-    }
+    bus->retry(this);
+}
 
-    return result;
+template <class Map>
+bool PCAL64Expander<Map>::transferUrgent(void) const
+{
+    return irqPending || servicingInterrupt();
 }
 
-void PCAL64::setInterruptHandler(FunctionPointer3<void, uint16_t, uint32_t, uint32_t> callback)
+template <class Map>
+bool PCAL64Expander<Map>::servicingInterrupt(void) const
 {
-    externalIRQHandler = callback;
+    return (state == STATE_INTERRUPT_GET_STATUS) ||
+           (state == STATE_INTERRUPT_SET_MASK) ||
+           (state == STATE_INTERRUPT_GET_VALUES);
 }
 
-void PCAL64::clearInterruptHandler(void)
+template <class Map>
+bool PCAL64Expander<Map>::interruptPossible(void) const
 {
-    externalIRQHandler.clear();
+    /* only inputs with a cleared mask bit can assert INT */
+    return !shadowEnabled ||
+           ((shadow[SHADOW_CONFIGURATION] & ~shadow[SHADOW_INTERRUPT_MASK]) != 0);
 }
 
-void PCAL64::internalHandlerIRQ(void)
+/* Reading the input port clears the interrupt status. It only matters if
+   somebody services the interrupt and an input can assert it.
+*/
+template <class Map>
+bool PCAL64Expander<Map>::interruptsInUse(void) const
 {
-    minar::Scheduler::postCallback(this, &PCAL64::internalHandlerTask)
-        .tolerance(1);
+    return (irqConnected || interruptAttached()) && interruptPossible();
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::statusPreReadNeeded(void) const
+{
+    return statusPreRead && interruptsInUse();
 }
 
-void PCAL64::internalHandlerTask(void)
+template <class Map>
+void PCAL64Expander<Map>::interruptRequest(void)
 {
+#if YOTTA_CFG_GPIO_PCAL64_STATISTICS
+    if (!irqPending)
+    {
+        irqEdge = us_ticker_read();
+    }
+#endif
+
+    /* already in minar context, no need to post */
+    irqPending = true;
+
     if (state == STATE_IDLE)
     {
-        state = STATE_INTERRUPT_GET_STATUS;
+        serviceInterrupt();
+    }
+}
 
-        FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-        i2c.read(address, INTERRUPT_STATUS_0, readBuffer, 2, fp);
+template <class Map>
+void PCAL64Expander<Map>::internalHandlerIRQ(void)
+{
+#if YOTTA_CFG_GPIO_PCAL64_STATISTICS
+    /* latency is measured from the first edge not yet serviced */
+    if (!irqPending)
+    {
+        irqEdge = us_ticker_read();
     }
-    else
+#endif
+
+    irqPending = true;
+
+    /* one task in the scheduler at most, however fast the edges come */
+    if (!irqTaskPosted)
     {
-        // transfer in progress, repost IRQ handler with 1 ms delay
-        minar::Scheduler::postCallback(this, &PCAL64::internalHandlerTask)
-            .delay(minar::milliseconds(1))
+        irqTaskPosted = true;
+
+        minar::Scheduler::postCallback(this, &PCAL64Expander::internalHandlerTask)
             .tolerance(1);
     }
 }
 
-void PCAL64::eventHandler()
+template <class Map>
+void PCAL64Expander<Map>::internalHandlerTask(void)
+{
+    irqTaskPosted = false;
+
+    /* If a transfer is in progress the pending flag is picked up by
+       eventHandler as soon as that transfer completes.
+    */
+    if ((state == STATE_IDLE) && irqPending)
+    {
+        serviceInterrupt();
+    }
+}
+
+template <class Map>
+bool PCAL64Expander<Map>::serviceInterrupt(void)
+{
+    STATISTICS(statistics.irqs++);
+
+    irqPending = false;
+
+    state = STATE_INTERRUPT_GET_STATUS;
+
+    bool result = readRegister(Map::INTERRUPT_STATUS);
+
+    if (!result)
+    {
+        state = STATE_IDLE;
+
+        interruptServiced(false);
+    }
+
+    return result;
+}
+
+template <class Map>
+void PCAL64Expander<Map>::eventHandler()
 {
+    /* Interrupts take priority over the command in progress. Park the
+       command between two transactions, read the interrupt status and
+       pin values, and resume the command afterwards.
+    */
+    if (irqPending &&
+        (state != STATE_IDLE) &&
+        (state != STATE_SIGNAL_DONE) &&
+        !servicingInterrupt())
+    {
+        STATISTICS(statistics.irqDeferred++);
+
+        resumeState = state;
+        memcpy(resumeBuffer, readBuffer, PORTS);
+
+        if (serviceInterrupt())
+        {
+            return;
+        }
+
+        state = resumeState;
+        resumeState = STATE_IDLE;
+    }
+
     switch (state)
     {
         /*********************************************************************/
@@ -166,13 +2730,18 @@ void PCAL64::eventHandler()
             {
                 state = STATE_READ_GET_VALUES;
 
-                uint32_t status = readBuffer[1];
-                status = (status << 8) | readBuffer[0];
+                pins_t status = unpack(readBuffer);
+
+                /* not again if an interrupt service has reported it */
+                if (!statusServiced)
+                {
+                    backupStatus |= status;
+                }
 
-                backupStatus = status;
+                statusServiced = false;
+                current.param1 = status;
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.read(address, INPUT_PORT_0, readBuffer, 2, fp);
+                readRegister(Map::INPUT_PORT);
             }
             break;
 
@@ -180,244 +2749,459 @@ void PCAL64::eventHandler()
             {
                 state = STATE_IDLE;
 
-                uint32_t values = readBuffer[1];
-                values = (values << 8) | readBuffer[0];
+                pins_t values = unpack(readBuffer);
+
+                backupStatus |= inputChanged(values, ALL_BITS);
+
+                if (current.type == COMMAND_SAMPLE)
+                {
+                    debounceResolve(values);
+                    stormPoll(values);
+                    break;
+                }
+
+                if (current.type == COMMAND_STREAM)
+                {
+                    if (streamRing)
+                    {
+                        streamRing->push(streamTimestamp, values);
+                    }
+                    break;
+                }
+
+                STATISTICS(recordLatency(statistics.commandLatency, current.submitted));
+
+                if (current.readHandler)
+                {
+                    minar::Scheduler::postCallback(current.readHandler.bind(values))
+                        .tolerance(1);
+                }
 
-                backupValues = values;
+                if (current.statusReadHandler)
+                {
+                    minar::Scheduler::postCallback(current.statusReadHandler.bind(current.param1, values))
+                        .tolerance(1);
+                }
 
-                if (externalReadHandler)
+                if (current.doneHandler)
                 {
-                    minar::Scheduler::postCallback(externalReadHandler.bind(values))
+                    minar::Scheduler::postCallback(current.doneHandler)
                         .tolerance(1);
                 }
             }
             break;
 
         /*********************************************************************/
-        /* bulkWrite                                                         */
+        /* bulkWrite, bulkToggle, bulkInterrupt and internal mask changes    */
         /*********************************************************************/
-        case STATE_WRITE_GET_DIRECTIONS:
+        case STATE_STEP_GET:
             {
-                state = STATE_WRITE_SET_DIRECTIONS;
+                pins_t value = unpack(readBuffer);
+
+                switch (step->rule & ~RULE_RELEASE)
+                {
+                    case RULE_SET_ON_1:
+                        value = (value & ~current.pins) | (current.param1 & current.pins);
+                        break;
 
-                uint16_t directions = readBuffer[1];
-                directions = (directions << 8) | readBuffer[0];
+                    case RULE_SET_ON_0:
+                        value = (value & ~current.pins) | (~current.param1 & current.pins);
+                        break;
 
-                /* pins are input when bit is 1 */
+                    case RULE_DIRECTION_DELTA:
+                        value = (value & current.directionKeep) ^ current.directionFlip;
+                        break;
 
-                // enable bits
-                directions |= (pins & param1);
+                    default:
+                        value = (value & current.outputKeep) ^ current.outputFlip;
+                        break;
+                }
 
-                // disable bits
-                directions &= ~(pins & ~param1);
+                if (step->rule & RULE_RELEASE)
+                {
+                    /* A pin enabled while it debounces stays masked until the
+                       debounce ends, which reports the edge that started it.
+                       Otherwise the application's setting replaces a
+                       debounce or polling in progress.
+                    */
+                    pins_t kept = debouncing & current.pins & current.param1;
+                    pins_t released = current.pins & ~kept;
+
+                    value |= kept;
+
+                    debouncing &= ~released;
+                    maskPending &= ~current.pins;
+                    unmaskPending &= ~current.pins;
+                    debounceUnknown &= ~released;
+                    storming &= ~current.pins;
+                    stormChanged &= ~current.pins;
+                    interruptsOff = (interruptsOff & ~current.pins) | (current.pins & ~current.param1);
+                }
 
-                uint8_t writeBuffer[2];
-                writeBuffer[0] = directions;
-                writeBuffer[1] = directions >> 8;
+                state = (step[1].reg == STEP_END) ? STATE_SIGNAL_DONE : STATE_STEP_SET;
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.write(address, CONFIGURATION_PORT_0, writeBuffer, 2, fp);
+                writeRegister(step->reg, value);
             }
             break;
 
-        case STATE_WRITE_SET_DIRECTIONS:
+        case STATE_STEP_SET:
             {
-                state = STATE_WRITE_GET_VALUES;
+                step++;
+                state = STATE_STEP_GET;
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.read(address, OUTPUT_PORT_0, readBuffer, 2, fp);
+                readRegister(step->reg);
             }
             break;
 
-        case STATE_WRITE_GET_VALUES:
+        /*********************************************************************/
+        /* configure                                                         */
+        /*********************************************************************/
+        case STATE_CONFIG_GET_BANKS:
             {
-                state = STATE_SIGNAL_DONE;
-
-                uint16_t values = readBuffer[1];
-                values = (values << 8) | readBuffer[0];
-
-                /* pins are high when bit is 1 */
+                const Config& config = *current.config;
 
-                // enable bits
-                values |= (pins & param2);
-
-                // disable bits
-                values &= ~(pins & ~param2);
+                for (uint8_t index = 0; index < configRunCount; index++)
+                {
+                    uint8_t bank = configRunBank + index;
+                    pins_t mask = config.mask[bank] & configBits(bank);
+                    pins_t held = unpack(burstBuffer + index * PORTS);
+                    pins_t desired = (held & ~mask) | (config.value[bank] & mask);
 
-                uint8_t writeBuffer[2];
-                writeBuffer[0] = values;
-                writeBuffer[1] = values >> 8;
+                    if (desired != held)
+                    {
+                        configValues[bank] = desired;
+                        configChanged |= 1 << bank;
+                    }
+                }
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.write(address, OUTPUT_PORT_0, writeBuffer, 2, fp);
+                configStep();
             }
             break;
 
-        /*********************************************************************/
-        /* bulkToggle                                                        */
-        /*********************************************************************/
-        case STATE_TOGGLE_GET_VALUES:
+        case STATE_CONFIG_SET_BANKS:
+            configStep();
+            break;
+
+        case STATE_CONFIG_GET_PORTS:
             {
                 state = STATE_SIGNAL_DONE;
 
-                uint16_t values = readBuffer[1];
-                values = (values << 8) | readBuffer[0];
+                const Config& config = *current.config;
+                uint8_t desired = (burstBuffer[0] & ~config.portMask) | (config.portValue & config.portMask);
 
-                uint16_t original = values;
+                shadowPortConfiguration = desired;
 
-                // enable bits
-                values |= (pins & ~original);
+                if (desired == burstBuffer[0])
+                {
+                    eventHandler();
+                    break;
+                }
 
-                // disable bits
-                values &= ~(pins & original);
+                burstBuffer[0] = desired;
 
-                uint8_t writeBuffer[2];
-                writeBuffer[0] = values;
-                writeBuffer[1] = values >> 8;
+                STATISTICS(statistics.transactions++);
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.write(address, OUTPUT_PORT_0, writeBuffer, 2, fp);
+                bus->write(this, address, Map::OUTPUT_PORT_CONFIGURATION | Map::AUTO_INCREMENT, burstBuffer, 1);
             }
             break;
 
         /*********************************************************************/
-        /* bulkInterrupt                                                     */
+        /* IRQ handler                                                       */
         /*********************************************************************/
-        case STATE_INTERRUPT_GET_DIRECTIONS:
+        case STATE_INTERRUPT_GET_STATUS:
             {
-                state = STATE_INTERRUPT_SET_DIRECTIONS;
+                cache = unpack(readBuffer);
+
+                stormCheck(cache);
 
-                uint16_t directions = readBuffer[1];
-                directions = (directions << 8) | readBuffer[0];
+                /* Mask pins that start debouncing or have just turned noisy
+                   before the input read clears their status, so edges in
+                   between are ignored. Needs the shadow to write the mask
+                   without reading it.
+                */
+                pins_t masking = (cache & debounceEnabled & ~debouncing) | (storming & maskPending);
 
-                /* pins are input when bit is 1 */
+                /* a key press: the columns stay masked while the matrix is scanned */
+                if (cache & keypadColumns)
+                {
+                    masking |= keypadColumns & ~shadow[SHADOW_INTERRUPT_MASK];
+                }
 
-                // enable bits
-                directions |= (pins & param1);
+                if (masking && shadowEnabled)
+                {
+                    state = STATE_INTERRUPT_SET_MASK;
 
-                // disable bits
-                directions &= ~(pins & ~param1);
+                    maskPending &= ~masking;
+                    debounceMasked = cache & debounceEnabled & ~debouncing;
 
-                uint8_t writeBuffer[2];
-                writeBuffer[0] = directions;
-                writeBuffer[1] = directions >> 8;
+                    writeRegister(Map::INTERRUPT_MASK, shadow[SHADOW_INTERRUPT_MASK] | masking);
+                }
+                else
+                {
+                    state = STATE_INTERRUPT_GET_VALUES;
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.write(address, CONFIGURATION_PORT_0, writeBuffer, 2, fp);
+                    readRegister(Map::INPUT_PORT);
+                }
             }
             break;
 
-        case STATE_INTERRUPT_SET_DIRECTIONS:
+        case STATE_INTERRUPT_SET_MASK:
             {
-                state = STATE_INTERRUPT_GET_LATCH;
+                state = STATE_INTERRUPT_GET_VALUES;
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.read(address, INPUT_LATCH_0, readBuffer, 2, fp);
+                readRegister(Map::INPUT_PORT);
             }
             break;
 
-        case STATE_INTERRUPT_GET_LATCH:
+        case STATE_INTERRUPT_GET_VALUES:
             {
-                state = STATE_INTERRUPT_SET_LATCH;
+                state = resumeState;
+                resumeState = STATE_IDLE;
+
+                pins_t values = unpack(readBuffer);
+
+                /* A normal read call can clear interrupts if it is already
+                   running when an interrupt fires. So all read calls also
+                   read and store the interrupt status register, and note
+                   the pins their input read found changed, in the odd event
+                   that a read call clears the status register before the
+                   interrupt handler gets to read it. Likewise a pin that
+                   changes between the status and the input read here is
+                   cleared by the input read.
+
+                   The pins from the backup are reported with the values
+                   just read, once. With nothing to report this expander did
+                   not fire, e.g. on a shared interrupt line.
+                */
+                pins_t status = cache | inputChanged(values, ALL_BITS);
+
+                if (backupStatus)
+                {
+                    if (!status)
+                    {
+                        STATISTICS(statistics.irqBackupUsed++);
+                    }
+
+                    status |= backupStatus;
+                }
+
+                backupStatus = 0;
 
-                uint16_t latch = readBuffer[1];
-                latch = (latch << 8) | readBuffer[0];
+                pins_t report = debounceStart(keypadInterrupt(status));
 
-                /* pins are latched when bit is 1 */
+                if (report)
+                {
+                    queueEvent(report, values);
+                }
 
-                // enable bits
-                latch |= (pins & param1);
+                STATISTICS(recordLatency(statistics.irqLatency, irqEdge));
 
-                // disable bits
-                latch &= ~(pins & ~param1);
+                interruptServiced(status != 0);
+
+                /* continue the command that was interrupted */
+                if (state != STATE_IDLE)
+                {
+                    memcpy(readBuffer, resumeBuffer, PORTS);
 
-                uint8_t writeBuffer[2];
-                writeBuffer[0] = latch;
-                writeBuffer[1] = latch >> 8;
+                    /* the status a read parked with was read again above */
+                    statusServiced = (state == STATE_READ_GET_STATUS);
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.write(address, INPUT_LATCH_0, writeBuffer, 2, fp);
+                    /* a step that read the shadow sees what the service masked */
+                    if ((state == STATE_STEP_GET) && shadowEnabled && (shadowSlot(step->reg) >= 0))
+                    {
+                        pack(readBuffer, shadow[shadowSlot(step->reg)]);
+                    }
 
+                    eventHandler();
+                }
             }
             break;
 
-        case STATE_INTERRUPT_SET_LATCH:
+        /*********************************************************************/
+        /* shadow registers                                                  */
+        /*********************************************************************/
+        case STATE_SHADOW_GET_REGISTER:
             {
-                state = STATE_INTERRUPT_GET_MASK;
+                pins_t value = unpack(readBuffer);
+
+                shadow[shadowIndex] = value;
+                shadowIndex++;
+
+                if (shadowIndex < SHADOW_END)
+                {
+                    readRegister(shadowRegisters[shadowIndex]);
+                }
+                else
+                {
+                    state = STATE_SHADOW_GET_PORTS;
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.read(address, INTERRUPT_MASK_0, readBuffer, 2, fp);
+                    STATISTICS(statistics.transactions++);
+
+                    bus->read(this, address, Map::OUTPUT_PORT_CONFIGURATION | Map::AUTO_INCREMENT, burstBuffer, 1);
+                }
             }
             break;
 
-        case STATE_INTERRUPT_GET_MASK:
+        case STATE_SHADOW_GET_PORTS:
             {
+                shadowPortConfiguration = burstBuffer[0];
+                shadowEnabled = true;
+
                 state = STATE_SIGNAL_DONE;
+                eventHandler();
+            }
+            break;
+
+        /*********************************************************************/
+        /* snapshot restore                                                  */
+        /*********************************************************************/
+        case STATE_RESTORE_SET_BANKS:
+            restoreStep();
+            break;
+
+        case STATE_RESTORE_SET_PORTS:
+            if (current.param1)
+            {
+                restoreSlot = 0;
+                restoreVerifying = true;
 
-                uint16_t values = readBuffer[1];
-                values = (values << 8) | readBuffer[0];
+                restoreStep();
+            }
+            else
+            {
+                state = STATE_SIGNAL_DONE;
+                eventHandler();
+            }
+            break;
 
-                /* interrupts are enabled when bit is 0 */
+        case STATE_RESTORE_GET_BANKS:
+            {
+                uint8_t slot = restoreSlot - restoreRunCount;
 
-                // enable bits
-                values |= (pins & ~param1);
+                if (memcmp(burstBuffer, current.snapshot->banks[slot], restoreRunCount * PORTS))
+                {
+                    restoreMatch = false;
+                }
 
-                // disable bits
-                values &= ~(pins & param1);
+                restoreStep();
+            }
+            break;
 
-                uint8_t writeBuffer[2];
-                writeBuffer[0] = values;
-                writeBuffer[1] = values >> 8;
+        case STATE_RESTORE_GET_PORTS:
+            {
+                if (burstBuffer[0] != current.snapshot->outputPortConfiguration)
+                {
+                    restoreMatch = false;
+                }
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.write(address, INTERRUPT_MASK_0, writeBuffer, 2, fp);
+                state = STATE_SIGNAL_DONE;
+                eventHandler();
             }
             break;
 
         /*********************************************************************/
-        /* IRQ handler                                                       */
+        /* sequence player                                                   */
         /*********************************************************************/
-        case STATE_INTERRUPT_GET_STATUS:
+        case STATE_SEQUENCE_SET_PORTS:
+            state = STATE_IDLE;
+
+            sequenceFrameEnd(true);
+            break;
+
+        /*********************************************************************/
+        /* key matrix                                                        */
+        /*********************************************************************/
+        case STATE_KEYPAD_SET_ROW:
+            if (keypadColumns)
             {
-                state = STATE_INTERRUPT_GET_VALUES;
+                state = STATE_KEYPAD_GET_COLUMNS;
+
+                readPorts(Map::INPUT_PORT, keypadColumns);
+            }
+            else
+            {
+                state = STATE_IDLE;
+            }
+            break;
+
+        case STATE_KEYPAD_GET_COLUMNS:
+            {
+                pins_t values = unpack(burstBuffer);
+                uint8_t down = 0;
+
+                backupStatus |= inputChanged(values, portsOf(keypadColumns));
+
+                for (uint8_t column = 0; column < keypadColumnCount; column++)
+                {
+                    if (!((values >> keypadColumnPin[column]) & 1))
+                    {
+                        down |= 1 << column;
+                    }
+                }
 
-                cache = readBuffer[1];
-                cache = (cache << 8) | readBuffer[0];
+                keypadScan[keypadRow] = down;
+                keypadRow++;
 
-                FunctionPointer0<void> fp(this, &PCAL64::eventHandler);
-                i2c.read(address, INPUT_PORT_0, readBuffer, 2, fp);
+                keypadStep();
             }
             break;
 
-        case STATE_INTERRUPT_GET_VALUES:
+        case STATE_KEYPAD_SET_ROWS:
+            {
+                state = STATE_IDLE;
+
+                if (!keypadRows)
+                {
+                    break;
+                }
+
+                keypadResolve();
+
+                bool held = false;
+
+                for (uint8_t row = 0; row < keypadRowCount; row++)
+                {
+                    held |= (keypadScan[row] != 0);
+                }
+
+                if (held)
+                {
+                    keypadTimer = minar::Scheduler::postCallback(this, &PCAL64Expander::keypadTimeout)
+                                    .delay(minar::milliseconds(keypadPeriod))
+                                    .tolerance(1)
+                                    .getHandle();
+                }
+                else
+                {
+                    /* a key pressed after its row was scanned still shows */
+                    state = STATE_KEYPAD_GET_IDLE;
+
+                    readPorts(Map::INPUT_PORT, keypadColumns);
+                }
+            }
+            break;
+
+        case STATE_KEYPAD_GET_IDLE:
             {
                 state = STATE_IDLE;
 
-                uint16_t values = readBuffer[1];
-                values = (values << 8) | readBuffer[0];
+                pins_t values = unpack(burstBuffer);
 
-                if (externalIRQHandler)
+                backupStatus |= inputChanged(values, portsOf(keypadColumns));
+
+                if ((values & keypadColumns) != keypadColumns)
+                {
+                    keypadTimer = minar::Scheduler::postCallback(this, &PCAL64Expander::keypadTimeout)
+                                    .delay(minar::milliseconds(keypadPeriod))
+                                    .tolerance(1)
+                                    .getHandle();
+                }
+                else
                 {
-                    /* A normal read call can clear interrupts if it is already
-                       running when an interrupt fires. So all read calls also
-                       reads and stores the interrupt status register and the
-                       pin values in a cache in the odd event that a read call
-                       cleares the status register before the interrupt handler
-                       gets to read it.
+                    keypadScanning = false;
 
-                       In this particular case the status register will be zero
-                       and we can substitute it with the cached version instead.
-                    */
-                    if (cache)
-                    {
-                        minar::Scheduler::postCallback(externalIRQHandler.bind(address, cache, values))
-                            .tolerance(1);
-                    }
-                    else
-                    {
-                        minar::Scheduler::postCallback(externalIRQHandler.bind(address, backupStatus, backupValues))
-                            .tolerance(1);
-                    }
+                    unmaskPending |= keypadColumns;
+                    maskPending &= ~keypadColumns;
                 }
             }
             break;
@@ -429,9 +3213,17 @@ void PCAL64::eventHandler()
             {
                 state = STATE_IDLE;
 
-                if (externalDoneHandler)
+                STATISTICS(recordLatency(statistics.commandLatency, current.submitted));
+
+                if (current.doneHandler)
+                {
+                    minar::Scheduler::postCallback(current.doneHandler)
+                        .tolerance(1);
+                }
+
+                if (current.restoreHandler)
                 {
-                    minar::Scheduler::postCallback(externalDoneHandler)
+                    minar::Scheduler::postCallback(current.restoreHandler.bind(restoreMatch))
                         .tolerance(1);
                 }
             }
@@ -441,4 +3233,17 @@ void PCAL64::eventHandler()
             state = STATE_IDLE;
             break;
     }
+
+    /* start the next queued command as soon as the current one is done */
+    if (state == STATE_IDLE)
+    {
+        processQueue();
+    }
 }
+
+/* Parts the driver is built for. Member functions of unused parts are
+   discarded by the linker.
+*/
+template class PCAL64Expander<PCAL6416AMap>;
+template class PCAL64Expander<PCAL6524Map>;
+template class PCAL64Expander<PCAL6534Map>;
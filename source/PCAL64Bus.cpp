@@ -0,0 +1,535 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gpio-pcal64/PCAL64Bus.h"
+
+PCAL64BusClient::PCAL64BusClient(void)
+    :   next(NULL),
+        pending(false),
+        isRead(false),
+        address(0),
+        reg(0),
+        length(0),
+        readData(NULL)
+{
+}
+
+PCAL64Bus::PCAL64Bus(PinName _sda, PinName _scl)
+    :   i2c(_sda, _scl),
+        sda(_sda),
+        scl(_scl),
+        hz(400000),
+        polledI2C(NULL),
+        clients(NULL),
+        active(NULL),
+        last(NULL),
+        failedCallback(NULL),
+        dispatching(false),
+        sequence(0),
+        started(0),
+        timeout(YOTTA_CFG_GPIO_PCAL64_TRANSFER_TIMEOUT),
+        watchdogTimer(NULL),
+        timeouts(0),
+        staleCompletions(0)
+{
+    for (uint8_t index = 0; index < COMPLETIONS; index++)
+    {
+        completions[index].bus = this;
+        completions[index].sequence = 0;
+        completions[index].taken = false;
+    }
+
+    i2c.frequency(hz);
+}
+
+PCAL64Bus::~PCAL64Bus(void)
+{
+    if (watchdogTimer)
+    {
+        minar::Scheduler::cancelCallback(watchdogTimer);
+    }
+
+    if (failedCallback)
+    {
+        minar::Scheduler::cancelCallback(failedCallback);
+    }
+}
+
+void PCAL64Bus::frequency(uint32_t _hz)
+{
+    hz = _hz;
+    i2c.frequency(hz);
+}
+
+void PCAL64Bus::setTimeout(uint16_t milliseconds)
+{
+    timeout = milliseconds;
+
+    /* rearmed with the new period by the next transfer */
+    if (watchdogTimer)
+    {
+        minar::Scheduler::cancelCallback(watchdogTimer);
+        watchdogTimer = NULL;
+    }
+}
+
+uint32_t PCAL64Bus::getTimeouts(void) const
+{
+    return timeouts;
+}
+
+uint32_t PCAL64Bus::getStaleCompletions(void) const
+{
+    return staleCompletions;
+}
+
+bool PCAL64Bus::recover(void)
+{
+    /* half a clock period, at least 5 us for standard mode */
+    uint32_t half = 500000 / hz;
+
+    if (half < 5)
+    {
+        half = 5;
+    }
+
+    /* open-drain by hand: output low or input and let the pull-up win */
+    DigitalInOut data(sda);
+    DigitalInOut clock(scl);
+
+    data.input();
+    clock.input();
+
+    /* the slave shifts out the rest of its byte, one bit per clock */
+    for (uint8_t pulse = 0; (pulse < 9) && !data.read(); pulse++)
+    {
+        clock = 0;
+        clock.output();
+        wait_us(half);
+
+        clock.input();
+        wait_us(half);
+    }
+
+    /* STOP, SDA rising while SCL is high */
+    clock = 0;
+    clock.output();
+    data = 0;
+    data.output();
+    wait_us(half);
+
+    clock.input();
+    wait_us(half);
+
+    data.input();
+    wait_us(half);
+
+    bool released = data.read();
+
+    /* hand the pins back to the peripheral */
+    {
+        I2C bus(sda, scl);
+        bus.frequency(hz);
+    }
+
+    i2c.frequency(hz);
+
+    return released;
+}
+
+void PCAL64Bus::attach(PCAL64BusClient* client)
+{
+    client->next = clients;
+    clients = client;
+}
+
+void PCAL64Bus::detach(PCAL64BusClient* client)
+{
+    for (PCAL64BusClient** link = &clients; *link; link = &(*link)->next)
+    {
+        if (*link == client)
+        {
+            *link = client->next;
+            break;
+        }
+    }
+
+    client->next = NULL;
+    client->pending = false;
+
+    if (last == client)
+    {
+        last = NULL;
+    }
+
+    /* its transfer is dropped, nobody is left to hear how it ended */
+    if (active == client)
+    {
+        if (failedCallback)
+        {
+            minar::Scheduler::cancelCallback(failedCallback);
+            failedCallback = NULL;
+        }
+        else if (!polledI2C)
+        {
+            abort();
+        }
+
+        active = NULL;
+
+        if (!dispatching)
+        {
+            schedule();
+        }
+    }
+}
+
+bool PCAL64Bus::read(PCAL64BusClient* client, uint16_t address, uint8_t reg, uint8_t* data, uint8_t length)
+{
+    if (length > PCAL64BusClient::MAX_TRANSFER)
+    {
+        return false;
+    }
+
+    client->isRead = true;
+    client->address = address;
+    client->reg = reg;
+    client->length = length;
+    client->readData = data;
+
+    return submit(client);
+}
+
+bool PCAL64Bus::write(PCAL64BusClient* client, uint16_t address, uint8_t reg, const uint8_t* data, uint8_t length)
+{
+    if (length > PCAL64BusClient::MAX_TRANSFER)
+    {
+        return false;
+    }
+
+    client->isRead = false;
+    client->address = address;
+    client->reg = reg;
+    client->length = length;
+    memcpy(client->writeData, data, length);
+
+    return submit(client);
+}
+
+bool PCAL64Bus::submit(PCAL64BusClient* client)
+{
+    /* wait for a turn while the bus is in use */
+    if (active || dispatching)
+    {
+        client->pending = true;
+
+        return true;
+    }
+
+    last = client;
+    active = client;
+
+    /* The caller is in the middle of its state machine. The failure is
+       delivered from the scheduler, like that of any other transfer.
+    */
+    if (!start(client))
+    {
+        failedCallback = minar::Scheduler::postCallback(this, &PCAL64Bus::transferFailed)
+                            .tolerance(1)
+                            .getHandle();
+    }
+
+    return true;
+}
+
+bool PCAL64Bus::retry(PCAL64BusClient* client)
+{
+    return submit(client);
+}
+
+bool PCAL64Bus::polled(FunctionPointer0<void> body)
+{
+    if (active || dispatching || polledI2C)
+    {
+        return false;
+    }
+
+    for (PCAL64BusClient* client = clients; client; client = client->next)
+    {
+        if (client->pending)
+        {
+            return false;
+        }
+    }
+
+    I2C bus(sda, scl);
+    bus.frequency(hz);
+
+    polledI2C = &bus;
+    body.call();
+    polledI2C = NULL;
+
+    return true;
+}
+
+bool PCAL64Bus::startPolled(PCAL64BusClient* client)
+{
+    /* register address first, then a repeated start for reads */
+    char buffer[1 + PCAL64BusClient::MAX_TRANSFER];
+    buffer[0] = client->reg;
+
+    int result;
+
+    if (client->isRead)
+    {
+        result = polledI2C->write(client->address, buffer, 1, true);
+
+        if (result == 0)
+        {
+            result = polledI2C->read(client->address, (char*) client->readData, client->length);
+        }
+    }
+    else
+    {
+        memcpy(&buffer[1], client->writeData, client->length);
+
+        result = polledI2C->write(client->address, buffer, 1 + client->length);
+    }
+
+    /* deliver the completion now, the caller is waiting for the command */
+    if (result == 0)
+    {
+        transferDone();
+    }
+    else
+    {
+        active = NULL;
+
+        dispatching = true;
+        client->transferDone(false);
+        dispatching = false;
+
+        schedule();
+    }
+
+    return true;
+}
+
+bool PCAL64Bus::start(PCAL64BusClient* client)
+{
+    if (polledI2C)
+    {
+        return startPolled(client);
+    }
+
+    Completion* completion = &completions[0];
+
+    for (uint8_t index = 0; index < COMPLETIONS; index++)
+    {
+        if (!completions[index].taken)
+        {
+            completion = &completions[index];
+            break;
+        }
+
+        if (completions[index].sequence < completion->sequence)
+        {
+            completion = &completions[index];
+        }
+    }
+
+    completion->sequence = ++sequence;
+    completion->taken = true;
+    started = minar::getTime();
+
+    if (timeout && !watchdogTimer)
+    {
+        watchdogTimer = minar::Scheduler::postCallback(this, &PCAL64Bus::watchdogTimeout)
+                            .period(minar::milliseconds(timeout))
+                            .tolerance(1)
+                            .getHandle();
+    }
+
+    FunctionPointer0<void> fp(completion, &Completion::done);
+
+    bool result;
+
+    if (client->isRead)
+    {
+        result = i2c.read(client->address, client->reg, client->readData, client->length, fp);
+    }
+    else
+    {
+        result = i2c.write(client->address, client->reg, client->writeData, client->length, fp);
+    }
+
+    /* refused, no completion will come */
+    if (!result)
+    {
+        completion->taken = false;
+    }
+
+    return result;
+}
+
+PCAL64BusClient* PCAL64Bus::nextClient(void) const
+{
+    if (clients == NULL)
+    {
+        return NULL;
+    }
+
+    /* round-robin, starting after the client that had the last turn */
+    PCAL64BusClient* first = (last && last->next) ? last->next : clients;
+    PCAL64BusClient* client = first;
+    PCAL64BusClient* selected = NULL;
+
+    do
+    {
+        if (client->pending)
+        {
+            if (client->transferUrgent())
+            {
+                return client;
+            }
+
+            if (selected == NULL)
+            {
+                selected = client;
+            }
+        }
+
+        client = client->next ? client->next : clients;
+    }
+    while (client != first);
+
+    return selected;
+}
+
+void PCAL64Bus::schedule(void)
+{
+    while (active == NULL)
+    {
+        PCAL64BusClient* client = nextClient();
+
+        if (client == NULL)
+        {
+            break;
+        }
+
+        client->pending = false;
+
+        last = client;
+        active = client;
+
+        if (!start(client))
+        {
+            active = NULL;
+
+            dispatching = true;
+            client->transferDone(false);
+            dispatching = false;
+        }
+    }
+}
+
+void PCAL64Bus::Completion::done(void)
+{
+    taken = false;
+
+    /* the transfer was abandoned, its client has moved on */
+    if ((bus->active == NULL) || (sequence != bus->sequence))
+    {
+        bus->staleCompletions++;
+
+        return;
+    }
+
+    bus->transferDone();
+}
+
+void PCAL64Bus::transferFailed(void)
+{
+    failedCallback = NULL;
+
+    /* the client was detached in the meantime */
+    if (active == NULL)
+    {
+        return;
+    }
+
+    PCAL64BusClient* client = active;
+    active = NULL;
+
+    dispatching = true;
+    client->transferDone(false);
+    dispatching = false;
+
+    schedule();
+}
+
+void PCAL64Bus::watchdogTimeout(void)
+{
+    /* idle, the next transfer arms the watchdog again */
+    if (active == NULL)
+    {
+        minar::Scheduler::cancelCallback(watchdogTimer);
+        watchdogTimer = NULL;
+
+        return;
+    }
+
+    /* refused, the failure is already on its way */
+    if (failedCallback ||
+        ((minar::tick_t) (minar::getTime() - started) < minar::milliseconds(timeout)))
+    {
+        return;
+    }
+
+    timeouts++;
+
+    /* A stuck slave may be what holds the transfer up. The peripheral is
+       stopped first so it does not drive the pins during the recovery. A
+       completion that comes all the same finds the bus idle or busy with a
+       newer transfer.
+    */
+    abort();
+    recover();
+
+    transferFailed();
+}
+
+/* The peripheral is shared by every I2C object on the pins, as in recover. */
+void PCAL64Bus::abort(void)
+{
+    I2C bus(sda, scl);
+    bus.abort_transfer();
+}
+
+void PCAL64Bus::transferDone(void)
+{
+    PCAL64BusClient* client = active;
+    active = NULL;
+
+    /* The client usually queues its next transfer from the callback. It
+       competes with the other waiting clients like everybody else.
+    */
+    dispatching = true;
+    client->transferDone(true);
+    dispatching = false;
+
+    schedule();
+}
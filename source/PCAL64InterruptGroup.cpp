@@ -0,0 +1,184 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gpio-pcal64/PCAL64InterruptGroup.h"
+
+PCAL64InterruptSource::PCAL64InterruptSource(void)
+    :   group(NULL),
+        next(NULL),
+        requested(false)
+{
+}
+
+PCAL64InterruptSource::~PCAL64InterruptSource(void)
+{
+    if (group)
+    {
+        group->detach(*this);
+    }
+}
+
+void PCAL64InterruptSource::interruptServiced(bool fired)
+{
+    if (group)
+    {
+        group->serviced(*this, fired);
+    }
+}
+
+bool PCAL64InterruptSource::interruptAttached(void) const
+{
+    return group != NULL;
+}
+
+PCAL64InterruptGroup::PCAL64InterruptGroup(PinName _irq)
+    :   irq(_irq),
+        sources(NULL),
+        outstanding(0),
+        fired(false),
+        edgePending(false),
+        statusReads(0)
+{
+    irq.fall(this, &PCAL64InterruptGroup::internalHandlerIRQ);
+}
+
+PCAL64InterruptGroup::~PCAL64InterruptGroup(void)
+{
+    irq.fall(NULL);
+
+    while (sources)
+    {
+        detach(*sources);
+    }
+}
+
+void PCAL64InterruptGroup::attach(PCAL64InterruptSource& source)
+{
+    if (source.group)
+    {
+        source.group->detach(source);
+    }
+
+    source.group = this;
+    source.next = sources;
+    sources = &source;
+}
+
+void PCAL64InterruptGroup::detach(PCAL64InterruptSource& source)
+{
+    for (PCAL64InterruptSource** link = &sources; *link; link = &(*link)->next)
+    {
+        if (*link == &source)
+        {
+            *link = source.next;
+            break;
+        }
+    }
+
+    /* do not leave the round waiting for an expander that is gone */
+    if (source.requested)
+    {
+        source.requested = false;
+        outstanding--;
+    }
+
+    source.group = NULL;
+    source.next = NULL;
+}
+
+uint32_t PCAL64InterruptGroup::getStatusReads(void) const
+{
+    return statusReads;
+}
+
+void PCAL64InterruptGroup::internalHandlerIRQ(void)
+{
+    /* A pending edge already has a task posted, or is picked up when the
+       round in progress completes.
+    */
+    if (!edgePending)
+    {
+        edgePending = true;
+
+        minar::Scheduler::postCallback(this, &PCAL64InterruptGroup::internalHandlerTask)
+            .tolerance(1);
+    }
+}
+
+void PCAL64InterruptGroup::internalHandlerTask(void)
+{
+    /* a round in progress picks up the edge when it completes */
+    if (outstanding == 0)
+    {
+        startRound();
+    }
+}
+
+void PCAL64InterruptGroup::startRound(void)
+{
+    edgePending = false;
+    fired = false;
+
+    /* Mark every candidate before asking any of them, an expander that
+       fails to start reports back immediately.
+    */
+    for (PCAL64InterruptSource* source = sources; source; source = source->next)
+    {
+        if (source->interruptPossible())
+        {
+            source->requested = true;
+            outstanding++;
+        }
+    }
+
+    for (PCAL64InterruptSource* source = sources; source; source = source->next)
+    {
+        if (source->requested)
+        {
+            statusReads++;
+
+            source->interruptRequest();
+        }
+    }
+}
+
+void PCAL64InterruptGroup::serviced(PCAL64InterruptSource& source, bool _fired)
+{
+    if (!source.requested)
+    {
+        return;
+    }
+
+    source.requested = false;
+    outstanding--;
+
+    fired |= _fired;
+
+    if (outstanding > 0)
+    {
+        return;
+    }
+
+    /* Another round if an edge arrived meanwhile, or if the line is still
+       held low and the last round made progress. The round is started from
+       minar so the expander that reported last can finish first.
+    */
+    if (edgePending || (fired && (irq.read() == 0)))
+    {
+        minar::Scheduler::postCallback(this, &PCAL64InterruptGroup::internalHandlerTask)
+            .tolerance(1);
+    }
+}
@@ -0,0 +1,286 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Benchmark of the PCAL64 driver on the simulated bus.
+
+   Every result is printed as one JSON object per line so runs of different
+   driver versions can be diffed or loaded into a spreadsheet:
+
+     {"benchmark":"latency","operation":"bulkWrite","shadow":false,"clock":400000,
+      "transactions":4,"bytes":18,"latency_us":430.0}
+
+   Usage: benchmark [label]   label is copied into every record.
+*/
+
+#include "gpio-pcal64/PCAL64.h"
+#include "sim/PCALModel.h"
+
+#include <stdlib.h>
+
+#define SDA     ((PinName) 1)
+#define SCL     ((PinName) 2)
+#define IRQ     ((PinName) 3)
+#define ADDRESS PCAL64::PRIMARY_ADDRESS
+
+static const uint32_t clocks[] = { 100000, 400000, 1000000 };
+
+static const char* label = "";
+
+/*****************************************************************************/
+/* Helpers                                                                   */
+/*****************************************************************************/
+
+static sim::I2CBus& bus(void)
+{
+    return sim::I2CBus::get(SDA, SCL);
+}
+
+static sim::time_ns_t now(void)
+{
+    return sim::EventLoop::get().now();
+}
+
+static sim::time_ns_t completedAt;
+static uint64_t completions;
+
+static void done(void)
+{
+    completedAt = now();
+    completions++;
+}
+
+static void readDone(uint32_t)
+{
+    completedAt = now();
+    completions++;
+}
+
+static void irqDone(uint16_t, uint32_t, uint32_t)
+{
+    completedAt = now();
+    completions++;
+}
+
+static void record(const char* benchmark, const char* operation, bool shadow, uint32_t clock)
+{
+    printf("{\"label\":\"%s\",\"benchmark\":\"%s\",\"operation\":\"%s\",\"shadow\":%s,\"clock\":%u",
+           label, benchmark, operation, shadow ? "true" : "false", clock);
+}
+
+/*****************************************************************************/
+/* Single operation latency                                                  */
+/*****************************************************************************/
+
+typedef enum {
+    OP_READ,
+    OP_WRITE,
+    OP_TOGGLE,
+    OP_SET_INTERRUPT,
+    OP_INTERRUPT
+} operation_t;
+
+static const char* operationNames[] = {
+    "bulkRead",
+    "bulkWrite",
+    "bulkToggle",
+    "bulkSetInterrupt",
+    "interrupt"
+};
+
+static void latency(operation_t operation, bool shadow, uint32_t clock)
+{
+    sim::reset();
+    bus().forceClock(clock);
+
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    expander.setInterruptHandler(irqDone);
+
+    if (shadow)
+    {
+        expander.enableShadowRegisters(done);
+    }
+
+    if (operation == OP_INTERRUPT)
+    {
+        expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+    }
+
+    sim::EventLoop::get().runUntilIdle();
+
+    bus().resetCounters();
+    completions = 0;
+
+    sim::time_ns_t start = now();
+
+    switch (operation)
+    {
+        case OP_READ:
+            expander.bulkRead(readDone);
+            break;
+        case OP_WRITE:
+            expander.bulkWrite(PCAL64::P0_6, PCAL64::P0_6, 0, done);
+            break;
+        case OP_TOGGLE:
+            expander.bulkToggle(PCAL64::P0_6, done);
+            break;
+        case OP_SET_INTERRUPT:
+            expander.bulkSetInterrupt(PCAL64::P1_0, PCAL64::P1_0, done);
+            break;
+        case OP_INTERRUPT:
+            chip.drive(PCAL64::P0_0, 0);
+            break;
+    }
+
+    sim::EventLoop::get().runUntilIdle();
+
+    record("latency", operationNames[operation], shadow, clock);
+    printf(",\"transactions\":%llu,\"bytes\":%llu,\"latency_us\":%.1f}\n",
+           (unsigned long long) bus().counters().transactions,
+           (unsigned long long) bus().counters().bytes,
+           (completedAt - start) / 1000.0);
+}
+
+/*****************************************************************************/
+/* Sustained load                                                            */
+/*****************************************************************************/
+
+static PCAL64* loadExpander;
+static bool loadRunning;
+
+static void loadNext(void)
+{
+    completions++;
+
+    if (loadRunning)
+    {
+        loadExpander->bulkToggle(PCAL64::P0_6, loadNext);
+    }
+}
+
+/* Keep a number of toggles in flight for one second of simulated time.
+   With an IRQ storm period the pin P0_0 toggles at that rate as well.
+*/
+static void sustained(const char* name, bool shadow, uint32_t clock, unsigned inFlight, sim::time_ns_t stormPeriod)
+{
+    static const sim::time_ns_t duration = sim::NS_PER_MS * 1000;
+
+    sim::reset();
+    bus().forceClock(clock);
+
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    static uint64_t irqs;
+    struct Local {
+        static void irq(uint16_t, uint32_t, uint32_t) { irqs++; }
+    };
+    irqs = 0;
+
+    expander.setInterruptHandler(Local::irq);
+    expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, NULL);
+    expander.bulkWrite(PCAL64::P0_6, PCAL64::P0_6, 0, NULL);
+
+    if (shadow)
+    {
+        expander.enableShadowRegisters(NULL);
+    }
+
+    sim::EventLoop::get().runUntilIdle();
+
+    bus().resetCounters();
+    completions = 0;
+    loadExpander = &expander;
+    loadRunning = true;
+
+    sim::time_ns_t start = now();
+    sim::time_ns_t end = start + duration;
+
+    for (unsigned index = 0; index < inFlight; index++)
+    {
+        expander.bulkToggle(PCAL64::P0_6, loadNext);
+    }
+
+    uint64_t edges = 0;
+
+    if (stormPeriod)
+    {
+        for (sim::time_ns_t when = start + stormPeriod; when < end; when += stormPeriod)
+        {
+            bool level = edges & 1;
+            sim::EventLoop::get().post(when, [&chip, level]() { chip.drive(PCAL64::P0_0, level); });
+            edges++;
+        }
+    }
+
+    sim::EventLoop::get().runUntil(end);
+
+    sim::I2CBus::counters_t counters = bus().counters();
+    uint64_t operations = completions;
+
+    loadRunning = false;
+    sim::EventLoop::get().runUntilIdle();
+
+    record("throughput", name, shadow, clock);
+    printf(",\"in_flight\":%u,\"ops_per_s\":%llu,\"transactions_per_s\":%llu,\"bus_utilization\":%.3f",
+           inFlight,
+           (unsigned long long) operations,
+           (unsigned long long) counters.transactions,
+           (double) counters.busyTime / duration);
+
+    if (stormPeriod)
+    {
+        printf(",\"edges_per_s\":%llu,\"irqs_per_s\":%llu", (unsigned long long) edges, (unsigned long long) irqs);
+    }
+
+    printf("}\n");
+}
+
+/*****************************************************************************/
+/* Main                                                                      */
+/*****************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+    {
+        label = argv[1];
+    }
+
+    for (size_t index = 0; index < sizeof(clocks) / sizeof(clocks[0]); index++)
+    {
+        for (int shadow = 0; shadow < 2; shadow++)
+        {
+            for (int operation = OP_READ; operation <= OP_INTERRUPT; operation++)
+            {
+                latency((operation_t) operation, shadow, clocks[index]);
+            }
+        }
+    }
+
+    for (size_t index = 0; index < sizeof(clocks) / sizeof(clocks[0]); index++)
+    {
+        for (int shadow = 0; shadow < 2; shadow++)
+        {
+            sustained("bulkToggle", shadow, clocks[index], 1, 0);
+            sustained("bulkToggle", shadow, clocks[index], 4, 0);
+            sustained("bulkToggle+irq_storm", shadow, clocks[index], 1, 100 * sim::NS_PER_US);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1966 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gpio-pcal64/PCAL64.h"
+#include "gpio-pcal64/PCAL64Pin.h"
+#include "sim/PCALModel.h"
+
+#include <stdlib.h>
+
+/*****************************************************************************/
+/* Helpers                                                                   */
+/*****************************************************************************/
+
+#define SDA     ((PinName) 1)
+#define SCL     ((PinName) 2)
+#define IRQ     ((PinName) 3)
+#define ADDRESS PCAL64::PRIMARY_ADDRESS
+
+static int failures = 0;
+
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition))                                                   \
+        {                                                                   \
+            printf("%s:%d: check failed: %s\r\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static sim::I2CBus& bus(void)
+{
+    return sim::I2CBus::get(SDA, SCL);
+}
+
+static uint64_t transactions(void)
+{
+    return bus().counters().transactions;
+}
+
+static void run(void)
+{
+    sim::EventLoop::get().runUntilIdle();
+}
+
+static int doneCount;
+static uint32_t readValue;
+static int irqCount;
+static uint32_t irqPins;
+static uint32_t irqValues;
+static sim::time_ns_t irqTime;
+
+static void done(void)
+{
+    doneCount++;
+}
+
+static void readDone(uint32_t values)
+{
+    readValue = values;
+}
+
+static void irqHandler(uint16_t, uint32_t pins, uint32_t values)
+{
+    irqCount++;
+    irqPins = pins;
+    irqValues = values;
+    irqTime = sim::EventLoop::get().now();
+}
+
+static void setup(void)
+{
+    sim::reset();
+    bus().forceClock(400000);
+
+    doneCount = 0;
+    readValue = 0;
+    irqCount = 0;
+    irqPins = 0;
+    irqValues = 0;
+    irqTime = 0;
+}
+
+/*****************************************************************************/
+/* Tests                                                                     */
+/*****************************************************************************/
+
+static void testWrite(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    CHECK(expander.bulkWrite(PCAL64::P0_6 | PCAL64::P1_0, PCAL64::P0_6 | PCAL64::P1_0, PCAL64::P1_0, done));
+    run();
+
+    CHECK(doneCount == 1);
+    CHECK(transactions() == 4);
+    CHECK(chip.peekBank(0x06) == 0xFEBF);
+    CHECK(chip.peekBank(0x02) == 0xFFBF);
+    CHECK((chip.levels() & 0x0140) == 0x0100);
+}
+
+static void testRead(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    chip.drive(0x8001, 0x0001);
+
+    CHECK(expander.bulkRead(readDone));
+    run();
+
+    CHECK(readValue == 0x7FFF);
+    CHECK(transactions() == 2);
+    CHECK(chip.statusReads == 1);
+}
+
+static uint32_t readStatus;
+
+static void readStatusDone(uint32_t status, uint32_t values)
+{
+    readStatus = status;
+    readValue = values;
+}
+
+static void testFastRead(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+
+    /* nobody services the interrupt: one transfer */
+    {
+        PCAL64 expander(SDA, SCL, ADDRESS);
+
+        expander.bulkRead(readDone);
+        run();
+
+        CHECK(transactions() == 1);
+        CHECK(chip.statusReads == 0);
+    }
+
+    /* every input masked, as the shadow shows */
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    expander.enableShadowRegisters(done);
+    run();
+
+    bus().resetCounters();
+    expander.bulkRead(readDone);
+    run();
+
+    CHECK(transactions() == 1);
+
+    /* with an interrupt enabled the status is protected again */
+    expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+    run();
+
+    bus().resetCounters();
+    expander.bulkRead(readDone);
+    run();
+
+    CHECK(transactions() == 2);
+
+    /* unless the application opts out */
+    expander.setStatusPreRead(false);
+
+    bus().resetCounters();
+    expander.bulkRead(readDone);
+    run();
+
+    CHECK(transactions() == 1);
+
+    /* status and values, with nobody servicing the pending status */
+    setup();
+    sim::PCALModel polled(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 reader(SDA, SCL, ADDRESS);
+
+    reader.bulkSetInterrupt(PCAL64::P1_2, PCAL64::P1_2, done);
+    run();
+
+    polled.drive(PCAL64::P1_2, 0);
+
+    bus().resetCounters();
+    readStatus = 0;
+    CHECK(reader.bulkReadWithStatus(readStatusDone));
+    run();
+
+    CHECK(transactions() == 2);
+    CHECK(readStatus == PCAL64::P1_2);
+    CHECK(readValue == (0xFFFF & ~PCAL64::P1_2));
+}
+
+static void testBlocking(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+    sim::EventLoop& loop = sim::EventLoop::get();
+
+    /* no scheduler hops: the call takes exactly the bus time */
+    sim::time_ns_t start = loop.now();
+
+    CHECK(expander.bulkWriteBlocking(PCAL64::P0_6 | PCAL64::P1_0, PCAL64::P0_6 | PCAL64::P1_0, PCAL64::P1_0));
+    CHECK(transactions() == 4);
+    CHECK(loop.now() - start == 2 * bus().duration(true, 2) + 2 * bus().duration(false, 2));
+    CHECK(chip.peekBank(0x06) == 0xFEBF);
+    CHECK((chip.levels() & 0x0140) == 0x0100);
+    CHECK(sim::pendingCallbacks() == 0);
+
+    uint32_t values = 0;
+    chip.drive(0x8001, 0x0001);
+
+    CHECK(expander.bulkReadBlocking(values));
+    CHECK((values & 0x8001) == 0x0001);
+
+    CHECK(expander.bulkSetInterruptBlocking(PCAL64::P0_0, PCAL64::P0_0));
+    CHECK(chip.peekBank(0x4A) == 0xFFFE);
+
+    PCAL64::Config config;
+    config.pull(PCAL64::P0_1, PCAL64::PULL_UP);
+
+    CHECK(expander.configureBlocking(config));
+    CHECK(chip.peekBank(0x46) == PCAL64::P0_1);
+    CHECK(sim::pendingCallbacks() == 0);
+
+    /* not while a command is in progress */
+    expander.bulkToggle(PCAL64::P1_0, done);
+
+    uint64_t before = transactions();
+    CHECK(!expander.bulkWriteBlocking(PCAL64::P1_0, PCAL64::P1_0, PCAL64::P1_0));
+    CHECK(transactions() == before);
+
+    run();
+    CHECK(doneCount == 1);
+    CHECK((chip.levels() & PCAL64::P1_0) == 0);
+
+    /* a device that does not answer */
+    PCAL64 absent(SDA, SCL, PCAL64::SECONDARY_ADDRESS);
+
+    CHECK(!absent.bulkWriteBlocking(PCAL64::P0_0, PCAL64::P0_0, 0));
+}
+
+static void testPins(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    PCAL64Pin<PCAL64> leds[4] = {
+        PCAL64Pin<PCAL64>(expander, PCAL64::P0_0),
+        PCAL64Pin<PCAL64>(expander, PCAL64::P0_1),
+        PCAL64Pin<PCAL64>(expander, PCAL64::P1_2),
+        PCAL64Pin<PCAL64>(expander, PCAL64::P1_3)
+    };
+
+    /* everything within one callback is a single output command */
+    for (uint8_t index = 0; index < 4; index++)
+    {
+        leds[index].output();
+        leds[index] = index & 1;
+    }
+
+    run();
+
+    CHECK(transactions() == 4);
+    CHECK(chip.peekBank(0x06) == 0xF3FC);
+    CHECK((chip.levels() & 0x0C03) == 0x0802);
+
+    /* writes while a command runs go out together behind it */
+    expander.bulkRead(readDone);
+
+    for (uint8_t round = 0; round < 8; round++)
+    {
+        leds[round & 3] = round >> 2;
+    }
+
+    bus().resetCounters();
+    run();
+
+    /* status and input, then the output port read and written once */
+    CHECK(transactions() == 4);
+    CHECK((chip.levels() & 0x0C03) == 0x0C03);
+
+    /* reads are from the last input port read until refreshed */
+    PCAL64Pin<PCAL64> button(expander, PCAL64::P0_7);
+
+    chip.drive(PCAL64::P0_7, 0);
+    CHECK(button.read() == 1);
+
+    CHECK(button.refresh(done));
+    run();
+
+    CHECK(button == 0);
+    CHECK(doneCount == 1);
+
+    /* a full queue delays the write instead of losing it */
+    for (uint8_t index = 0; index <= YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE; index++)
+    {
+        expander.bulkRead(readDone);
+    }
+
+    leds[0] = 0;
+    run();
+
+    CHECK((chip.levels() & PCAL64::P0_0) == 0);
+}
+
+static void testToggle(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    expander.bulkWrite(PCAL64::P0_1, PCAL64::P0_1, 0, done);
+    run();
+
+    bus().resetCounters();
+    CHECK(expander.bulkToggle(PCAL64::P0_1, done));
+    run();
+
+    CHECK(transactions() == 2);
+    CHECK(chip.peekBank(0x02) == 0xFFFF);
+    CHECK(doneCount == 2);
+}
+
+static void testInterrupt(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    expander.setInterruptHandler(irqHandler);
+
+    CHECK(expander.bulkSetInterrupt(PCAL64::P1_3, PCAL64::P1_3, done));
+    run();
+
+    CHECK(transactions() == 6);
+    CHECK(chip.peekBank(0x4A) == 0xF7FF);
+    CHECK(chip.peekBank(0x44) == 0x0800);
+
+    chip.drive(PCAL64::P1_3, 0);
+    run();
+
+    CHECK(irqCount == 1);
+    CHECK(irqPins == PCAL64::P1_3);
+    CHECK(irqValues == 0xF7FF);
+    CHECK(!chip.interruptAsserted());
+}
+
+static int fallingCalls;
+static int bothCalls;
+static int risingCalls;
+static PCAL64::edge_t lastEdge;
+
+static void onFalling(uint8_t pin, PCAL64::edge_t edge)
+{
+    CHECK(pin == 0);
+    CHECK(edge == PCAL64::EDGE_FALLING);
+    fallingCalls++;
+}
+
+static void onBoth(uint8_t pin, PCAL64::edge_t edge)
+{
+    CHECK(pin == 0);
+    lastEdge = edge;
+    bothCalls++;
+}
+
+static void onRising(uint8_t pin, PCAL64::edge_t edge)
+{
+    CHECK(pin == 9);
+    CHECK(edge == PCAL64::EDGE_RISING);
+    risingCalls++;
+}
+
+static void testSubscriptions(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    fallingCalls = 0;
+    bothCalls = 0;
+    risingCalls = 0;
+
+    expander.bulkSetInterrupt(PCAL64::P0_0 | PCAL64::P1_1, PCAL64::P0_0 | PCAL64::P1_1, done);
+    run();
+
+    int8_t falling = expander.subscribe(0, PCAL64::EDGE_FALLING, onFalling);
+    int8_t both = expander.subscribe(0, PCAL64::EDGE_BOTH, onBoth);
+    int8_t rising = expander.subscribe(9, PCAL64::EDGE_RISING, onRising);
+
+    CHECK((falling >= 0) && (both >= 0) && (rising >= 0));
+    CHECK(expander.subscribe(16, PCAL64::EDGE_BOTH, onBoth) == -1);
+
+    /* both subscribers on P0_0 see the falling edge */
+    chip.drive(PCAL64::P0_0, 0);
+    run();
+
+    CHECK(fallingCalls == 1);
+    CHECK(bothCalls == 1);
+    CHECK(lastEdge == PCAL64::EDGE_FALLING);
+    CHECK(risingCalls == 0);
+
+    chip.drive(PCAL64::P0_0, PCAL64::P0_0);
+    run();
+
+    CHECK(fallingCalls == 1);
+    CHECK(bothCalls == 2);
+    CHECK(lastEdge == PCAL64::EDGE_RISING);
+
+    /* nobody wants falling edges on P1_1 */
+    chip.drive(PCAL64::P1_1, 0);
+    run();
+
+    CHECK(risingCalls == 0);
+
+    chip.drive(PCAL64::P1_1, PCAL64::P1_1);
+    run();
+
+    CHECK(risingCalls == 1);
+
+    /* removed subscriptions are not called, their slots are reused */
+    expander.unsubscribe(both);
+    expander.unsubscribe(falling);
+
+    chip.drive(PCAL64::P0_0, 0);
+    run();
+
+    CHECK(fallingCalls == 1);
+    CHECK(bothCalls == 2);
+
+    int count = 1;
+    while (expander.subscribe(0, PCAL64::EDGE_BOTH, onBoth) >= 0)
+    {
+        count++;
+    }
+    CHECK(count == YOTTA_CFG_GPIO_PCAL64_SUBSCRIPTIONS);
+}
+
+static void testShadow(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    CHECK(expander.enableShadowRegisters(done));
+    run();
+    CHECK(doneCount == 1);
+
+    bus().resetCounters();
+    expander.bulkWrite(PCAL64::P0_2, PCAL64::P0_2, 0, done);
+    run();
+    CHECK(transactions() == 2);
+
+    /* nothing changes, nothing is written */
+    bus().resetCounters();
+    expander.bulkWrite(PCAL64::P0_2, PCAL64::P0_2, 0, done);
+    run();
+    CHECK(transactions() == 0);
+    CHECK(doneCount == 3);
+
+    /* the chip is reset behind the driver's back */
+    chip.reset();
+    expander.resyncShadowRegisters(done);
+    run();
+
+    bus().resetCounters();
+    expander.bulkWrite(PCAL64::P0_2, PCAL64::P0_2, 0, done);
+    run();
+    CHECK(transactions() == 2);
+    CHECK(chip.peekBank(0x02) == 0xFFFB);
+}
+
+static void testQueue(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    /* one in progress, one queued, the rest merge into the queued one */
+    CHECK(expander.bulkRead(readDone));
+    CHECK(expander.bulkWrite(PCAL64::P0_6, PCAL64::P0_6, PCAL64::P0_6, done));
+    CHECK(expander.bulkWrite(PCAL64::P1_2, PCAL64::P1_2, 0, done));
+    CHECK(expander.bulkToggle(PCAL64::P0_6, done));
+    CHECK(expander.bulkToggle(PCAL64::P1_2, NULL));
+    run();
+
+    CHECK(doneCount == 3);
+    CHECK(transactions() == 2 + 4);
+    CHECK(chip.peekBank(0x06) == 0xFBBF);
+    CHECK(chip.peekBank(0x02) == 0xFFBF);
+    CHECK(expander.getQueueHighWaterMark() == 3);
+}
+
+static void testInterruptDuringCommand(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    expander.setInterruptHandler(irqHandler);
+    expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+    run();
+
+    /* the edge arrives in the middle of the first transfer */
+    sim::time_ns_t start = sim::EventLoop::get().now();
+    sim::time_ns_t transfer = bus().duration(true, 2);
+    sim::time_ns_t edge = start + transfer / 2;
+
+    expander.bulkWrite(PCAL64::P0_6, PCAL64::P0_6, PCAL64::P0_6, done);
+    sim::EventLoop::get().post(edge, [&chip]() { chip.drive(PCAL64::P0_0, 0); });
+    run();
+
+    CHECK(irqCount == 1);
+    CHECK(irqPins == PCAL64::P0_0);
+
+    /* rest of the transfer, then status and input reads */
+    CHECK(irqTime - edge <= 3 * transfer);
+
+    CHECK(chip.peekBank(0x06) == 0xFFBF);
+    CHECK(chip.peekBank(0x02) == 0xFFFF);
+}
+
+static void testInterruptDuringRead(void)
+{
+    /* An edge while a read fetches the status is reported by the service
+       the read is parked for, and not again with the next edge. The first
+       read gives the driver values to find changes against.
+    */
+    for (int step = 0; step < 8; step++)
+    {
+        setup();
+        sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+        PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+        expander.setInterruptHandler(irqHandler);
+        expander.bulkSetInterrupt(PCAL64::P0_0 | PCAL64::P0_1, PCAL64::P0_0 | PCAL64::P0_1, done);
+        expander.bulkRead(readDone);
+        run();
+
+        sim::time_ns_t edge = sim::EventLoop::get().now() + step * bus().duration(true, 2) / 4;
+
+        expander.bulkRead(readDone);
+        sim::EventLoop::get().post(edge, [&chip]() { chip.drive(PCAL64::P0_0, 0); });
+        run();
+
+        CHECK(irqCount == 1);
+        CHECK(irqPins == PCAL64::P0_0);
+
+        chip.drive(PCAL64::P0_1, 0);
+        run();
+
+        CHECK(irqCount == 2);
+        CHECK(irqPins == PCAL64::P0_1);
+    }
+}
+
+static void testCoalescing(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    expander.setInterruptHandler(irqHandler);
+    expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+    run();
+
+    /* The application keeps the scheduler busy for 2 ms at a time while
+       commands keep the expander busy. Interrupts are serviced between the
+       command's transfers, faster than the scheduler can deliver them.
+    */
+    sim::setSchedulerLatency(2 * sim::NS_PER_MS);
+
+    size_t pending = 0;
+    sim::time_ns_t start = sim::EventLoop::get().now();
+
+    for (int command = 0; command < 4; command++)
+    {
+        expander.bulkSetInterrupt(PCAL64::P1_0 << command, 0, FunctionPointer0<void>());
+    }
+
+    for (int edge = 0; edge < 40; edge++)
+    {
+        sim::EventLoop::get().post(start + edge * 100 * sim::NS_PER_US, [&chip, &pending, edge]() {
+            chip.drive(PCAL64::P0_0, (edge & 1) ? PCAL64::P0_0 : 0);
+
+            if (sim::pendingCallbacks() > pending)
+            {
+                pending = sim::pendingCallbacks();
+            }
+        });
+    }
+    run();
+
+    /* one interrupt task and one event at most, and the bus watchdog */
+    CHECK(pending <= 2 + 1);
+    CHECK(irqCount > 0);
+    CHECK(irqCount < 40);
+    CHECK(irqPins == PCAL64::P0_0);
+
+    PCAL64::statistics_t statistics;
+    expander.getStatistics(statistics);
+
+    CHECK(statistics.irqCoalesced > 0);
+    CHECK(statistics.irqs == irqCount + statistics.irqCoalesced);
+}
+
+/* 31 edges 100 us apart ending at the given level, like a mechanical contact */
+static void bounce(sim::PCALModel& chip, uint32_t pin, bool level)
+{
+    sim::time_ns_t start = sim::EventLoop::get().now();
+
+    for (int edge = 0; edge < 31; edge++)
+    {
+        bool high = (edge & 1) ? !level : level;
+
+        sim::EventLoop::get().post(start + edge * 100 * sim::NS_PER_US, [&chip, pin, high]() {
+            chip.drive(pin, high ? pin : 0);
+        });
+    }
+    run();
+}
+
+static void testDebounce(void)
+{
+    uint64_t plainTransactions;
+    int plainIrqs;
+
+    {
+        setup();
+        sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+        PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+        expander.setInterruptHandler(irqHandler);
+        expander.enableShadowRegisters(done);
+        expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+        run();
+
+        uint64_t before = transactions();
+        bounce(chip, PCAL64::P0_0, false);
+
+        plainTransactions = transactions() - before;
+        plainIrqs = irqCount;
+    }
+
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    expander.setInterruptHandler(irqHandler);
+    expander.setDebounce(PCAL64::P0_0, 10);
+    expander.enableShadowRegisters(done);
+    expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+    run();
+
+    /* press: one edge, reported after the period */
+    uint64_t before = transactions();
+    sim::time_ns_t start = sim::EventLoop::get().now();
+    bounce(chip, PCAL64::P0_0, false);
+
+    CHECK(irqCount == 1);
+    CHECK(irqPins == PCAL64::P0_0);
+    CHECK((irqValues & PCAL64::P0_0) == 0);
+    CHECK(irqTime - start >= 10 * sim::NS_PER_MS);
+
+    /* status, mask, values, sample of two, unmask */
+    CHECK(transactions() - before <= 6);
+    CHECK(transactions() - before < plainTransactions / 3);
+    CHECK(irqCount < plainIrqs / 5);
+    CHECK(chip.peekBank(0x4A) == 0xFFFE);
+
+    /* release */
+    bounce(chip, PCAL64::P0_0, true);
+
+    CHECK(irqCount == 2);
+    CHECK((irqValues & PCAL64::P0_0) == PCAL64::P0_0);
+
+    /* a glitch shorter than the period is not reported */
+    chip.drive(PCAL64::P0_0, 0);
+    sim::EventLoop::get().runUntil(sim::EventLoop::get().now() + sim::NS_PER_MS);
+    chip.drive(PCAL64::P0_0, PCAL64::P0_0);
+    run();
+
+    CHECK(irqCount == 2);
+    CHECK(chip.peekBank(0x4A) == 0xFFFE);
+}
+
+static void testDebounceMaskChanges(void)
+{
+    sim::EventLoop& loop = sim::EventLoop::get();
+
+    /* enabling a pin while it debounces still reports the edge */
+    {
+        setup();
+        sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+        PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+        expander.setInterruptHandler(irqHandler);
+        expander.setDebounce(PCAL64::P0_0, 10);
+        expander.enableShadowRegisters(done);
+        expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+        run();
+
+        chip.drive(PCAL64::P0_0, 0);
+        loop.runUntil(loop.now() + 2 * sim::NS_PER_MS);
+
+        CHECK(chip.peekBank(0x4A) == 0xFFFF);
+
+        expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+        loop.runUntil(loop.now() + 2 * sim::NS_PER_MS);
+
+        CHECK(irqCount == 0);
+        CHECK(chip.peekBank(0x4A) == 0xFFFF);
+
+        run();
+
+        CHECK(irqCount == 1);
+        CHECK((irqValues & PCAL64::P0_0) == 0);
+        CHECK(chip.peekBank(0x4A) == 0xFFFE);
+    }
+
+    /* On a shared interrupt line held low by another chip an edge raises
+       no interrupt. A read keeps its status for the interrupt path, which
+       only runs for a later edge, once the pin has been masked. That
+       stale status must not debounce the pin and unmask it.
+    */
+    {
+        setup();
+        const PinName OTHER = (PinName) 4;
+
+        sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+        sim::PCALModel other(sim::PCAL6416A_LAYOUT, OTHER, SCL, ADDRESS, IRQ);
+        PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+        PCAL64 neighbour(OTHER, SCL, ADDRESS);
+
+        neighbour.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+        expander.setInterruptHandler(irqHandler);
+        expander.setDebounce(PCAL64::P0_0, 10);
+        expander.enableShadowRegisters(done);
+        expander.bulkSetInterrupt(PCAL64::P0_0 | PCAL64::P0_1, PCAL64::P0_0 | PCAL64::P0_1, done);
+        run();
+
+        other.drive(PCAL64::P0_0, 0);
+        run();
+
+        chip.drive(PCAL64::P0_0, 0);
+        run();
+
+        expander.bulkRead(readDone);
+        expander.bulkSetInterrupt(PCAL64::P0_0, 0, done);
+        neighbour.bulkRead(readDone);
+        run();
+
+        chip.drive(PCAL64::P0_1, 0);
+        run();
+
+        CHECK(irqCount == 1);
+        CHECK(irqPins == PCAL64::P0_1);
+        CHECK(chip.peekBank(0x4A) == 0xFFFD);
+    }
+
+    /* Debounce turned off between the interrupt path masking the pin and
+       reading it. Whenever that happens, the edge is reported and the pin
+       unmasked.
+    */
+    for (int step = 0; step < 24; step++)
+    {
+        setup();
+        sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+        PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+        expander.setInterruptHandler(irqHandler);
+        expander.setDebounce(PCAL64::P0_0, 10);
+        expander.enableShadowRegisters(done);
+        expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+        run();
+
+        sim::time_ns_t edge = loop.now();
+
+        chip.drive(PCAL64::P0_0, 0);
+        loop.post(edge + step * bus().duration(true, 2) / 4, [&expander]() {
+            expander.setDebounce(PCAL64::P0_0, 0);
+        });
+        run();
+
+        CHECK(irqCount == 1);
+        CHECK((irqValues & PCAL64::P0_0) == 0);
+        CHECK(chip.peekBank(0x4A) == 0xFFFE);
+    }
+}
+
+static int stormEvents;
+static PCAL64::storm_t stormTransition;
+static uint32_t stormPins;
+
+static void stormHandler(uint16_t, PCAL64::storm_t transition, uint32_t pins)
+{
+    stormEvents++;
+    stormTransition = transition;
+    stormPins = pins;
+}
+
+static sim::time_ns_t doneTime;
+static int fallCount;
+
+static void fallHandler(uint8_t, PCAL64::edge_t)
+{
+    fallCount++;
+}
+
+static void timedDone(void)
+{
+    doneCount++;
+    doneTime = sim::EventLoop::get().now();
+}
+
+/* P0_0 toggles every 30 us for 20 ms and ends high, P0_1 falls once after 15 ms */
+static uint64_t storm(sim::PCALModel& chip, PCAL64& expander, sim::time_ns_t& writeLatency)
+{
+    sim::EventLoop& loop = sim::EventLoop::get();
+    sim::time_ns_t start = loop.now();
+    uint64_t before = transactions();
+
+    for (int edge = 0; edge < 666; edge++)
+    {
+        loop.post(start + edge * 30 * sim::NS_PER_US, [&chip, edge]() {
+            chip.drive(PCAL64::P0_0, (edge & 1) ? PCAL64::P0_0 : 0);
+        });
+    }
+
+    loop.post(start + 15 * sim::NS_PER_MS, [&chip]() {
+        chip.drive(PCAL64::P0_1, 0);
+    });
+
+    /* a command issued in the middle of the storm */
+    loop.post(start + 5 * sim::NS_PER_MS, [&expander]() {
+        expander.bulkWrite(PCAL64::P1_0, PCAL64::P1_0, 0, timedDone);
+    });
+
+    doneTime = 0;
+    loop.runUntil(start + 20 * sim::NS_PER_MS);
+    writeLatency = doneTime - (start + 5 * sim::NS_PER_MS);
+
+    return transactions() - before;
+}
+
+static void testStorm(void)
+{
+    uint64_t plainTransactions;
+    sim::time_ns_t plainLatency;
+
+    {
+        setup();
+        sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+        PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+        expander.setInterruptHandler(irqHandler);
+        expander.enableShadowRegisters(done);
+        expander.bulkSetInterrupt(PCAL64::P0_0 | PCAL64::P0_1, PCAL64::P0_0 | PCAL64::P0_1, done);
+        run();
+
+        plainTransactions = storm(chip, expander, plainLatency);
+        run();
+    }
+
+    setup();
+    stormEvents = 0;
+    fallCount = 0;
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    expander.setInterruptHandler(irqHandler);
+    expander.setStormProtection(10, 10, 5, stormHandler);
+    expander.subscribe(1, PCAL64::EDGE_FALLING, fallHandler);
+    expander.enableShadowRegisters(done);
+    expander.bulkSetInterrupt(PCAL64::P0_0 | PCAL64::P0_1, PCAL64::P0_0 | PCAL64::P0_1, done);
+    run();
+
+    sim::time_ns_t latency;
+    uint64_t cost = storm(chip, expander, latency);
+
+    /* P0_0 is polled, P0_1 still interrupts */
+    CHECK(stormEvents == 1);
+    CHECK(stormTransition == PCAL64::STORM_DETECTED);
+    CHECK(stormPins == PCAL64::P0_0);
+    CHECK(chip.peekBank(0x4A) == 0xFFFD);
+    CHECK(fallCount == 1);
+    CHECK(doneCount == 3);
+
+    /* interrupts up to the limit, then a poll every 5 ms */
+    CHECK(cost < plainTransactions / 4);
+    CHECK(latency < plainLatency / 2);
+
+    /* a change while polled is reported by the next poll */
+    sim::EventLoop& loop = sim::EventLoop::get();
+    loop.runUntil(loop.now() + 6 * sim::NS_PER_MS);
+
+    irqCount = 0;
+    chip.drive(PCAL64::P0_0, 0);
+    loop.runUntil(loop.now() + 6 * sim::NS_PER_MS);
+
+    CHECK(irqCount == 1);
+    CHECK(irqPins == PCAL64::P0_0);
+    CHECK((irqValues & PCAL64::P0_0) == 0);
+    CHECK(chip.peekBank(0x4A) == 0xFFFD);
+
+    /* quiet for a window, back on interrupts */
+    run();
+
+    CHECK(stormEvents == 2);
+    CHECK(stormTransition == PCAL64::STORM_CLEARED);
+    CHECK(stormPins == PCAL64::P0_0);
+    CHECK(chip.peekBank(0x4A) == 0xFFFC);
+
+    irqCount = 0;
+    chip.drive(PCAL64::P0_0, PCAL64::P0_0);
+    run();
+
+    CHECK(irqCount == 1);
+    CHECK(irqPins == PCAL64::P0_0);
+    CHECK(stormEvents == 2);
+}
+
+static void testSampler(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS);
+    sim::EventLoop& loop = sim::EventLoop::get();
+
+    PCAL64::SampleRing_t::sample_t storage[8];
+    PCAL64::SampleRing_t ring(storage, 8);
+    PCAL64::SampleRing_t::sample_t samples[8];
+
+    sim::time_ns_t start = loop.now();
+    uint64_t before = transactions();
+
+    CHECK(!expander.startSampling(ring, 0));
+    CHECK(expander.startSampling(ring, 2));
+
+    loop.post(start + 5 * sim::NS_PER_MS, [&chip]() {
+        chip.drive(PCAL64::P1_3, 0);
+    });
+    loop.runUntil(start + 11 * sim::NS_PER_MS);
+
+    /* one burst per sample without an IRQ line */
+    CHECK(transactions() - before == 5);
+    CHECK(ring.available() == 5);
+    CHECK(ring.pop(samples, 8) == 5);
+    CHECK(ring.available() == 0);
+
+    for (int index = 1; index < 5; index++)
+    {
+        CHECK(samples[index].timestamp - samples[index - 1].timestamp == 2000);
+    }
+
+    CHECK((samples[1].values & PCAL64::P1_3) == PCAL64::P1_3);
+    CHECK((samples[2].values & PCAL64::P1_3) == 0);
+
+    /* an undrained ring counts what it could not hold */
+    loop.runUntil(start + 31 * sim::NS_PER_MS);
+
+    CHECK(ring.available() == 7);
+    CHECK(ring.getOverruns() == 3);
+    CHECK(ring.pop(samples, 4) == 4);
+    CHECK(ring.available() == 3);
+
+    expander.stopSampling();
+    before = transactions();
+    run();
+
+    CHECK(transactions() == before);
+    CHECK(expander.getSampleMisses() == 0);
+
+    /* a bus too slow for the period merges periods and counts them */
+    setup();
+    sim::PCALModel slow(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 slowExpander(SDA, SCL, ADDRESS);
+    PCAL64::SampleRing_t slowRing(storage, 8);
+
+    bus().forceClock(10000);
+    start = loop.now();
+    slowExpander.startSampling(slowRing, 1);
+    loop.runUntil(start + 20 * sim::NS_PER_MS + 500 * sim::NS_PER_US);
+    slowExpander.stopSampling();
+    run();
+
+    CHECK(slowRing.available() > 0);
+    CHECK(slowExpander.getSampleMisses() > 0);
+    uint32_t periods = slowRing.available() + slowRing.getOverruns() + slowExpander.getSampleMisses();
+    CHECK(periods >= 18 && periods <= 20);
+
+    /* a restart begins a new count */
+    bus().forceClock(400000);
+    slowExpander.startSampling(slowRing, 1);
+    CHECK(slowExpander.getSampleMisses() == 0);
+    slowExpander.stopSampling();
+
+    /* with interrupts in use the status is read first and not lost */
+    setup();
+    sim::PCALModel wired(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 interrupting(SDA, SCL, ADDRESS, IRQ);
+    PCAL64::SampleRing_t shared(storage, 8);
+
+    interrupting.setInterruptHandler(irqHandler);
+    interrupting.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+    run();
+
+    start = loop.now();
+    before = transactions();
+    interrupting.startSampling(shared, 2);
+
+    loop.post(start + 2 * sim::NS_PER_MS, [&wired]() {
+        wired.drive(PCAL64::P0_0, 0);
+    });
+    loop.runUntil(start + 5 * sim::NS_PER_MS);
+    interrupting.stopSampling();
+    run();
+
+    CHECK(shared.available() == 2);
+    CHECK(irqCount == 1);
+    CHECK(irqPins == PCAL64::P0_0);
+}
+
+static void testSequence(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+    sim::EventLoop& loop = sim::EventLoop::get();
+
+    const uint32_t pins = PCAL64::P0_0 | PCAL64::P0_1 | PCAL64::P1_0;
+    const PCAL64::Sequence::frame_t frames[] = {
+        { 1, PCAL64::P0_0 },
+        { 1, PCAL64::P0_1 },
+        { 1, PCAL64::P0_1 | PCAL64::P1_0 },
+        { 1, 0 }
+    };
+
+    PCAL64::Sequence::step_t steps[4];
+    PCAL64::Sequence sequence(steps, 4);
+
+    CHECK(!sequence.prepare(frames, 5, pins));
+    CHECK(sequence.prepare(frames, 4, pins));
+
+    /* not without the shadow */
+    CHECK(!expander.playSequence(sequence, false, done));
+
+    expander.enableShadowRegisters(done);
+    expander.bulkWrite(pins | PCAL64::P0_7, pins | PCAL64::P0_7, PCAL64::P0_7, done);
+    run();
+
+    uint64_t levels[4];
+    sim::time_ns_t start = loop.now();
+
+    for (int frame = 0; frame < 4; frame++)
+    {
+        loop.post(start + (frame + 1) * sim::NS_PER_MS + 500 * sim::NS_PER_US, [&chip, &levels, frame]() {
+            levels[frame] = chip.levels();
+        });
+    }
+
+    bus().resetCounters();
+    doneCount = 0;
+
+    CHECK(expander.playSequence(sequence, false, done));
+    run();
+
+    /* both ports, then a byte for each frame that touches one port */
+    CHECK(doneCount == 1);
+    CHECK(transactions() == 4);
+    CHECK(bus().counters().bytes == 4 * 2 + (2 + 1 + 1 + 2));
+    CHECK((levels[0] & 0x0183) == 0x0081);
+    CHECK((levels[1] & 0x0183) == 0x0082);
+    CHECK((levels[2] & 0x0183) == 0x0182);
+    CHECK((levels[3] & 0x0183) == 0x0080);
+    CHECK(expander.getFrameMisses() == 0);
+
+    /* looping, the deadlines stay on the millisecond grid however late
+       each timer runs
+    */
+    sim::setSchedulerLatency(300 * sim::NS_PER_US);
+    start = loop.now();
+    expander.playSequence(sequence, true, done);
+
+    sim::time_ns_t checkpoint = start + 40 * sim::NS_PER_MS + 700 * sim::NS_PER_US;
+    uint64_t level = 0;
+
+    loop.post(checkpoint, [&chip, &level]() {
+        level = chip.levels();
+    });
+    loop.runUntil(checkpoint + sim::NS_PER_US);
+
+    /* frame 40 is the last of the tenth round */
+    CHECK((level & 0x0183) == 0x0080);
+
+    sim::setSchedulerLatency(0);
+
+    /* a bus too slow for the frame rate skips frames and counts them */
+    bus().forceClock(10000);
+    loop.runUntil(checkpoint + 20 * sim::NS_PER_MS);
+    expander.stopSequence();
+    run();
+
+    CHECK(expander.getFrameMisses() > 0);
+    CHECK(doneCount == 1);
+}
+
+static int keyEvents;
+static uint8_t keyRow;
+static uint8_t keyColumn;
+static PCAL64::keypad_event_t keyEvent;
+
+static void keyHandler(uint8_t row, uint8_t column, PCAL64::keypad_event_t event)
+{
+    keyEvents++;
+    keyRow = row;
+    keyColumn = column;
+    keyEvent = event;
+}
+
+static void testKeypad(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+    sim::EventLoop& loop = sim::EventLoop::get();
+
+    const uint32_t rows = 0x000F;
+    const uint32_t columns = 0x0F00;
+
+    keyEvents = 0;
+
+    /* not without the shadow */
+    CHECK(!expander.startKeypad(rows, columns, 10, keyHandler));
+
+    PCAL64::Config pullUps;
+    pullUps.pull(columns, PCAL64::PULL_UP);
+
+    expander.enableShadowRegisters(done);
+    expander.configure(pullUps, done);
+    run();
+
+    CHECK(!expander.startKeypad(rows, rows, 10, keyHandler));
+    CHECK(expander.startKeypad(rows, columns, 10, keyHandler));
+    run();
+
+    /* idle: nothing on the bus */
+    bus().resetCounters();
+    loop.runUntil(loop.now() + 100 * sim::NS_PER_MS);
+
+    CHECK(transactions() == 0);
+
+    /* interrupt with the columns masked, then a write and a read per row
+       and the rows driven again
+    */
+    chip.setSwitch(1, 10, true);
+    loop.runUntil(loop.now() + 5 * sim::NS_PER_MS);
+
+    CHECK(keyEvents == 1);
+    CHECK((keyRow == 1) && (keyColumn == 2) && (keyEvent == PCAL64::KEY_DOWN));
+    CHECK(transactions() == 3 + 4 * 2 + 1);
+    CHECK(irqCount == 0);
+
+    /* held: scanned every period, one data byte per transfer as rows and
+       columns each sit in one port
+    */
+    bus().resetCounters();
+    loop.runUntil(loop.now() + 10 * sim::NS_PER_MS);
+
+    CHECK(transactions() == 4 * 2 + 1);
+    CHECK(bus().counters().bytes == 5 * (2 + 1) + 4 * (3 + 1));
+    CHECK(keyEvents == 1);
+
+    /* released: one more scan and the idle check, then quiet again */
+    chip.setSwitch(1, 10, false);
+    loop.runUntil(loop.now() + 20 * sim::NS_PER_MS);
+
+    CHECK(keyEvents == 2);
+    CHECK((keyRow == 1) && (keyColumn == 2) && (keyEvent == PCAL64::KEY_UP));
+    CHECK((chip.peekBank(0x4A) & columns) == 0);
+
+    bus().resetCounters();
+    loop.runUntil(loop.now() + 100 * sim::NS_PER_MS);
+
+    CHECK(transactions() == 0);
+
+    /* three corners of a rectangle: the fourth is a ghost */
+    chip.setSwitch(0, 8, true);
+    chip.setSwitch(0, 9, true);
+    loop.runUntil(loop.now() + 5 * sim::NS_PER_MS);
+
+    CHECK(keyEvents == 4);
+
+    chip.setSwitch(2, 8, true);
+    loop.runUntil(loop.now() + 10 * sim::NS_PER_MS);
+
+    CHECK(keyEvents == 5);
+    CHECK(keyEvent == PCAL64::KEY_GHOSTING);
+
+    /* the ambiguous key is reported once it is released */
+    chip.setSwitch(0, 9, false);
+    loop.runUntil(loop.now() + 10 * sim::NS_PER_MS);
+
+    CHECK(keyEvents == 7);
+
+    chip.setSwitch(0, 8, false);
+    chip.setSwitch(2, 8, false);
+    loop.runUntil(loop.now() + 100 * sim::NS_PER_MS);
+
+    CHECK(keyEvents == 9);
+
+    /* a column glitch between scan steps is not held for the next row,
+       even by a part that latches masked inputs
+    */
+    chip.setMaskedLatching(true);
+    bus().resetCounters();
+    chip.setSwitch(1, 10, true);
+
+    while (transactions() < 3 + 2 * 2)
+    {
+        loop.runOne();
+    }
+
+    chip.drive(PCAL64::P1_1, 0);
+    chip.release(PCAL64::P1_1);
+    loop.runUntil(loop.now() + 5 * sim::NS_PER_MS);
+
+    CHECK(keyEvents == 10);
+    CHECK((keyRow == 1) && (keyColumn == 2) && (keyEvent == PCAL64::KEY_DOWN));
+
+    chip.setSwitch(1, 10, false);
+    loop.runUntil(loop.now() + 20 * sim::NS_PER_MS);
+
+    CHECK(keyEvents == 11);
+    CHECK((keyRow == 1) && (keyColumn == 2) && (keyEvent == PCAL64::KEY_UP));
+
+    expander.stopKeypad();
+    run();
+}
+
+static void testTiming(void)
+{
+    setup();
+    bus().forceClock(100000);
+
+    /* start, address, register, repeated start, address, 2 bytes, stop */
+    CHECK(bus().duration(true, 2) == 480000);
+
+    /* start, address, register, 2 bytes, stop */
+    CHECK(bus().duration(false, 2) == 380000);
+}
+
+static void testStatistics(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    expander.setInterruptHandler(irqHandler);
+    expander.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+    expander.bulkToggle(PCAL64::P0_6, done);
+    expander.bulkRead(readDone);
+    run();
+
+    chip.drive(PCAL64::P0_0, 0);
+    run();
+
+    PCAL64::statistics_t statistics;
+    expander.getStatistics(statistics);
+
+    CHECK(statistics.setInterrupts == 1);
+    CHECK(statistics.toggles == 1);
+    CHECK(statistics.reads == 1);
+    CHECK(statistics.queued == 2);
+    CHECK(statistics.transactions == 6 + 2 + 2 + 2);
+    CHECK(statistics.transactions == transactions());
+    CHECK(statistics.irqs == 1);
+
+    /* 645 us, 645 + 215 us and 645 + 215 + 240 us at 400 kHz */
+    uint32_t commands = 0;
+    for (uint8_t bucket = 0; bucket < PCAL64::HISTOGRAM_BUCKETS; bucket++)
+    {
+        commands += statistics.commandLatency[bucket];
+    }
+    CHECK(commands == 3);
+    CHECK(statistics.commandLatency[4] == 2);
+    CHECK(statistics.commandLatency[5] == 1);
+
+    /* status and input reads, 240 us */
+    CHECK(statistics.irqLatency[2] == 1);
+
+    expander.resetStatistics();
+    expander.getStatistics(statistics);
+    CHECK(statistics.transactions == 0);
+}
+
+static sim::time_ns_t doneTimeA;
+static sim::time_ns_t doneTimeB;
+
+static void doneA(void)
+{
+    doneTimeA = sim::EventLoop::get().now();
+}
+
+static void doneB(void)
+{
+    doneTimeB = sim::EventLoop::get().now();
+}
+
+static void testConfigure(void)
+{
+    /* PCAL6534: the five banks are adjacent, one burst each way */
+    setup();
+    sim::PCALModel chip(sim::PCAL6534_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL6534 expander(SDA, SCL, ADDRESS, IRQ);
+
+    PCAL6534::Config config;
+    config.drive(PCAL6534::pin(0, 0), PCAL6534::DRIVE_QUARTER)
+          .drive(PCAL6534::pin(4, 1), PCAL6534::DRIVE_HALF)
+          .latch(PCAL6534::pin(1, 2), true)
+          .pull(PCAL6534::pin(2, 0), PCAL6534::PULL_DOWN)
+          .openDrain(0x01, true);
+
+    CHECK(expander.configure(config, done));
+    run();
+
+    /* banks read and written, then the port configuration */
+    CHECK(doneCount == 1);
+    CHECK(transactions() == 4);
+    CHECK(chip.peek(0x30) == 0xFC);
+    CHECK(chip.peek(0x38) == 0xF7);
+    CHECK(chip.peekBank(0x3A) == PCAL6534::pin(1, 2));
+    CHECK(chip.peekBank(0x3F) == PCAL6534::pin(2, 0));
+    CHECK(chip.peekBank(0x44) == (0xFFFFFFFFFFULL & ~PCAL6534::pin(2, 0)));
+    CHECK(chip.peek(0x53) == 0x01);
+
+    /* with the shadow, matching banks and ports cost nothing */
+    expander.enableShadowRegisters(done);
+    run();
+
+    bus().resetCounters();
+    expander.configure(config, done);
+    run();
+
+    CHECK(transactions() == 0);
+
+    /* and only the bank that differs is written */
+    PCAL6534::Config pull;
+    pull.pull(PCAL6534::pin(2, 0), PCAL6534::PULL_UP);
+
+    bus().resetCounters();
+    expander.configure(pull, done);
+    run();
+
+    CHECK(transactions() == 1);
+    CHECK(chip.peekBank(0x44) == 0xFFFFFFFFFFULL);
+    CHECK(doneCount == 4);
+
+    /* pins in the upper half of drive bank 0, read and from the shadow */
+    {
+        setup();
+        sim::PCALModel upperChip(sim::PCAL6534_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+        PCAL6534 upperExpander(SDA, SCL, ADDRESS, IRQ);
+
+        PCAL6534::Config upper;
+        upper.drive(PCAL6534::pin(2, 1), PCAL6534::DRIVE_QUARTER)
+             .drive(PCAL6534::pin(2, 2), PCAL6534::DRIVE_FULL)
+             .drive(PCAL6534::pin(2, 3), PCAL6534::DRIVE_QUARTER);
+
+        upperExpander.configure(upper, done);
+        run();
+
+        CHECK(upperChip.peek(0x33) == 0xFF);
+        CHECK(upperChip.peek(0x34) == 0x33);
+        CHECK(upperChip.peekBank(0x35) == 0xFFFFFFFFFFULL);
+
+        upperExpander.enableShadowRegisters(done);
+        run();
+
+        PCAL6534::Config half;
+        half.drive(PCAL6534::pin(2, 1), PCAL6534::DRIVE_HALF);
+
+        bus().resetCounters();
+        upperExpander.configure(half, done);
+        run();
+
+        CHECK(transactions() == 1);
+        CHECK(upperChip.peek(0x34) == 0x37);
+        CHECK(upperChip.peekBank(0x35) == 0xFFFFFFFFFFULL);
+        CHECK(doneCount == 3);
+    }
+
+    /* PCAL6416A: no auto-increment, a transfer per bank */
+    setup();
+    sim::PCALModel small(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 narrow(SDA, SCL, ADDRESS, IRQ);
+
+    PCAL64::Config both;
+    both.drive(PCAL64::P1_7, PCAL64::DRIVE_QUARTER)
+        .pull(PCAL64::P0_3, PCAL64::PULL_DOWN);
+
+    narrow.configure(both, done);
+    run();
+
+    /* drive bank 1, pull enable and selection, each read and written */
+    CHECK(transactions() == 6);
+    CHECK(small.peek(0x42) == 0xFF);
+    CHECK(small.peek(0x43) == 0x3F);
+    CHECK(small.peekBank(0x46) == PCAL64::P0_3);
+    CHECK(small.peekBank(0x48) == (0xFFFF & ~PCAL64::P0_3));
+}
+
+static bool restoreResult;
+static int restoreCount;
+
+static void restoreDone(bool match)
+{
+    restoreResult = match;
+    restoreCount++;
+}
+
+static void testSnapshot(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6534_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL6534 expander(SDA, SCL, ADDRESS, IRQ);
+
+    PCAL6534::snapshot_t snapshot;
+
+    /* the shadow is the source, nothing to export without it */
+    CHECK(!expander.exportSnapshot(snapshot));
+
+    PCAL6534::Config config;
+    config.drive(PCAL6534::pin(3, 3), PCAL6534::DRIVE_HALF)
+          .pull(PCAL6534::pin(1, 5), PCAL6534::PULL_UP)
+          .latch(PCAL6534::pin(0, 4), true)
+          .openDrain(0x12, true);
+
+    expander.enableShadowRegisters(done);
+    expander.configure(config, done);
+    expander.bulkWrite(PCAL6534::pin(2, 1), PCAL6534::pin(2, 1), 0, done);
+    expander.bulkSetInterrupt(PCAL6534::pin(0, 0), PCAL6534::pin(0, 0), done);
+    run();
+
+    CHECK(expander.exportSnapshot(snapshot));
+    CHECK(snapshot.version == PCAL6534::SNAPSHOT_VERSION);
+
+    uint64_t mask = chip.peekBank(0x49);
+    uint64_t directions = chip.peekBank(0x0F);
+
+    /* brownout: the chip is back at its defaults */
+    chip.reset();
+    CHECK(chip.peek(0x53) == 0);
+
+    bus().resetCounters();
+    CHECK(expander.restoreSnapshot(snapshot, false, restoreDone));
+    run();
+
+    /* output to configuration, drive strength to pull selection, the mask
+       and the port configuration byte
+    */
+    CHECK(restoreCount == 1);
+    CHECK(restoreResult);
+    CHECK(transactions() == 4);
+    CHECK(chip.peekBank(0x49) == mask);
+    CHECK(chip.peekBank(0x0F) == directions);
+    CHECK(chip.peekBank(0x3F) == PCAL6534::pin(1, 5));
+    CHECK(chip.peek(0x53) == 0x12);
+
+    /* with verify the same bursts are read back */
+    bus().resetCounters();
+    expander.restoreSnapshot(snapshot, true, restoreDone);
+    run();
+
+    CHECK(restoreResult);
+    CHECK(transactions() == 8);
+
+    /* a corrupt snapshot is refused */
+    snapshot.banks[2][0] ^= 0x01;
+    CHECK(!expander.restoreSnapshot(snapshot, false, restoreDone));
+    snapshot.banks[2][0] ^= 0x01;
+
+    /* at startup, over polled I2C */
+    chip.reset();
+    CHECK(expander.restoreSnapshotBlocking(snapshot, true));
+    CHECK(chip.peekBank(0x0F) == directions);
+    CHECK(restoreCount == 2);
+
+    /* another reset after the first burst has landed fails verify */
+    sim::time_ns_t firstBurst = bus().duration(false, 3 * 5);
+
+    sim::EventLoop::get().postIn(firstBurst + bus().duration(false, 5 * 5) / 2, [&chip]() {
+        chip.reset();
+    });
+
+    expander.restoreSnapshot(snapshot, true, restoreDone);
+    run();
+
+    CHECK(restoreCount == 3);
+    CHECK(!restoreResult);
+}
+
+static void testSharedBus(void)
+{
+    setup();
+    const PinName IRQ_B = (PinName) 4;
+
+    sim::PCALModel chipA(sim::PCAL6416A_LAYOUT, SDA, SCL, PCAL64::PRIMARY_ADDRESS, IRQ);
+    sim::PCALModel chipB(sim::PCAL6416A_LAYOUT, SDA, SCL, PCAL64::SECONDARY_ADDRESS, IRQ_B);
+
+    PCAL64Bus shared(SDA, SCL);
+    PCAL64 expanderA(shared, PCAL64::PRIMARY_ADDRESS, IRQ);
+    PCAL64 expanderB(shared, PCAL64::SECONDARY_ADDRESS, IRQ_B);
+
+    sim::time_ns_t transfer = bus().duration(true, 2);
+
+    /* transfers alternate, both commands finish one transfer apart */
+    expanderA.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, doneA);
+    expanderB.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, doneB);
+    run();
+
+    CHECK(transactions() == 12);
+    CHECK(doneTimeB > doneTimeA);
+    CHECK(doneTimeB - doneTimeA <= transfer);
+
+    /* Long commands on A and on a 24-bit C do not hold up interrupts on B.
+       B's reads go ahead of both instead of waiting for their turn.
+    */
+    sim::PCALModel chipC(sim::PCAL6524_LAYOUT, SDA, SCL, 0x44);
+    PCAL6524 expanderC(shared, 0x44);
+
+    expanderB.setInterruptHandler(irqHandler);
+
+    sim::time_ns_t edge = sim::EventLoop::get().now() + transfer / 2;
+
+    expanderA.bulkSetInterrupt(PCAL64::P0_1, PCAL64::P0_1, done);
+    expanderC.bulkSetInterrupt(PCAL6524::pin(2, 0), PCAL6524::pin(2, 0), done);
+    expanderA.bulkSetInterrupt(PCAL64::P0_2, PCAL64::P0_2, done);
+    expanderA.bulkSetInterrupt(PCAL64::P0_3, PCAL64::P0_3, done);
+    sim::EventLoop::get().post(edge, [&chipB]() { chipB.drive(PCAL64::P0_0, 0); });
+    run();
+
+    CHECK(doneCount == 4);
+    CHECK(irqCount == 1);
+    CHECK(irqPins == PCAL64::P0_0);
+
+    /* rest of the transfer, then status and input reads */
+    CHECK(irqTime - edge <= 5 * transfer / 2);
+    CHECK(chipA.peekBank(0x4A) == 0xFFF0);
+}
+
+static int errorCount;
+static PCAL64::failure_t errorFailure;
+
+static void errorHandler(uint16_t, PCAL64::failure_t failure)
+{
+    errorCount++;
+    errorFailure = failure;
+}
+
+static void testSequenceRefused(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS, IRQ);
+
+    errorCount = 0;
+    expander.setErrorHandler(errorHandler);
+
+    const PCAL64::Sequence::frame_t frames[] = {
+        { 1, PCAL64::P0_0 }
+    };
+
+    PCAL64::Sequence::step_t steps[1];
+    PCAL64::Sequence sequence(steps, 1);
+
+    CHECK(sequence.prepare(frames, 1, PCAL64::P0_0));
+
+    expander.enableShadowRegisters(done);
+    expander.bulkWrite(PCAL64::P0_0 | PCAL64::P0_1, PCAL64::P0_0 | PCAL64::P0_1, 0, done);
+    run();
+
+    doneCount = 0;
+
+    /* the only frame is refused: counted as missed, the sequence ends */
+    bus().refuse();
+    CHECK(expander.playSequence(sequence, false, done));
+    run();
+
+    CHECK(doneCount == 1);
+    CHECK(errorCount == 1);
+    CHECK(expander.getFrameMisses() == 1);
+    CHECK((chip.levels() & PCAL64::P0_0) == 0);
+
+    /* the shadow did not take the frame, so a write does not carry it out */
+    expander.bulkWrite(PCAL64::P0_1, PCAL64::P0_1, PCAL64::P0_1, done);
+    run();
+
+    CHECK((chip.levels() & (PCAL64::P0_0 | PCAL64::P0_1)) == PCAL64::P0_1);
+
+    /* and the sequence plays again */
+    CHECK(expander.playSequence(sequence, false, done));
+    run();
+
+    CHECK(doneCount == 3);
+    CHECK((chip.levels() & PCAL64::P0_0) == PCAL64::P0_0);
+}
+
+static void testRecovery(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+
+    PCAL64Bus shared(SDA, SCL);
+    PCAL64 expander(shared, ADDRESS, IRQ);
+
+    errorCount = 0;
+    shared.setTimeout(5);
+    expander.setRetryPolicy(2, 1);
+    expander.setErrorHandler(errorHandler);
+
+    /* the slave holds SDA, the bus is clocked free and the transfer retried */
+    bus().hang();
+    CHECK(expander.bulkWrite(PCAL64::P1_0, PCAL64::P1_0, 0, doneA));
+    run();
+
+    CHECK(doneCount == 0);
+    /* timeout, backoff, then the four transfers of the write */
+    CHECK(doneTimeA > 6 * sim::NS_PER_MS);
+    CHECK(doneTimeA < 7 * sim::NS_PER_MS);
+    CHECK(errorCount == 0);
+    CHECK(shared.getTimeouts() == 1);
+    CHECK(sim::Net::get(SDA).read());
+    CHECK(chip.peekBank(0x06) == 0xFEFF);
+    CHECK(chip.peekBank(0x02) == 0xFEFF);
+
+    PCAL64::statistics_t statistics;
+    expander.getStatistics(statistics);
+    CHECK(statistics.retries == 1);
+
+    /* without retries the command is abandoned, the next one goes ahead */
+    expander.setRetryPolicy(0, 0);
+
+    bus().hang();
+    CHECK(expander.bulkWrite(PCAL64::P1_1, PCAL64::P1_1, 0, done));
+    CHECK(expander.bulkRead(readDone));
+    run();
+
+    CHECK(doneCount == 0);
+    CHECK(errorCount == 1);
+    CHECK(errorFailure == PCAL64::FAILURE_COMMAND);
+    CHECK(readValue == 0xFEFF);
+    CHECK(chip.peekBank(0x06) == 0xFEFF);
+
+    /* a slow slave is still busy at the timeout, the transfer is aborted
+       so no late completion turns up, and the retry delivers the read
+    */
+    expander.setRetryPolicy(1, 0);
+    chip.drive(PCAL64::P0_0, 0);
+    readValue = 0;
+
+    bus().stretch(8 * sim::NS_PER_MS);
+    CHECK(expander.bulkRead(readDone));
+    run();
+
+    CHECK(readValue == 0xFEFE);
+    CHECK(errorCount == 1);
+    CHECK(shared.getTimeouts() == 3);
+    CHECK(shared.getStaleCompletions() == 0);
+
+    /* a write merged into one that is abandoned fails with it */
+    expander.setRetryPolicy(0, 0);
+    errorCount = 0;
+    doneCount = 0;
+
+    sim::time_ns_t transfer = bus().duration(true, 2);
+
+    CHECK(expander.bulkRead(readDone));
+    CHECK(expander.bulkWrite(PCAL64::P1_2, PCAL64::P1_2, 0, done));
+    CHECK(expander.bulkWrite(PCAL64::P1_3, PCAL64::P1_3, 0, done));
+    sim::EventLoop::get().postIn(3 * transfer / 2, []() { bus().refuse(); });
+    run();
+
+    CHECK(doneCount == 0);
+    CHECK(errorCount == 2);
+    CHECK(chip.peekBank(0x06) == 0xFEFF);
+}
+
+static void testDefaultTimeout(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64 expander(SDA, SCL, ADDRESS);
+    sim::EventLoop& loop = sim::EventLoop::get();
+
+    errorCount = 0;
+    expander.setErrorHandler(errorHandler);
+
+    /* the private bus has the watchdog on, the hung write is abandoned */
+    sim::time_ns_t start = loop.now();
+
+    bus().hang();
+    CHECK(expander.bulkWrite(PCAL64::P1_0, PCAL64::P1_0, 0, done));
+    CHECK(expander.bulkRead(readDone));
+    loop.runUntil(start + 2 * YOTTA_CFG_GPIO_PCAL64_TRANSFER_TIMEOUT * sim::NS_PER_MS + sim::NS_PER_MS);
+
+    CHECK(doneCount == 0);
+    CHECK(errorCount == 1);
+    CHECK(errorFailure == PCAL64::FAILURE_COMMAND);
+    CHECK(readValue == 0xFFFF);
+    CHECK(sim::Net::get(SDA).read());
+
+    /* a transfer at the slowest standard clock is well inside it */
+    setup();
+    sim::PCALModel slow(sim::PCAL6534_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64Bus shared(SDA, SCL);
+    PCAL6534 wide(shared, ADDRESS);
+
+    bus().forceClock(100000);
+    CHECK(wide.enableShadowRegisters(done));
+    run();
+
+    CHECK(doneCount == 1);
+    CHECK(shared.getTimeouts() == 0);
+}
+
+static void testDetach(void)
+{
+    setup();
+    sim::PCALModel chipA(sim::PCAL6416A_LAYOUT, SDA, SCL, PCAL64::PRIMARY_ADDRESS, IRQ);
+    sim::PCALModel chipB(sim::PCAL6416A_LAYOUT, SDA, SCL, PCAL64::SECONDARY_ADDRESS, IRQ);
+
+    PCAL64Bus shared(SDA, SCL);
+    PCAL64 expanderB(shared, PCAL64::SECONDARY_ADDRESS);
+
+    /* a refused transfer's failure is posted, its client goes first */
+    {
+        PCAL64 expanderA(shared, PCAL64::PRIMARY_ADDRESS);
+
+        bus().refuse();
+        CHECK(expanderA.bulkWrite(PCAL64::P1_0, PCAL64::P1_0, 0, done));
+    }
+
+    CHECK(expanderB.bulkRead(readDone));
+    run();
+
+    CHECK(doneCount == 0);
+    CHECK(readValue == 0xFFFF);
+    CHECK(sim::pendingCallbacks() == 0);
+
+    /* the transfer in progress is aborted and the bus handed on at once */
+    {
+        PCAL64 expanderA(shared, PCAL64::PRIMARY_ADDRESS);
+
+        CHECK(expanderA.bulkWrite(PCAL64::P1_0, PCAL64::P1_0, 0, done));
+        CHECK(expanderB.bulkWrite(PCAL64::P1_1, PCAL64::P1_1, 0, done));
+        CHECK(bus().busy());
+    }
+
+    run();
+
+    CHECK(doneCount == 1);
+    CHECK(chipA.peekBank(0x06) == 0xFFFF);
+    CHECK(chipB.peekBank(0x06) == 0xFDFF);
+    CHECK(shared.getStaleCompletions() == 0);
+    CHECK(shared.getTimeouts() == 0);
+}
+
+static void testInterruptGroup(void)
+{
+    setup();
+    const PinName IRQ_C = (PinName) 5;
+
+    /* A and B share the INT line, C sits on the same bus without interrupts */
+    sim::PCALModel chipA(sim::PCAL6416A_LAYOUT, SDA, SCL, PCAL64::PRIMARY_ADDRESS, IRQ);
+    sim::PCALModel chipB(sim::PCAL6416A_LAYOUT, SDA, SCL, PCAL64::SECONDARY_ADDRESS, IRQ);
+    sim::PCALModel chipC(sim::PCAL6524_LAYOUT, SDA, SCL, 0x44, IRQ_C);
+
+    PCAL64Bus shared(SDA, SCL);
+    PCAL64 expanderA(shared, PCAL64::PRIMARY_ADDRESS);
+    PCAL64 expanderB(shared, PCAL64::SECONDARY_ADDRESS);
+    PCAL6524 expanderC(shared, 0x44);
+
+    PCAL64InterruptGroup group(IRQ);
+    group.attach(expanderA);
+    group.attach(expanderB);
+    group.attach(expanderC);
+
+    expanderA.setInterruptHandler(irqHandler);
+    expanderB.setInterruptHandler(irqHandler);
+
+    expanderA.enableShadowRegisters(done);
+    expanderB.enableShadowRegisters(done);
+    expanderC.enableShadowRegisters(done);
+    expanderA.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, done);
+    expanderB.bulkSetInterrupt(PCAL64::P1_0, PCAL64::P1_0, done);
+    run();
+
+    /* only A is asked */
+    chipA.drive(PCAL64::P0_0, 0);
+    run();
+
+    CHECK(irqCount == 1);
+    CHECK(irqPins == PCAL64::P0_0);
+    CHECK(chipA.statusReads == 1);
+    CHECK(chipB.statusReads == 1);
+    CHECK(chipC.statusReads == 0);
+    CHECK(group.getStatusReads() == 2);
+
+    /* Both fire. When the first has been read, its pin changes again while
+       the other one still holds the line low, so there is no new edge.
+    */
+    chipA.drive(PCAL64::P0_0, PCAL64::P0_0);
+    chipB.drive(PCAL64::P1_0, 0);
+
+    uint64_t inputReadsA = chipA.inputReads;
+    uint64_t inputReadsB = chipB.inputReads;
+
+    while ((chipA.inputReads == inputReadsA) && (chipB.inputReads == inputReadsB))
+    {
+        sim::EventLoop::get().runOne();
+    }
+
+    bool aFirst = (chipA.inputReads != inputReadsA);
+
+    if (aFirst)
+    {
+        chipA.drive(PCAL64::P0_0, 0);
+    }
+    else
+    {
+        chipB.drive(PCAL64::P1_0, PCAL64::P1_0);
+    }
+
+    CHECK(sim::Net::get(IRQ).read() == 0);
+    run();
+
+    CHECK(irqCount == 4);
+    CHECK(sim::Net::get(IRQ).read() == 1);
+    CHECK(chipC.statusReads == 0);
+}
+
+static uint64_t wideIrqPins;
+static uint64_t wideIrqValues;
+
+static void wideIrqHandler(uint16_t, uint64_t pins, uint64_t values)
+{
+    wideIrqPins = pins;
+    wideIrqValues = values;
+}
+
+static void testWidePart(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6534_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL6534 expander(SDA, SCL, ADDRESS, IRQ);
+
+    const uint64_t output = PCAL6534::P4_1 | PCAL6534::P2_5;
+    const uint64_t input = PCAL6534::P4_0;
+
+    static_assert(PCAL6534::P4_1 == PCAL6534::pin(4, 1), "pin names");
+    static_assert(PCAL6524::P2_7 == PCAL6524::pin(2, 7), "pin names");
+
+    /* every bank is one burst of five bytes */
+    CHECK(expander.bulkWrite(output, output, PCAL6534::pin(4, 1), done));
+    run();
+
+    CHECK(doneCount == 1);
+    CHECK(transactions() == 4);
+    CHECK(bus().counters().bytes == 4 * (2 + 5) + 2);
+    CHECK(chip.peekBank(0x0F) == (0xFFFFFFFFFFULL & ~output));
+    CHECK((chip.levels() & output) == PCAL6534::pin(4, 1));
+
+    /* P4_2 to P4_7 do not exist, nothing is written for them */
+    CHECK(expander.bulkWrite(PCAL6534::pin(4, 5), PCAL6534::pin(4, 5), 0, done));
+    CHECK(expander.bulkToggle(PCAL6534::pin(4, 6), done));
+    run();
+
+    CHECK(doneCount == 3);
+    CHECK(chip.peekBank(0x0F) == (0xFFFFFFFFFFULL & ~output));
+    CHECK(chip.peekBank(0x05) == (0xFFFFFFFFFFULL & ~PCAL6534::P2_5));
+    CHECK(expander.subscribe(8 * 4 + 2, PCAL6534::EDGE_BOTH, NULL) == -1);
+
+    wideIrqPins = 0;
+    wideIrqValues = 0;
+
+    expander.setInterruptHandler(wideIrqHandler);
+    expander.bulkSetInterrupt(input, input, done);
+    run();
+
+    CHECK(chip.peekBank(0x49) == (0xFFFFFFFFFFULL & ~input));
+
+    chip.drive(input, 0);
+    run();
+
+    CHECK(wideIrqPins == input);
+    CHECK((wideIrqValues & (input | output)) == PCAL6534::pin(4, 1));
+
+    /* a 24-bit part uses its own map */
+    sim::PCALModel chip24(sim::PCAL6524_LAYOUT, SDA, SCL, PCAL6524::SECONDARY_ADDRESS);
+    PCAL6524 expander24(SDA, SCL, PCAL6524::SECONDARY_ADDRESS);
+
+    CHECK(expander24.bulkWrite(PCAL6524::pin(2, 7), PCAL6524::pin(2, 7), 0, done));
+    run();
+
+    CHECK(chip24.peekBank(0x0C) == 0x7FFFFF);
+    CHECK(chip24.peekBank(0x04) == 0x7FFFFF);
+}
+
+/*****************************************************************************/
+/* Main                                                                      */
+/*****************************************************************************/
+
+int main(void)
+{
+    testWrite();
+    testRead();
+    testFastRead();
+    testBlocking();
+    testPins();
+    testToggle();
+    testInterrupt();
+    testSubscriptions();
+    testShadow();
+    testQueue();
+    testInterruptDuringCommand();
+    testInterruptDuringRead();
+    testCoalescing();
+    testDebounce();
+    testDebounceMaskChanges();
+    testStorm();
+    testSampler();
+    testSequence();
+    testKeypad();
+    testTiming();
+    testStatistics();
+    testWidePart();
+    testConfigure();
+    testSnapshot();
+    testSharedBus();
+    testSequenceRefused();
+    testRecovery();
+    testDefaultTimeout();
+    testDetach();
+    testInterruptGroup();
+
+    printf("%s\r\n", failures ? "FAIL" : "PASS");
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
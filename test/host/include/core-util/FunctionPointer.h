@@ -0,0 +1,162 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HOST_CORE_UTIL_FUNCTIONPOINTER_H__
+#define __HOST_CORE_UTIL_FUNCTIONPOINTER_H__
+
+/* Host stand-in for core-util/FunctionPointer.h.
+
+   Only the subset used by the driver is provided: construction from free
+   and member functions, call(), operator bool, clear() and bind().
+*/
+
+#include <functional>
+#include <cstddef>
+
+namespace mbed {
+namespace util {
+
+template <typename R>
+class FunctionPointerBind
+{
+public:
+    FunctionPointerBind() {}
+    FunctionPointerBind(const std::function<R()>& _fn) : fn(_fn) {}
+
+    R call() const { return fn(); }
+    R operator()() const { return fn(); }
+    operator bool() const { return (bool) fn; }
+    void clear() { fn = nullptr; }
+
+private:
+    std::function<R()> fn;
+};
+
+typedef FunctionPointerBind<void> Event;
+
+template <typename R>
+class FunctionPointer0
+{
+public:
+    FunctionPointer0() {}
+    FunctionPointer0(R (*function)(void)) { if (function) fn = function; }
+
+    template <typename T>
+    FunctionPointer0(T* object, R (T::*member)(void))
+    {
+        fn = [object, member]() { return (object->*member)(); };
+    }
+
+    R call() const { return fn(); }
+    R operator()() const { return fn(); }
+    operator bool() const { return (bool) fn; }
+    void clear() { fn = nullptr; }
+
+    FunctionPointerBind<R> bind() const { return FunctionPointerBind<R>(fn); }
+    operator FunctionPointerBind<R>() const { return bind(); }
+
+private:
+    std::function<R()> fn;
+};
+
+template <typename R, typename A1>
+class FunctionPointer1
+{
+public:
+    FunctionPointer1() {}
+    FunctionPointer1(R (*function)(A1)) { if (function) fn = function; }
+
+    template <typename T>
+    FunctionPointer1(T* object, R (T::*member)(A1))
+    {
+        fn = [object, member](A1 a1) { return (object->*member)(a1); };
+    }
+
+    R call(A1 a1) const { return fn(a1); }
+    R operator()(A1 a1) const { return fn(a1); }
+    operator bool() const { return (bool) fn; }
+    void clear() { fn = nullptr; }
+
+    FunctionPointerBind<R> bind(A1 a1) const
+    {
+        std::function<R(A1)> f = fn;
+        return FunctionPointerBind<R>([f, a1]() { return f(a1); });
+    }
+
+private:
+    std::function<R(A1)> fn;
+};
+
+template <typename R, typename A1, typename A2>
+class FunctionPointer2
+{
+public:
+    FunctionPointer2() {}
+    FunctionPointer2(R (*function)(A1, A2)) { if (function) fn = function; }
+
+    template <typename T>
+    FunctionPointer2(T* object, R (T::*member)(A1, A2))
+    {
+        fn = [object, member](A1 a1, A2 a2) { return (object->*member)(a1, a2); };
+    }
+
+    R call(A1 a1, A2 a2) const { return fn(a1, a2); }
+    R operator()(A1 a1, A2 a2) const { return fn(a1, a2); }
+    operator bool() const { return (bool) fn; }
+    void clear() { fn = nullptr; }
+
+    FunctionPointerBind<R> bind(A1 a1, A2 a2) const
+    {
+        std::function<R(A1, A2)> f = fn;
+        return FunctionPointerBind<R>([f, a1, a2]() { return f(a1, a2); });
+    }
+
+private:
+    std::function<R(A1, A2)> fn;
+};
+
+template <typename R, typename A1, typename A2, typename A3>
+class FunctionPointer3
+{
+public:
+    FunctionPointer3() {}
+    FunctionPointer3(R (*function)(A1, A2, A3)) { if (function) fn = function; }
+
+    template <typename T>
+    FunctionPointer3(T* object, R (T::*member)(A1, A2, A3))
+    {
+        fn = [object, member](A1 a1, A2 a2, A3 a3) { return (object->*member)(a1, a2, a3); };
+    }
+
+    R call(A1 a1, A2 a2, A3 a3) const { return fn(a1, a2, a3); }
+    R operator()(A1 a1, A2 a2, A3 a3) const { return fn(a1, a2, a3); }
+    operator bool() const { return (bool) fn; }
+    void clear() { fn = nullptr; }
+
+    FunctionPointerBind<R> bind(A1 a1, A2 a2, A3 a3) const
+    {
+        std::function<R(A1, A2, A3)> f = fn;
+        return FunctionPointerBind<R>([f, a1, a2, a3]() { return f(a1, a2, a3); });
+    }
+
+private:
+    std::function<R(A1, A2, A3)> fn;
+};
+
+} // namespace util
+} // namespace mbed
+
+#endif // __HOST_CORE_UTIL_FUNCTIONPOINTER_H__
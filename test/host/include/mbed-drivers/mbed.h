@@ -0,0 +1,136 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HOST_MBED_H__
+#define __HOST_MBED_H__
+
+/* Host stand-in for mbed-drivers/mbed.h.
+
+   Pins are plain integers that name nets in the simulator. InterruptIn
+   listens to a net and calls its handlers synchronously on edges, which
+   plays the role of interrupt context. I2C is the polled master; a
+   transfer advances simulated time by its duration before returning.
+   DigitalInOut drives its net open-drain, a high output only lets go.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core-util/FunctionPointer.h"
+#include "minar/minar.h"
+
+typedef enum {
+    NC = -1
+} PinName;
+
+typedef enum {
+    PullNone = 0,
+    PullUp   = 1,
+    PullDown = 2,
+    OpenDrain = 3
+} PinMode;
+
+uint32_t us_ticker_read(void);
+
+/* Advances simulated time, running the events due meanwhile. */
+void wait_us(int us);
+
+namespace mbed {
+
+class InterruptIn
+{
+public:
+    InterruptIn(PinName pin);
+    ~InterruptIn();
+
+    int read(void);
+    operator int() { return read(); }
+
+    void fall(void (*function)(void)) { fallHandler = util::FunctionPointer0<void>(function); }
+
+    template <typename T>
+    void fall(T* object, void (T::*member)(void)) { fallHandler = util::FunctionPointer0<void>(object, member); }
+
+    void rise(void (*function)(void)) { riseHandler = util::FunctionPointer0<void>(function); }
+
+    template <typename T>
+    void rise(T* object, void (T::*member)(void)) { riseHandler = util::FunctionPointer0<void>(object, member); }
+
+private:
+    void edge(bool level);
+
+    PinName pin;
+    int listener;
+    util::FunctionPointer0<void> fallHandler;
+    util::FunctionPointer0<void> riseHandler;
+};
+
+class DigitalInOut
+{
+public:
+    DigitalInOut(PinName pin);
+    ~DigitalInOut();
+
+    void output(void);
+    void input(void);
+    void write(int value);
+    int read(void);
+
+    DigitalInOut& operator=(int value) { write(value); return *this; }
+    operator int() { return read(); }
+
+private:
+    void update(void);
+
+    PinName pin;
+    int driver;
+    bool isOutput;
+    int value;
+};
+
+/* Polled I2C master. A register read is a one-byte write with repeated
+   start followed by a read, as on the target. Returns 0 on ACK.
+   abort_transfer drops the asynchronous transfer in progress on the pins,
+   its callback is not called.
+*/
+class I2C
+{
+public:
+    I2C(PinName sda, PinName scl);
+
+    void frequency(int hz);
+
+    int read(int address, char* data, int length, bool repeated = false);
+    int write(int address, const char* data, int length, bool repeated = false);
+
+    void abort_transfer(void);
+
+private:
+    PinName sda;
+    PinName scl;
+
+    /* register addressed by a write with repeated start */
+    int pendingRegister;
+};
+
+} // namespace mbed
+
+using namespace mbed;
+
+#endif // __HOST_MBED_H__
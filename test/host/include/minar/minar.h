@@ -0,0 +1,87 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HOST_MINAR_H__
+#define __HOST_MINAR_H__
+
+/* Host stand-in for minar, backed by the simulator event loop.
+
+   One tick is one microsecond of simulated time. Tolerances are accepted
+   but ignored; callbacks run exactly at their deadline.
+*/
+
+#include <stdint.h>
+
+#include "core-util/FunctionPointer.h"
+
+namespace minar {
+
+namespace platform {
+typedef uint32_t tick_t;
+}
+
+typedef platform::tick_t tick_t;
+typedef void* callback_handle_t;
+
+tick_t milliseconds(uint32_t ms);
+tick_t ticks(uint32_t ticks);
+tick_t getTime(void);
+
+class Scheduler
+{
+public:
+    class CallbackAdder
+    {
+    public:
+        CallbackAdder(const mbed::util::Event& event);
+        CallbackAdder(const CallbackAdder& other);
+        ~CallbackAdder();
+
+        CallbackAdder& delay(tick_t ticks);
+        CallbackAdder& period(tick_t ticks);
+        CallbackAdder& tolerance(tick_t ticks);
+
+        callback_handle_t getHandle(void);
+
+    private:
+        CallbackAdder& operator=(const CallbackAdder&);
+
+        mutable bool owner;
+        mbed::util::Event event;
+        tick_t delayTicks;
+        tick_t periodTicks;
+        callback_handle_t handle;
+    };
+
+    static CallbackAdder postCallback(const mbed::util::Event& event);
+
+    static CallbackAdder postCallback(void (*function)(void))
+    {
+        return postCallback(mbed::util::FunctionPointer0<void>(function).bind());
+    }
+
+    template <typename T>
+    static CallbackAdder postCallback(T* object, void (T::*member)(void))
+    {
+        return postCallback(mbed::util::FunctionPointer0<void>(object, member).bind());
+    }
+
+    static int cancelCallback(callback_handle_t handle);
+};
+
+} // namespace minar
+
+#endif // __HOST_MINAR_H__
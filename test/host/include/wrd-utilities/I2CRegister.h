@@ -0,0 +1,47 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HOST_I2CREGISTER_H__
+#define __HOST_I2CREGISTER_H__
+
+/* Host stand-in for wrd-utilities/I2CRegister.h.
+
+   Transfers are queued on the simulated bus for the given pins and the
+   callback is run from the event loop once the transfer has completed.
+   Write data is copied when the call is made.
+*/
+
+#include "mbed-drivers/mbed.h"
+
+class I2CRegister
+{
+public:
+    I2CRegister(PinName sda, PinName scl);
+
+    void frequency(uint32_t hz);
+
+    bool read(uint16_t address, uint8_t reg, uint8_t* data, uint32_t length,
+              mbed::util::FunctionPointer0<void> callback);
+
+    bool write(uint16_t address, uint8_t reg, const uint8_t* data, uint32_t length,
+               mbed::util::FunctionPointer0<void> callback);
+
+private:
+    PinName sda;
+    PinName scl;
+};
+
+#endif // __HOST_I2CREGISTER_H__
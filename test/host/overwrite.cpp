@@ -0,0 +1,194 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Tests of the overwrite-oldest queue policy. The policy is a compile-time
+   option, so this program links a driver built with
+   YOTTA_CFG_GPIO_PCAL64_QUEUE_OVERWRITE_OLDEST set, see the Makefile.
+*/
+
+#include "gpio-pcal64/PCAL64.h"
+#include "sim/PCALModel.h"
+
+#include <stdlib.h>
+
+#if !YOTTA_CFG_GPIO_PCAL64_QUEUE_OVERWRITE_OLDEST
+#error "build with YOTTA_CFG_GPIO_PCAL64_QUEUE_OVERWRITE_OLDEST=1"
+#endif
+
+/*****************************************************************************/
+/* Helpers                                                                   */
+/*****************************************************************************/
+
+#define SDA     ((PinName) 1)
+#define SCL     ((PinName) 2)
+#define ADDRESS PCAL64::PRIMARY_ADDRESS
+
+static int failures = 0;
+
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition))                                                   \
+        {                                                                   \
+            printf("%s:%d: check failed: %s\r\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static sim::I2CBus& bus(void)
+{
+    return sim::I2CBus::get(SDA, SCL);
+}
+
+static void run(void)
+{
+    sim::EventLoop::get().runUntilIdle();
+}
+
+static int doneCount;
+static int readCount;
+static int errorCount;
+static PCAL64::failure_t errorFailure;
+
+static void done(void)
+{
+    doneCount++;
+}
+
+static void readDone(uint32_t)
+{
+    readCount++;
+}
+
+static void errorHandler(uint16_t, PCAL64::failure_t failure)
+{
+    errorCount++;
+    errorFailure = failure;
+}
+
+static void setup(void)
+{
+    sim::reset();
+    bus().forceClock(400000);
+
+    doneCount = 0;
+    readCount = 0;
+    errorCount = 0;
+    errorFailure = PCAL64::FAILURE_COMMAND;
+}
+
+/*****************************************************************************/
+/* Tests                                                                     */
+/*****************************************************************************/
+
+static void testDropOldest(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS);
+    PCAL64 expander(SDA, SCL, ADDRESS);
+
+    expander.setErrorHandler(errorHandler);
+
+    /* one in progress, a full queue, then one more */
+    for (uint8_t index = 0; index < 1 + YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE; index++)
+    {
+        CHECK(expander.bulkRead(readDone));
+    }
+
+    CHECK(expander.bulkWrite(PCAL64::P0_6, PCAL64::P0_6, 0, done));
+    run();
+
+    CHECK(readCount == YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE);
+    CHECK(doneCount == 1);
+    CHECK(errorCount == 1);
+    CHECK(errorFailure == PCAL64::FAILURE_OVERWRITTEN);
+    CHECK(chip.peekBank(0x06) == 0xFFBF);
+
+    PCAL64::statistics_t statistics;
+    expander.getStatistics(statistics);
+    CHECK(statistics.overwritten == 1);
+    CHECK(statistics.rejected == 0);
+}
+
+static void testMergedDropped(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS);
+    PCAL64 expander(SDA, SCL, ADDRESS);
+
+    expander.setErrorHandler(errorHandler);
+
+    /* the oldest queued write goes with the toggle merged into it */
+    CHECK(expander.bulkRead(readDone));
+    CHECK(expander.bulkWrite(PCAL64::P0_6, PCAL64::P0_6, 0, done));
+    CHECK(expander.bulkToggle(PCAL64::P0_6, done));
+    CHECK(expander.bulkRead(readDone));
+    CHECK(expander.bulkRead(readDone));
+    CHECK(expander.bulkRead(readDone));
+    run();
+
+    CHECK(readCount == 4);
+    CHECK(doneCount == 0);
+    CHECK(errorCount == 2);
+    CHECK(chip.peekBank(0x06) == 0xFFFF);
+}
+
+static void testInProgressKept(void)
+{
+    setup();
+    sim::PCALModel chip(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS);
+    PCAL64 expander(SDA, SCL, ADDRESS);
+
+    expander.setErrorHandler(errorHandler);
+
+    /* the write and the toggles merged into it are under way... */
+    CHECK(expander.bulkRead(readDone));
+    CHECK(expander.bulkWrite(PCAL64::P0_6 | PCAL64::P0_7, PCAL64::P0_6 | PCAL64::P0_7, 0, done));
+    CHECK(expander.bulkToggle(PCAL64::P0_6, done));
+    CHECK(expander.bulkToggle(PCAL64::P0_7, done));
+
+    while (bus().counters().transactions == 0)
+    {
+        sim::EventLoop::get().runOne();
+    }
+
+    /* ...so a full queue drops the next read, not their callbacks */
+    CHECK(expander.bulkRead(readDone));
+    CHECK(expander.bulkRead(readDone));
+    CHECK(expander.bulkRead(readDone));
+    run();
+
+    CHECK(doneCount == 3);
+    CHECK(readCount == 1 + 2);
+    CHECK(errorCount == 1);
+    CHECK(errorFailure == PCAL64::FAILURE_OVERWRITTEN);
+    CHECK(chip.peekBank(0x06) == 0xFF3F);
+    CHECK(chip.peekBank(0x02) == 0xFFFF);
+}
+
+/*****************************************************************************/
+/* Main                                                                      */
+/*****************************************************************************/
+
+int main(void)
+{
+    testDropOldest();
+    testMergedDropped();
+    testInProgressKept();
+
+    printf("%s\r\n", failures ? "FAIL" : "PASS");
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,360 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim/PCALModel.h"
+
+#include <string.h>
+
+namespace sim {
+
+const pcal_layout_t PCAL6416A_LAYOUT = {
+    2,      // ports
+    true,   // pairWrap
+    0x00,   // input
+    0x02,   // output
+    0x04,   // polarity
+    0x06,   // configuration
+    0x40,   // driveStrength
+    0x44,   // inputLatch
+    0x46,   // pullEnable
+    0x48,   // pullSelection
+    0x4A,   // interruptMask
+    0x4C,   // interruptStatus
+    0x4F    // outputPortConfiguration
+};
+
+const pcal_layout_t PCAL6524_LAYOUT = {
+    3,      // ports
+    false,  // pairWrap
+    0x00,   // input
+    0x04,   // output
+    0x08,   // polarity
+    0x0C,   // configuration
+    0x40,   // driveStrength
+    0x48,   // inputLatch
+    0x4C,   // pullEnable
+    0x50,   // pullSelection
+    0x54,   // interruptMask
+    0x58,   // interruptStatus
+    0x5C    // outputPortConfiguration
+};
+
+const pcal_layout_t PCAL6534_LAYOUT = {
+    5,      // ports
+    false,  // pairWrap
+    0x00,   // input
+    0x05,   // output
+    0x0A,   // polarity
+    0x0F,   // configuration
+    0x30,   // driveStrength
+    0x3A,   // inputLatch
+    0x3F,   // pullEnable
+    0x44,   // pullSelection
+    0x49,   // interruptMask
+    0x4E,   // interruptStatus
+    0x53    // outputPortConfiguration
+};
+
+PCALModel::PCALModel(const pcal_layout_t& _layout, int sda, int scl, uint16_t _address, int _irq)
+    :   statusReads(0),
+        inputReads(0),
+        layout(_layout),
+        bus(I2CBus::get(sda, scl)),
+        address(_address),
+        irqDriver(-1),
+        irqPin(_irq),
+        externalDriven(0),
+        externalValues(0),
+        maskedLatching(false)
+{
+    pinMask = (layout.ports >= 8) ? ~0ULL : ((1ULL << (8 * layout.ports)) - 1);
+
+    memset(switches, 0, sizeof(switches));
+
+    if (irqPin >= 0)
+    {
+        irqDriver = Net::get(irqPin).attachDriver();
+    }
+
+    bus.attach(address, this);
+
+    reset();
+}
+
+PCALModel::~PCALModel()
+{
+    bus.detach(address);
+}
+
+void PCALModel::reset(void)
+{
+    memset(registers, 0, sizeof(registers));
+
+    for (uint8_t port = 0; port < layout.ports; port++)
+    {
+        registers[layout.output + port] = 0xFF;
+        registers[layout.configuration + port] = 0xFF;
+        registers[layout.driveStrength + 2 * port] = 0xFF;
+        registers[layout.driveStrength + 2 * port + 1] = 0xFF;
+        registers[layout.pullSelection + port] = 0xFF;
+        registers[layout.interruptMask + port] = 0xFF;
+    }
+
+    statusBits = 0;
+    latched = 0;
+    held = 0;
+    lastRead = inputValues();
+
+    evaluate();
+}
+
+void PCALModel::drive(uint64_t pins, uint64_t values)
+{
+    externalDriven |= pins;
+    externalValues = (externalValues & ~pins) | (values & pins);
+
+    evaluate();
+}
+
+void PCALModel::release(uint64_t pins)
+{
+    externalDriven &= ~pins;
+
+    evaluate();
+}
+
+void PCALModel::setSwitch(uint8_t row, uint8_t column, bool closed)
+{
+    if (closed)
+    {
+        switches[row] |= 1ULL << column;
+    }
+    else
+    {
+        switches[row] &= ~(1ULL << column);
+    }
+
+    evaluate();
+}
+
+uint64_t PCALModel::levels(void) const
+{
+    return pinLevels();
+}
+
+uint64_t PCALModel::getBank(uint8_t base) const
+{
+    uint64_t value = 0;
+
+    for (uint8_t port = 0; port < layout.ports; port++)
+    {
+        value |= ((uint64_t) registers[base + port]) << (8 * port);
+    }
+
+    return value;
+}
+
+uint64_t PCALModel::peekBank(uint8_t base) const
+{
+    if (base == layout.input)
+    {
+        return inputValues();
+    }
+    else if (base == layout.interruptStatus)
+    {
+        return statusBits;
+    }
+
+    return getBank(base);
+}
+
+uint64_t PCALModel::pinLevels(void) const
+{
+    uint64_t inputs = getBank(layout.configuration);
+    uint64_t pulls = getBank(layout.pullEnable);
+    uint64_t pullUp = getBank(layout.pullSelection);
+
+    /* floating inputs read high */
+    uint64_t inputLevels = (pulls & pullUp) | (~pulls);
+    inputLevels = (inputLevels & ~externalDriven) | (externalValues & externalDriven);
+
+    /* Outputs driving low pull down every input they reach through closed
+       switches, also through other inputs, which is how a key matrix
+       without diodes shows ghost keys.
+    */
+    uint64_t low = ~inputs & ~getBank(layout.output) & pinMask;
+    bool grown = true;
+
+    while (grown)
+    {
+        grown = false;
+
+        for (uint8_t row = 0; row < 64; row++)
+        {
+            uint64_t reached = switches[row] & inputs;
+
+            if (((low >> row) & 1) && (reached & ~low))
+            {
+                low |= reached;
+                grown = true;
+            }
+            else if (!((low >> row) & 1) && ((inputs >> row) & 1) && (switches[row] & low))
+            {
+                low |= 1ULL << row;
+                grown = true;
+            }
+        }
+    }
+
+    inputLevels &= ~(low & inputs);
+
+    uint64_t levels = (inputLevels & inputs) | (getBank(layout.output) & ~inputs);
+
+    return levels & pinMask;
+}
+
+uint64_t PCALModel::inputValues(void) const
+{
+    return (pinLevels() ^ getBank(layout.polarity)) & pinMask;
+}
+
+void PCALModel::evaluate(void)
+{
+    uint64_t inputs = inputValues();
+    uint64_t enabled = getBank(layout.configuration) & ~getBank(layout.interruptMask) & pinMask;
+    uint64_t latch = getBank(layout.inputLatch);
+    uint64_t changed = inputs ^ lastRead;
+
+    /* latched pins keep their status and capture the value that fired */
+    uint64_t latching = maskedLatching ? (getBank(layout.configuration) & pinMask) : enabled;
+    uint64_t fire = latching & latch & changed & ~held;
+    latched = (latched & ~fire) | (inputs & fire);
+    held = (held | fire) & latching & latch;
+
+    uint64_t latchedStatus = (statusBits | fire) & enabled & latch;
+    uint64_t plainStatus = changed & enabled & ~latch;
+
+    statusBits = latchedStatus | plainStatus;
+
+    if (irqDriver >= 0)
+    {
+        Net::get(irqPin).drive(irqDriver, statusBits != 0);
+    }
+}
+
+void PCALModel::readInputPort(uint8_t port)
+{
+    uint64_t portMask = 0xFFULL << (8 * port);
+
+    /* latched values are reported until the port has been read */
+    uint64_t holding = getBank(layout.inputLatch) & held & portMask;
+    uint64_t value = (inputValues() & ~holding) | (latched & holding);
+
+    lastRead = (lastRead & ~portMask) | (value & portMask);
+    statusBits &= ~portMask;
+    held &= ~portMask;
+
+    /* INT is released by the read even if a new change asserts it again */
+    if ((irqDriver >= 0) && (statusBits == 0))
+    {
+        Net::get(irqPin).drive(irqDriver, false);
+    }
+
+    evaluate();
+}
+
+bool PCALModel::writable(uint8_t reg) const
+{
+    return inBank(reg, layout.output, layout.ports)
+        || inBank(reg, layout.polarity, layout.ports)
+        || inBank(reg, layout.configuration, layout.ports)
+        || inBank(reg, layout.driveStrength, 2 * layout.ports)
+        || inBank(reg, layout.inputLatch, layout.ports)
+        || inBank(reg, layout.pullEnable, layout.ports)
+        || inBank(reg, layout.pullSelection, layout.ports)
+        || inBank(reg, layout.interruptMask, layout.ports)
+        || (reg == layout.outputPortConfiguration);
+}
+
+uint8_t PCALModel::next(uint8_t reg, uint8_t command) const
+{
+    if (layout.pairWrap)
+    {
+        /* PCAL6416A: alternate between the two registers of a bank */
+        return (reg == layout.outputPortConfiguration) ? reg : (reg ^ 0x01);
+    }
+
+    /* auto-increment across the register file only when requested */
+    return (command & 0x80) ? (uint8_t) (reg + 1) : reg;
+}
+
+void PCALModel::write(uint8_t command, const uint8_t* data, size_t length)
+{
+    uint8_t reg = layout.pairWrap ? command : (command & 0x7F);
+
+    for (size_t index = 0; index < length; index++)
+    {
+        if (writable(reg))
+        {
+            registers[reg] = data[index];
+        }
+
+        reg = next(reg, command);
+    }
+
+    evaluate();
+}
+
+void PCALModel::read(uint8_t command, uint8_t* data, size_t length)
+{
+    uint8_t reg = layout.pairWrap ? command : (command & 0x7F);
+
+    if (inBank(reg, layout.interruptStatus, layout.ports))
+    {
+        statusReads++;
+    }
+    else if (inBank(reg, layout.input, layout.ports))
+    {
+        inputReads++;
+    }
+
+    for (size_t index = 0; index < length; index++)
+    {
+        if (inBank(reg, layout.input, layout.ports))
+        {
+            uint8_t port = reg - layout.input;
+            uint64_t portMask = 0xFFULL << (8 * port);
+            uint64_t holding = getBank(layout.inputLatch) & held & portMask;
+            uint64_t value = (inputValues() & ~holding) | (latched & holding);
+
+            data[index] = value >> (8 * port);
+
+            readInputPort(port);
+        }
+        else if (inBank(reg, layout.interruptStatus, layout.ports))
+        {
+            data[index] = statusBits >> (8 * (reg - layout.interruptStatus));
+        }
+        else
+        {
+            data[index] = registers[reg];
+        }
+
+        reg = next(reg, command);
+    }
+}
+
+} // namespace sim
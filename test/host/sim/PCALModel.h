@@ -0,0 +1,160 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SIM_PCALMODEL_H__
+#define __SIM_PCALMODEL_H__
+
+#include "sim/Simulator.h"
+
+namespace sim {
+
+/**
+ * @brief Register map of a PCAL family part.
+ * @details Every bank holds one byte per port, except drive strength which
+ *          holds two. pairWrap selects the PCAL6416A style auto-increment
+ *          where consecutive bytes alternate within the addressed bank;
+ *          otherwise the part increments across the whole register file
+ *          when bit 7 of the command byte is set (PCAL6524/PCAL6534).
+ */
+typedef struct {
+    uint8_t ports;
+    bool pairWrap;
+    uint8_t input;
+    uint8_t output;
+    uint8_t polarity;
+    uint8_t configuration;
+    uint8_t driveStrength;
+    uint8_t inputLatch;
+    uint8_t pullEnable;
+    uint8_t pullSelection;
+    uint8_t interruptMask;
+    uint8_t interruptStatus;
+    uint8_t outputPortConfiguration;
+} pcal_layout_t;
+
+extern const pcal_layout_t PCAL6416A_LAYOUT;
+extern const pcal_layout_t PCAL6524_LAYOUT;
+extern const pcal_layout_t PCAL6534_LAYOUT;
+
+/**
+ * @brief Behavioural model of a PCAL I/O expander.
+ * @details Models the register file, power-on defaults, pull resistors,
+ *          polarity inversion, input latching and the interrupt logic:
+ *          an unmasked input raises its status bit when it differs from
+ *          the value last read from the input port, and reading an input
+ *          port clears the status bits of that port (and releases latched
+ *          values). Without latching a status bit also
+ *          clears when the input returns to the last read value. INT is an open-drain
+ *          output asserted while any status bit is set.
+ */
+class PCALModel : public I2CDevice
+{
+public:
+    PCALModel(const pcal_layout_t& layout, int sda, int scl, uint16_t address, int irq = -1);
+    ~PCALModel();
+
+    /**
+     * @brief Restore power-on register defaults, as after a reset pulse.
+     */
+    void reset(void);
+
+    /**
+     * @brief Drive input pins from outside the chip.
+     * @param pins Pins to drive (LSB is P0_0).
+     * @param values Levels for the driven pins.
+     */
+    void drive(uint64_t pins, uint64_t values);
+
+    /**
+     * @brief Stop driving pins, they fall back to pulls or float high.
+     */
+    void release(uint64_t pins);
+
+    /**
+     * @brief Close or open a switch between two pins, as in a key matrix.
+     * @details Closed switches connect pins as in a matrix without diodes:
+     *          an output driving low pulls down every input it reaches,
+     *          directly or through other inputs.
+     */
+    void setSwitch(uint8_t row, uint8_t column, bool closed);
+
+    /**
+     * @brief Latch inputs whose interrupt is masked.
+     * @details The datasheets leave open whether the input latch depends on
+     *          the interrupt mask. By default a masked input reads its live
+     *          level. When enabled, a latched input captures the value of
+     *          its first change, masked or not, until the port is read; the
+     *          mask only keeps its status bit clear.
+     */
+    void setMaskedLatching(bool enable) { maskedLatching = enable; }
+
+    /**
+     * @brief Level on each pin as seen from outside the chip.
+     */
+    uint64_t levels(void) const;
+
+    uint8_t peek(uint8_t reg) const { return registers[reg]; }
+    uint64_t peekBank(uint8_t base) const;
+
+    bool interruptAsserted(void) const { return statusBits != 0; }
+
+    const pcal_layout_t& getLayout(void) const { return layout; }
+
+    /* I2CDevice */
+    virtual void write(uint8_t reg, const uint8_t* data, size_t length);
+    virtual void read(uint8_t reg, uint8_t* data, size_t length);
+
+    /* number of times INTERRUPT_STATUS has been read and input ports have been read */
+    uint64_t statusReads;
+    uint64_t inputReads;
+
+private:
+    uint8_t next(uint8_t reg, uint8_t command) const;
+    bool writable(uint8_t reg) const;
+    bool inBank(uint8_t reg, uint8_t base, uint8_t size) const { return (reg >= base) && (reg < base + size); }
+
+    uint64_t pinLevels(void) const;
+    uint64_t inputValues(void) const;
+    void evaluate(void);
+    void readInputPort(uint8_t port);
+
+    uint64_t getBank(uint8_t base) const;
+
+    const pcal_layout_t& layout;
+    I2CBus& bus;
+    uint16_t address;
+    int irqDriver;
+    int irqPin;
+
+    uint8_t registers[256];
+
+    uint64_t externalDriven;
+    uint64_t externalValues;
+
+    /* closed switches, column pins for each row pin */
+    uint64_t switches[64];
+
+    uint64_t statusBits;
+    uint64_t lastRead;
+    uint64_t latched;
+    uint64_t held;                  // inputs whose latched value is reported
+    uint64_t pinMask;
+    bool maskedLatching;
+};
+
+} // namespace sim
+
+#endif // __SIM_PCALMODEL_H__
@@ -0,0 +1,528 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim/Simulator.h"
+
+namespace sim {
+
+/*****************************************************************************/
+/* Event loop                                                                */
+/*****************************************************************************/
+
+EventLoop& EventLoop::get(void)
+{
+    static EventLoop loop;
+    return loop;
+}
+
+EventLoop::handle_t EventLoop::post(time_ns_t when, const std::function<void(void)>& fn)
+{
+    if (when < current)
+    {
+        when = current;
+    }
+
+    handle_t handle = ++sequence;
+
+    events[key_t(when, handle)] = fn;
+    index[handle] = when;
+
+    return handle;
+}
+
+bool EventLoop::cancel(handle_t handle)
+{
+    std::map<handle_t, time_ns_t>::iterator entry = index.find(handle);
+
+    if (entry == index.end())
+    {
+        return false;
+    }
+
+    events.erase(key_t(entry->second, handle));
+    index.erase(entry);
+
+    return true;
+}
+
+bool EventLoop::runOne(void)
+{
+    if (events.empty())
+    {
+        return false;
+    }
+
+    std::map<key_t, std::function<void(void)> >::iterator next = events.begin();
+
+    current = next->first.first;
+
+    std::function<void(void)> fn = next->second;
+    index.erase(next->first.second);
+    events.erase(next);
+
+    fn();
+
+    return true;
+}
+
+void EventLoop::runUntil(time_ns_t when)
+{
+    while (!events.empty() && (events.begin()->first.first <= when))
+    {
+        runOne();
+    }
+
+    if (current < when)
+    {
+        current = when;
+    }
+}
+
+bool EventLoop::runUntilIdle(time_ns_t limit)
+{
+    while (!events.empty())
+    {
+        if (events.begin()->first.first > limit)
+        {
+            return false;
+        }
+
+        runOne();
+    }
+
+    return true;
+}
+
+void EventLoop::reset(void)
+{
+    events.clear();
+    index.clear();
+    current = 0;
+}
+
+/*****************************************************************************/
+/* Nets                                                                      */
+/*****************************************************************************/
+
+static std::map<int, Net*>& nets(void)
+{
+    static std::map<int, Net*> table;
+    return table;
+}
+
+Net& Net::get(int pin)
+{
+    Net*& net = nets()[pin];
+
+    if (net == NULL)
+    {
+        net = new Net();
+    }
+
+    return *net;
+}
+
+void Net::resetAll(void)
+{
+    std::map<int, Net*>& table = nets();
+
+    for (std::map<int, Net*>::iterator it = table.begin(); it != table.end(); ++it)
+    {
+        delete it->second;
+    }
+
+    table.clear();
+}
+
+int Net::attachDriver(void)
+{
+    drivers.push_back(false);
+    return drivers.size() - 1;
+}
+
+void Net::drive(int driver, bool low)
+{
+    drivers[driver] = low;
+    update();
+}
+
+int Net::listen(const std::function<void(bool)>& onEdge)
+{
+    int listener = nextListener++;
+    listeners[listener] = onEdge;
+    return listener;
+}
+
+void Net::unlisten(int listener)
+{
+    listeners.erase(listener);
+}
+
+void Net::update(void)
+{
+    bool newLevel = true;
+
+    for (size_t index = 0; index < drivers.size(); index++)
+    {
+        if (drivers[index])
+        {
+            newLevel = false;
+        }
+    }
+
+    if (newLevel != level)
+    {
+        level = newLevel;
+
+        /* copy, listeners may detach themselves */
+        std::map<int, std::function<void(bool)> > copy = listeners;
+
+        for (std::map<int, std::function<void(bool)> >::iterator it = copy.begin(); it != copy.end(); ++it)
+        {
+            it->second(level);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* I2C bus                                                                   */
+/*****************************************************************************/
+
+static std::map<int, I2CBus*>& buses(void)
+{
+    static std::map<int, I2CBus*> table;
+    return table;
+}
+
+I2CBus::I2CBus(int _sda, int _scl)
+    :   sda(_sda),
+        scl(_scl),
+        requestedClock(100000),
+        forcedClock(0),
+        overhead(0),
+        active(false),
+        finishEvent(0),
+        hangNext(false),
+        stalled(false),
+        hung(false),
+        holding(false),
+        hangClocks(0),
+        stretchNext(0),
+        refuseNext(false)
+{
+    resetCounters();
+
+    /* the nets go away with the bus in reset(), no need to unlisten */
+    sdaDriver = Net::get(sda).attachDriver();
+    Net::get(sda).listen(std::bind(&I2CBus::dataEdge, this, std::placeholders::_1));
+    Net::get(scl).listen(std::bind(&I2CBus::clockEdge, this, std::placeholders::_1));
+}
+
+I2CBus& I2CBus::get(int sda, int scl)
+{
+    I2CBus*& bus = buses()[(sda << 16) ^ scl];
+
+    if (bus == NULL)
+    {
+        bus = new I2CBus(sda, scl);
+    }
+
+    return *bus;
+}
+
+void I2CBus::resetAll(void)
+{
+    std::map<int, I2CBus*>& table = buses();
+
+    for (std::map<int, I2CBus*>::iterator it = table.begin(); it != table.end(); ++it)
+    {
+        delete it->second;
+    }
+
+    table.clear();
+}
+
+void I2CBus::attach(uint16_t address, I2CDevice* device)
+{
+    devices[address] = device;
+}
+
+void I2CBus::detach(uint16_t address)
+{
+    devices.erase(address);
+}
+
+time_ns_t I2CBus::duration(bool isRead, size_t length) const
+{
+    /* start + address + register, then either data or
+       repeated start + address + data, then stop. Every byte is 9 bits.
+    */
+    uint64_t bits = 1 + 9 * 2;
+
+    if (isRead)
+    {
+        bits += 1 + 9;
+    }
+
+    bits += 9 * length + 1;
+
+    return overhead + (bits * 1000000000ULL + clock() - 1) / clock();
+}
+
+void I2CBus::read(uint16_t address, uint8_t reg, uint8_t* data, size_t length, const done_t& done)
+{
+    transaction_t transaction;
+    transaction.isRead = true;
+    transaction.address = address;
+    transaction.reg = reg;
+    transaction.data.resize(length);
+    transaction.destination = data;
+    transaction.done = done;
+
+    submit(transaction);
+}
+
+void I2CBus::write(uint16_t address, uint8_t reg, const uint8_t* data, size_t length, const done_t& done)
+{
+    transaction_t transaction;
+    transaction.isRead = false;
+    transaction.address = address;
+    transaction.reg = reg;
+    transaction.data.assign(data, data + length);
+    transaction.destination = NULL;
+    transaction.done = done;
+
+    submit(transaction);
+}
+
+bool I2CBus::readBlocking(uint16_t address, uint8_t reg, uint8_t* data, size_t length)
+{
+    if (busy())
+    {
+        return false;
+    }
+
+    transaction_t transaction;
+    transaction.isRead = true;
+    transaction.address = address;
+    transaction.reg = reg;
+    transaction.data.resize(length);
+    transaction.destination = data;
+
+    EventLoop::get().runUntil(EventLoop::get().now() + duration(true, length));
+    execute(transaction);
+
+    return devices.count(address) != 0;
+}
+
+bool I2CBus::writeBlocking(uint16_t address, uint8_t reg, const uint8_t* data, size_t length)
+{
+    if (busy())
+    {
+        return false;
+    }
+
+    transaction_t transaction;
+    transaction.isRead = false;
+    transaction.address = address;
+    transaction.reg = reg;
+    transaction.data.assign(data, data + length);
+    transaction.destination = NULL;
+
+    EventLoop::get().runUntil(EventLoop::get().now() + duration(false, length));
+    execute(transaction);
+
+    return devices.count(address) != 0;
+}
+
+void I2CBus::resetCounters(void)
+{
+    stats.transactions = 0;
+    stats.reads = 0;
+    stats.writes = 0;
+    stats.bytes = 0;
+    stats.busyTime = 0;
+}
+
+void I2CBus::submit(const transaction_t& transaction)
+{
+    queue.push_back(transaction);
+
+    if (!active)
+    {
+        startNext();
+    }
+}
+
+void I2CBus::abort(void)
+{
+    if (!active)
+    {
+        return;
+    }
+
+    if (stalled)
+    {
+        stalled = false;
+    }
+    else
+    {
+        EventLoop::get().cancel(finishEvent);
+    }
+
+    active = false;
+
+    if (!hung)
+    {
+        startNext();
+    }
+}
+
+void I2CBus::startNext(void)
+{
+    if (queue.empty() || hung)
+    {
+        return;
+    }
+
+    active = true;
+    current = queue.front();
+    queue.pop_front();
+
+    if (hangNext)
+    {
+        hangNext = false;
+        stalled = true;
+        hung = true;
+        holding = true;
+        hangClocks = 0;
+
+        Net::get(sda).drive(sdaDriver, true);
+
+        return;
+    }
+
+    time_ns_t extra = stretchNext;
+    stretchNext = 0;
+
+    finishEvent = EventLoop::get().postIn(duration(current.isRead, current.data.size()) + extra,
+                                          std::bind(&I2CBus::finish, this));
+}
+
+void I2CBus::clockEdge(bool level)
+{
+    if (!holding)
+    {
+        return;
+    }
+
+    if (level)
+    {
+        hangClocks++;
+    }
+    else if (hangClocks >= 4)
+    {
+        /* data changes while SCL is low */
+        holding = false;
+
+        Net::get(sda).drive(sdaDriver, false);
+    }
+}
+
+void I2CBus::dataEdge(bool level)
+{
+    /* STOP, SDA rising while SCL is high. A stalled transaction that has
+       not been aborted still holds up the queue.
+    */
+    if (hung && !holding && level && Net::get(scl).read())
+    {
+        hung = false;
+
+        if (!active)
+        {
+            startNext();
+        }
+    }
+}
+
+void I2CBus::finish(void)
+{
+    execute(current);
+
+    done_t done = current.done;
+    active = false;
+
+    startNext();
+
+    if (done)
+    {
+        done();
+    }
+}
+
+void I2CBus::execute(transaction_t& transaction)
+{
+    stats.transactions++;
+    stats.busyTime += duration(transaction.isRead, transaction.data.size());
+
+    /* address + register (+ address again for reads) + data */
+    stats.bytes += 2 + transaction.data.size();
+
+    std::map<uint16_t, I2CDevice*>::iterator device = devices.find(transaction.address);
+
+    if (transaction.isRead)
+    {
+        stats.reads++;
+        stats.bytes++;
+
+        if (device != devices.end())
+        {
+            device->second->read(transaction.reg, &transaction.data[0], transaction.data.size());
+        }
+        else
+        {
+            /* no ACK, the bus floats high */
+            for (size_t index = 0; index < transaction.data.size(); index++)
+            {
+                transaction.data[index] = 0xFF;
+            }
+        }
+
+        for (size_t index = 0; index < transaction.data.size(); index++)
+        {
+            transaction.destination[index] = transaction.data[index];
+        }
+    }
+    else
+    {
+        stats.writes++;
+
+        if (device != devices.end())
+        {
+            device->second->write(transaction.reg, &transaction.data[0], transaction.data.size());
+        }
+    }
+}
+
+void reset(void)
+{
+    resetScheduler();
+    EventLoop::get().reset();
+    Net::resetAll();
+    I2CBus::resetAll();
+}
+
+} // namespace sim
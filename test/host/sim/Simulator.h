@@ -0,0 +1,317 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SIM_SIMULATOR_H__
+#define __SIM_SIMULATOR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace sim {
+
+/* Simulated time in nanoseconds. */
+typedef uint64_t time_ns_t;
+
+static const time_ns_t NS_PER_US = 1000;
+static const time_ns_t NS_PER_MS = 1000000;
+
+/*****************************************************************************/
+/* Event loop                                                                */
+/*****************************************************************************/
+
+/**
+ * @brief Deterministic discrete-event loop.
+ * @details Events are executed in order of time, events with equal time
+ *          are executed in the order they were posted. Time only moves
+ *          forward when an event is executed, so a run is fully
+ *          reproducible.
+ */
+class EventLoop
+{
+public:
+    typedef uint64_t handle_t;
+
+    static EventLoop& get(void);
+
+    time_ns_t now(void) const { return current; }
+
+    handle_t post(time_ns_t when, const std::function<void(void)>& fn);
+    handle_t postIn(time_ns_t delay, const std::function<void(void)>& fn) { return post(current + delay, fn); }
+    bool cancel(handle_t handle);
+
+    /**
+     * @brief Execute the next pending event.
+     * @return False if there were no events left.
+     */
+    bool runOne(void);
+
+    /**
+     * @brief Execute events until the given time, then advance time to it.
+     */
+    void runUntil(time_ns_t when);
+
+    /**
+     * @brief Execute events until none are left or the limit is reached.
+     * @return True if the loop went idle, false if the limit was hit.
+     */
+    bool runUntilIdle(time_ns_t limit = ~(time_ns_t) 0);
+
+    size_t pending(void) const { return events.size(); }
+
+    /**
+     * @brief Drop all events and rewind time to zero.
+     */
+    void reset(void);
+
+private:
+    EventLoop() : current(0), sequence(0) {}
+
+    typedef std::pair<time_ns_t, handle_t> key_t;
+
+    time_ns_t current;
+    handle_t sequence;
+    std::map<key_t, std::function<void(void)> > events;
+    std::map<handle_t, time_ns_t> index;
+};
+
+/*****************************************************************************/
+/* Nets                                                                      */
+/*****************************************************************************/
+
+/**
+ * @brief A single wire with open-drain drivers and a pull-up.
+ * @details The level is low if any driver pulls it low. Edge listeners
+ *          are called synchronously when the level changes, which is how
+ *          interrupt context is modelled.
+ */
+class Net
+{
+public:
+    static Net& get(int pin);
+
+    /**
+     * @brief Remove all nets, drivers and listeners.
+     */
+    static void resetAll(void);
+
+    int attachDriver(void);
+    void drive(int driver, bool low);
+
+    bool read(void) const { return level; }
+
+    int listen(const std::function<void(bool)>& onEdge);
+    void unlisten(int listener);
+
+private:
+    Net() : level(true), nextListener(0) {}
+    void update(void);
+
+    bool level;
+    std::vector<bool> drivers;
+    int nextListener;
+    std::map<int, std::function<void(bool)> > listeners;
+};
+
+/*****************************************************************************/
+/* I2C bus                                                                   */
+/*****************************************************************************/
+
+/**
+ * @brief Register level view of a device on the simulated bus.
+ */
+class I2CDevice
+{
+public:
+    virtual ~I2CDevice() {}
+
+    virtual void write(uint8_t reg, const uint8_t* data, size_t length) = 0;
+    virtual void read(uint8_t reg, uint8_t* data, size_t length) = 0;
+};
+
+/**
+ * @brief Simulated I2C bus with transaction timing.
+ * @details Transactions are serialized in submission order. The duration of
+ *          each transaction is computed from the bus clock and the number of
+ *          bits on the wire (start, address, register, data, acks, stop);
+ *          the register access itself takes effect when the transaction ends.
+ */
+class I2CBus
+{
+public:
+    typedef std::function<void(void)> done_t;
+
+    static I2CBus& get(int sda, int scl);
+    static void resetAll(void);
+
+    void attach(uint16_t address, I2CDevice* device);
+    void detach(uint16_t address);
+
+    /**
+     * @brief Clock requested by the driver.
+     */
+    void frequency(uint32_t hz) { requestedClock = hz; }
+
+    /**
+     * @brief Force the bus clock regardless of what the driver requests.
+     * @param hz Clock in Hz, 0 to follow the driver.
+     */
+    void forceClock(uint32_t hz) { forcedClock = hz; }
+    uint32_t clock(void) const { return forcedClock ? forcedClock : requestedClock; }
+
+    /**
+     * @brief Fixed software cost added to every transaction, e.g. the
+     *        interrupt and scheduler hops of the platform I2C driver.
+     */
+    void setOverhead(time_ns_t ns) { overhead = ns; }
+
+    void read(uint16_t address, uint8_t reg, uint8_t* data, size_t length, const done_t& done);
+    void write(uint16_t address, uint8_t reg, const uint8_t* data, size_t length, const done_t& done);
+
+    /**
+     * @brief Execute a transaction immediately, advancing time by its duration.
+     * @details Models polled (blocking) I2C. The bus must be idle.
+     */
+    bool readBlocking(uint16_t address, uint8_t reg, uint8_t* data, size_t length);
+    bool writeBlocking(uint16_t address, uint8_t reg, const uint8_t* data, size_t length);
+
+    bool busy(void) const { return active || !queue.empty(); }
+
+    /**
+     * @brief Drop the asynchronous transaction in progress.
+     * @details Models the master giving up on a transfer. Its completion
+     *          is not called. The next transaction starts at once, or
+     *          after the STOP that frees a slave still holding SDA.
+     */
+    void abort(void);
+
+    /**
+     * @brief Fault injection, the next transaction stalls with SDA held low.
+     * @details Models a slave that lost track of the clock. It lets go of
+     *          SDA after four SCL clocks, once the master has clocked the
+     *          pins by hand, and the bus is usable again after a STOP. The
+     *          stalled transaction never completes and holds up the
+     *          transactions behind it until it is aborted.
+     */
+    void hang(void) { hangNext = true; }
+
+    /**
+     * @brief Fault injection, the next transaction takes extra time.
+     * @details Models a slave stretching the clock. The transaction
+     *          completes normally, however late.
+     */
+    void stretch(time_ns_t extra) { stretchNext = extra; }
+
+    /**
+     * @brief Fault injection, the next asynchronous transfer is refused.
+     * @details I2CRegister returns false without queueing it, which is
+     *          all the driver learns of a NACK or of a platform driver
+     *          that gave up. Taken by the stand-in when a transfer starts.
+     */
+    void refuse(void) { refuseNext = true; }
+    bool takeRefusal(void) { bool refused = refuseNext; refuseNext = false; return refused; }
+
+    time_ns_t duration(bool isRead, size_t length) const;
+
+    /* statistics */
+    typedef struct {
+        uint64_t transactions;
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t bytes;
+        time_ns_t busyTime;
+    } counters_t;
+
+    const counters_t& counters(void) const { return stats; }
+    void resetCounters(void);
+
+private:
+    I2CBus(int sda, int scl);
+
+    typedef struct {
+        bool isRead;
+        uint16_t address;
+        uint8_t reg;
+        std::vector<uint8_t> data;
+        uint8_t* destination;
+        done_t done;
+    } transaction_t;
+
+    void submit(const transaction_t& transaction);
+    void startNext(void);
+    void finish(void);
+    void execute(transaction_t& transaction);
+    void clockEdge(bool level);
+    void dataEdge(bool level);
+
+    int sda;
+    int scl;
+
+    uint32_t requestedClock;
+    uint32_t forcedClock;
+    time_ns_t overhead;
+
+    std::map<uint16_t, I2CDevice*> devices;
+    std::deque<transaction_t> queue;
+    bool active;
+    transaction_t current;
+    EventLoop::handle_t finishEvent;
+
+    /* Stalled transaction, until aborted. The bus is hung until the STOP
+       after SDA is let go, SDA is held while holding is set.
+    */
+    int sdaDriver;
+    bool hangNext;
+    bool stalled;
+    bool hung;
+    bool holding;
+    uint8_t hangClocks;
+    time_ns_t stretchNext;
+    bool refuseNext;
+
+    counters_t stats;
+};
+
+/**
+ * @brief Reset the event loop, all nets and all buses.
+ */
+void reset(void);
+
+/**
+ * @brief Drop all pending minar callbacks (defined by the minar stand-in).
+ * @details Also sets the scheduler latency back to zero.
+ */
+void resetScheduler(void);
+
+/**
+ * @brief Delay every minar callback by a further latency.
+ * @details Models an application that keeps the scheduler busy, so
+ *          callbacks posted meanwhile pile up.
+ */
+void setSchedulerLatency(time_ns_t latency);
+
+/**
+ * @brief Number of minar callbacks posted and not yet run or cancelled.
+ */
+size_t pendingCallbacks(void);
+
+} // namespace sim
+
+#endif // __SIM_SIMULATOR_H__
@@ -0,0 +1,227 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed-drivers/mbed.h"
+#include "wrd-utilities/I2CRegister.h"
+#include "sim/Simulator.h"
+
+uint32_t us_ticker_read(void)
+{
+    return sim::EventLoop::get().now() / sim::NS_PER_US;
+}
+
+void wait_us(int us)
+{
+    sim::EventLoop::get().runUntil(sim::EventLoop::get().now() + us * sim::NS_PER_US);
+}
+
+namespace mbed {
+
+/*****************************************************************************/
+/* InterruptIn                                                               */
+/*****************************************************************************/
+
+InterruptIn::InterruptIn(PinName _pin)
+    :   pin(_pin),
+        listener(-1)
+{
+    if (pin != NC)
+    {
+        listener = sim::Net::get(pin).listen(std::bind(&InterruptIn::edge, this, std::placeholders::_1));
+    }
+}
+
+InterruptIn::~InterruptIn()
+{
+    if (pin != NC)
+    {
+        sim::Net::get(pin).unlisten(listener);
+    }
+}
+
+int InterruptIn::read(void)
+{
+    return (pin != NC) ? sim::Net::get(pin).read() : 1;
+}
+
+void InterruptIn::edge(bool level)
+{
+    if (level && riseHandler)
+    {
+        riseHandler.call();
+    }
+    else if (!level && fallHandler)
+    {
+        fallHandler.call();
+    }
+}
+
+/*****************************************************************************/
+/* DigitalInOut                                                              */
+/*****************************************************************************/
+
+DigitalInOut::DigitalInOut(PinName _pin)
+    :   pin(_pin),
+        driver(-1),
+        isOutput(false),
+        value(0)
+{
+    if (pin != NC)
+    {
+        driver = sim::Net::get(pin).attachDriver();
+    }
+}
+
+DigitalInOut::~DigitalInOut()
+{
+    isOutput = false;
+    update();
+}
+
+void DigitalInOut::output(void)
+{
+    isOutput = true;
+    update();
+}
+
+void DigitalInOut::input(void)
+{
+    isOutput = false;
+    update();
+}
+
+void DigitalInOut::write(int _value)
+{
+    value = _value;
+    update();
+}
+
+int DigitalInOut::read(void)
+{
+    return (pin != NC) ? sim::Net::get(pin).read() : 1;
+}
+
+void DigitalInOut::update(void)
+{
+    if (pin != NC)
+    {
+        sim::Net::get(pin).drive(driver, isOutput && !value);
+    }
+}
+
+/*****************************************************************************/
+/* I2C                                                                       */
+/*****************************************************************************/
+
+I2C::I2C(PinName _sda, PinName _scl)
+    :   sda(_sda),
+        scl(_scl),
+        pendingRegister(-1)
+{
+}
+
+void I2C::frequency(int hz)
+{
+    sim::I2CBus::get(sda, scl).frequency(hz);
+}
+
+int I2C::read(int address, char* data, int length, bool)
+{
+    if (pendingRegister < 0)
+    {
+        return -1;
+    }
+
+    uint8_t reg = pendingRegister;
+    pendingRegister = -1;
+
+    return sim::I2CBus::get(sda, scl).readBlocking(address, reg, (uint8_t*) data, length) ? 0 : -1;
+}
+
+int I2C::write(int address, const char* data, int length, bool repeated)
+{
+    if (length < 1)
+    {
+        return -1;
+    }
+
+    if (repeated && (length == 1))
+    {
+        pendingRegister = (uint8_t) data[0];
+
+        return 0;
+    }
+
+    return sim::I2CBus::get(sda, scl).writeBlocking(address, data[0], (const uint8_t*) &data[1], length - 1) ? 0 : -1;
+}
+
+void I2C::abort_transfer(void)
+{
+    sim::I2CBus::get(sda, scl).abort();
+}
+
+} // namespace mbed
+
+/*****************************************************************************/
+/* I2CRegister                                                               */
+/*****************************************************************************/
+
+I2CRegister::I2CRegister(PinName _sda, PinName _scl)
+    :   sda(_sda),
+        scl(_scl)
+{
+}
+
+void I2CRegister::frequency(uint32_t hz)
+{
+    sim::I2CBus::get(sda, scl).frequency(hz);
+}
+
+bool I2CRegister::read(uint16_t address, uint8_t reg, uint8_t* data, uint32_t length,
+                       mbed::util::FunctionPointer0<void> callback)
+{
+    if (sim::I2CBus::get(sda, scl).takeRefusal())
+    {
+        return false;
+    }
+
+    sim::I2CBus::get(sda, scl).read(address, reg, data, length, [callback]() {
+        if (callback)
+        {
+            callback.call();
+        }
+    });
+
+    return true;
+}
+
+bool I2CRegister::write(uint16_t address, uint8_t reg, const uint8_t* data, uint32_t length,
+                        mbed::util::FunctionPointer0<void> callback)
+{
+    if (sim::I2CBus::get(sda, scl).takeRefusal())
+    {
+        return false;
+    }
+
+    sim::I2CBus::get(sda, scl).write(address, reg, data, length, [callback]() {
+        if (callback)
+        {
+            callback.call();
+        }
+    });
+
+    return true;
+}
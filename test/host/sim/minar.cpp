@@ -0,0 +1,186 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "minar/minar.h"
+#include "sim/Simulator.h"
+
+#include <map>
+
+namespace minar {
+
+/* Periodic callbacks keep their handle across reposts. */
+typedef struct {
+    mbed::util::Event event;
+    tick_t period;
+    sim::EventLoop::handle_t pending;
+} entry_t;
+
+static std::map<uintptr_t, entry_t>& entries(void)
+{
+    static std::map<uintptr_t, entry_t> table;
+    return table;
+}
+
+static uintptr_t nextHandle = 1;
+
+static sim::time_ns_t latency = 0;
+
+static void fire(uintptr_t handle)
+{
+    std::map<uintptr_t, entry_t>::iterator it = entries().find(handle);
+
+    if (it == entries().end())
+    {
+        return;
+    }
+
+    mbed::util::Event event = it->second.event;
+
+    if (it->second.period)
+    {
+        it->second.pending = sim::EventLoop::get().postIn(it->second.period * sim::NS_PER_US,
+                                                          [handle]() { fire(handle); });
+    }
+    else
+    {
+        entries().erase(it);
+    }
+
+    event.call();
+}
+
+tick_t milliseconds(uint32_t ms)
+{
+    return ms * 1000;
+}
+
+tick_t ticks(uint32_t ticks)
+{
+    return ticks;
+}
+
+tick_t getTime(void)
+{
+    return sim::EventLoop::get().now() / sim::NS_PER_US;
+}
+
+Scheduler::CallbackAdder::CallbackAdder(const mbed::util::Event& _event)
+    :   owner(true),
+        event(_event),
+        delayTicks(0),
+        periodTicks(0),
+        handle(NULL)
+{
+}
+
+Scheduler::CallbackAdder::CallbackAdder(const CallbackAdder& other)
+    :   owner(other.owner),
+        event(other.event),
+        delayTicks(other.delayTicks),
+        periodTicks(other.periodTicks),
+        handle(other.handle)
+{
+    other.owner = false;
+}
+
+Scheduler::CallbackAdder::~CallbackAdder()
+{
+    if (owner)
+    {
+        getHandle();
+    }
+}
+
+Scheduler::CallbackAdder& Scheduler::CallbackAdder::delay(tick_t ticks)
+{
+    delayTicks = ticks;
+    return *this;
+}
+
+Scheduler::CallbackAdder& Scheduler::CallbackAdder::period(tick_t ticks)
+{
+    periodTicks = ticks;
+    return *this;
+}
+
+Scheduler::CallbackAdder& Scheduler::CallbackAdder::tolerance(tick_t)
+{
+    return *this;
+}
+
+callback_handle_t Scheduler::CallbackAdder::getHandle(void)
+{
+    if (owner)
+    {
+        owner = false;
+
+        uintptr_t id = nextHandle++;
+
+        entry_t entry;
+        entry.event = event;
+        entry.period = periodTicks;
+
+        tick_t first = delayTicks ? delayTicks : periodTicks;
+        entry.pending = sim::EventLoop::get().postIn(first * sim::NS_PER_US + latency, [id]() { fire(id); });
+
+        entries()[id] = entry;
+        handle = (callback_handle_t) id;
+    }
+
+    return handle;
+}
+
+Scheduler::CallbackAdder Scheduler::postCallback(const mbed::util::Event& event)
+{
+    return CallbackAdder(event);
+}
+
+int Scheduler::cancelCallback(callback_handle_t handle)
+{
+    std::map<uintptr_t, entry_t>::iterator it = entries().find((uintptr_t) handle);
+
+    if (it == entries().end())
+    {
+        return -1;
+    }
+
+    sim::EventLoop::get().cancel(it->second.pending);
+    entries().erase(it);
+
+    return 0;
+}
+
+} // namespace minar
+
+namespace sim {
+
+void resetScheduler(void)
+{
+    minar::entries().clear();
+    minar::latency = 0;
+}
+
+void setSchedulerLatency(time_ns_t latency)
+{
+    minar::latency = latency;
+}
+
+size_t pendingCallbacks(void)
+{
+    return minar::entries().size();
+}
+
+} // namespace sim
@@ -0,0 +1,1716 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2006-2015 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Randomized stress test of the PCAL64 driver on the simulated bus.
+
+   Random API calls, random edges on the input pins and random bus faults
+   (refused, late and hung transfers) are issued at a high rate, once with
+   the shadow registers off and once with them on. The run checks that
+
+   * every accepted command ends exactly once, with its callback or with
+     the error handler, and in the order it was issued,
+   * reads and the final register contents agree with the writes that
+     completed, except for pins touched by abandoned commands,
+   * every edge on an interrupt pin is reported: when the run settles the
+     level last reported for each pin is its level on the chip,
+   * the driver and the bus go idle once the faults stop.
+
+   A third pass drives a PCAL6524 through the rest of the API: interrupt
+   masks, configure, subscriptions, debounce, storm protection, snapshot
+   restore, staged writes, sequences and the keypad scanner, with the input
+   pins and a small key matrix switched at random. On top of the above it
+   checks that
+
+   * masks and configure read back as the commands that completed set them,
+   * every subscription is called once for each edge it asked for, and
+     only while it is subscribed,
+   * a debounced pin is not reported again within its period,
+   * storms are detected and cleared in turn, and all clear at the end,
+   * a restore with verify only fails when an edge changed the mask,
+   * staged writes and the last frame of a sequence reach the outputs, and
+     a sequence calls back once,
+   * key events match the switches closed in the matrix.
+
+   One JSON object per pass is printed, with throughput and worst-case
+   latencies. The exit code is non-zero if an invariant was violated.
+
+   Usage: stress [operations [seed]]
+*/
+
+#include "gpio-pcal64/PCAL64.h"
+#include "sim/PCALModel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <deque>
+
+#define SDA     ((PinName) 1)
+#define SCL     ((PinName) 2)
+#define IRQ     ((PinName) 3)
+#define ADDRESS PCAL64::PRIMARY_ADDRESS
+
+/* port 0 is written by the test, port 1 is driven from outside */
+static const uint32_t OUTPUTS = 0x00FF;
+static const uint32_t INPUTS  = 0xFF00;
+
+static const uint16_t TIMEOUT = 2;
+
+/*****************************************************************************/
+/* Helpers                                                                   */
+/*****************************************************************************/
+
+static sim::I2CBus& bus(void)
+{
+    return sim::I2CBus::get(SDA, SCL);
+}
+
+static sim::time_ns_t now(void)
+{
+    return sim::EventLoop::get().now();
+}
+
+/* xorshift, the same seed gives the same run */
+static uint32_t randomState;
+
+static uint32_t random32(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+
+    return randomState;
+}
+
+static uint32_t randomBelow(uint32_t limit)
+{
+    return random32() % limit;
+}
+
+static uint64_t violations;
+
+#define VIOLATION(...)                                                      \
+    do {                                                                    \
+        if (violations++ < 10)                                              \
+        {                                                                   \
+            printf("violation at %llu ns: ", (unsigned long long) now());   \
+            printf(__VA_ARGS__);                                            \
+            printf("\n");                                                   \
+        }                                                                   \
+    } while (0)
+
+/*****************************************************************************/
+/* Reference model                                                           */
+/*****************************************************************************/
+
+typedef enum {
+    OP_WRITE,
+    OP_TOGGLE,
+    OP_READ,
+    OP_READ_STATUS,
+    OP_RESYNC,
+    OP_MASK,
+    OP_CONFIGURE,
+    OP_RESTORE
+} op_t;
+
+typedef struct {
+    op_t op;
+    uint32_t pins;
+    uint32_t values;
+    uint64_t mark;
+    sim::time_ns_t submitted;
+} command_t;
+
+static PCAL64* expander;
+static sim::PCALModel* chip;
+static bool shadow;
+
+/* accepted commands that have not ended yet, oldest first */
+static std::deque<command_t> outstanding;
+
+/* expected output register, valid for pins not in uncertain */
+static uint32_t expected;
+static uint32_t uncertain;
+static uint32_t resyncsPending;
+
+/* input levels as last reported to the interrupt handler */
+static uint32_t reported;
+static uint32_t edgePending;
+static sim::time_ns_t edgeTime[16];
+
+/* counters */
+static uint64_t issued;
+static uint64_t refused;
+static uint64_t completed;
+static uint64_t abandoned;
+static uint64_t interruptFailures;
+static uint64_t edges;
+static uint64_t irqs;
+static sim::time_ns_t commandLatencyMax;
+static sim::time_ns_t commandLatencySum;
+static sim::time_ns_t irqLatencyMax;
+
+static bool end(op_t op, command_t& command)
+{
+    if (outstanding.empty())
+    {
+        VIOLATION("command ended twice or was never issued");
+        return false;
+    }
+
+    command = outstanding.front();
+    outstanding.pop_front();
+
+    if (command.op != op)
+    {
+        VIOLATION("command %d ended in place of command %d", op, command.op);
+        return false;
+    }
+
+    sim::time_ns_t latency = now() - command.submitted;
+
+    commandLatencySum += latency;
+
+    if (latency > commandLatencyMax)
+    {
+        commandLatencyMax = latency;
+    }
+
+    return true;
+}
+
+static void checkRead(uint32_t values)
+{
+    uint32_t known = OUTPUTS & ~uncertain;
+
+    if ((values ^ expected) & known)
+    {
+        VIOLATION("read %04X, expected %04X on %04X", values, expected, known);
+    }
+}
+
+static void writeDone(void)
+{
+    command_t command;
+
+    if (end(OP_WRITE, command))
+    {
+        completed++;
+
+        expected = (expected & ~command.pins) | (command.values & command.pins);
+
+        /* with the shadow ahead of the device writes may be skipped */
+        if (resyncsPending == 0)
+        {
+            uncertain &= ~command.pins;
+        }
+    }
+}
+
+static void toggleDone(void)
+{
+    command_t command;
+
+    if (end(OP_TOGGLE, command))
+    {
+        completed++;
+
+        expected ^= command.pins;
+    }
+}
+
+static void readDone(uint32_t values)
+{
+    command_t command;
+
+    if (end(OP_READ, command))
+    {
+        completed++;
+
+        checkRead(values);
+    }
+}
+
+static void readStatusDone(uint32_t, uint32_t values)
+{
+    command_t command;
+
+    if (end(OP_READ_STATUS, command))
+    {
+        completed++;
+
+        checkRead(values);
+    }
+}
+
+static void resyncDone(void)
+{
+    command_t command;
+
+    if (end(OP_RESYNC, command))
+    {
+        completed++;
+        resyncsPending--;
+    }
+}
+
+static void track(bool result, op_t op, uint32_t pins, uint32_t values, uint64_t mark = 0)
+{
+    issued++;
+
+    if (result)
+    {
+        command_t command;
+        command.op = op;
+        command.pins = pins;
+        command.values = values;
+        command.mark = mark;
+        command.submitted = now();
+
+        outstanding.push_back(command);
+    }
+    else
+    {
+        refused++;
+    }
+}
+
+static void submit(op_t op, uint32_t pins, uint32_t values)
+{
+    bool result = false;
+
+    switch (op)
+    {
+        case OP_WRITE:
+            result = expander->bulkWrite(pins, pins, values, writeDone);
+            break;
+        case OP_TOGGLE:
+            result = expander->bulkToggle(pins, toggleDone);
+            break;
+        case OP_READ:
+            result = expander->bulkRead(readDone);
+            break;
+        case OP_READ_STATUS:
+            result = expander->bulkReadWithStatus(readStatusDone);
+            break;
+        case OP_RESYNC:
+            result = expander->resyncShadowRegisters(resyncDone);
+            break;
+        default:
+            break;
+    }
+
+    track(result, op, pins, values);
+}
+
+static void errorHandler(uint16_t, PCAL64::failure_t failure)
+{
+    if (failure == PCAL64::FAILURE_INTERRUPT)
+    {
+        interruptFailures++;
+        return;
+    }
+
+    if (outstanding.empty())
+    {
+        VIOLATION("error without a command");
+        return;
+    }
+
+    command_t command = outstanding.front();
+    outstanding.pop_front();
+
+    abandoned++;
+
+    if (command.op == OP_RESYNC)
+    {
+        resyncsPending--;
+    }
+
+    /* the device may hold the old values, the new ones or a mix */
+    if ((command.op == OP_WRITE) || (command.op == OP_TOGGLE))
+    {
+        uncertain |= command.pins;
+    }
+
+    if (shadow)
+    {
+        uncertain |= OUTPUTS;
+
+        resyncsPending++;
+        submit(OP_RESYNC, 0, 0);
+    }
+}
+
+static void irqHandler(uint16_t, uint32_t pins, uint32_t values)
+{
+    irqs++;
+
+    pins &= INPUTS;
+
+    uint32_t levels = chip->levels();
+
+    for (uint8_t pin = 8; pin < 16; pin++)
+    {
+        uint32_t mask = 1UL << pin;
+
+        if ((pins & mask) && (edgePending & mask) && ((values & mask) == (levels & mask)))
+        {
+            sim::time_ns_t latency = now() - edgeTime[pin];
+
+            if (latency > irqLatencyMax)
+            {
+                irqLatencyMax = latency;
+            }
+
+            edgePending &= ~mask;
+        }
+    }
+
+    reported = (reported & ~pins) | (values & pins);
+}
+
+static void toggleInput(void)
+{
+    uint8_t pin = 8 + randomBelow(8);
+    uint32_t mask = 1UL << pin;
+    uint32_t level = chip->levels() & mask;
+
+    chip->drive(mask, level ^ mask);
+
+    edges++;
+
+    if (!(edgePending & mask))
+    {
+        edgePending |= mask;
+        edgeTime[pin] = now();
+    }
+}
+
+static void injectFault(void)
+{
+    uint32_t kind = randomBelow(10);
+
+    if (kind < 5)
+    {
+        bus().refuse();
+    }
+    else if (kind < 9)
+    {
+        /* mostly inside the timeout, sometimes late enough to be abandoned */
+        bus().stretch(randomBelow(3 * TIMEOUT * sim::NS_PER_MS));
+    }
+    else
+    {
+        bus().hang();
+    }
+}
+
+/*****************************************************************************/
+/* Pass                                                                      */
+/*****************************************************************************/
+
+static void pass(uint64_t operations, uint32_t seed, bool _shadow)
+{
+    sim::reset();
+    bus().forceClock(400000);
+
+    randomState = seed ? seed : 1;
+    shadow = _shadow;
+    violations = 0;
+
+    sim::PCALModel model(sim::PCAL6416A_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64Bus shared(SDA, SCL);
+    PCAL64 device(shared, ADDRESS, IRQ);
+
+    chip = &model;
+    expander = &device;
+
+    outstanding.clear();
+    expected = 0;
+    uncertain = 0;
+    resyncsPending = 0;
+    issued = refused = completed = abandoned = interruptFailures = 0;
+    edges = irqs = 0;
+    commandLatencyMax = commandLatencySum = irqLatencyMax = 0;
+    edgePending = 0;
+
+    /* fault free start: outputs low, interrupts on the inputs */
+    shared.setTimeout(TIMEOUT);
+    device.setRetryPolicy(2, 0);
+    device.setErrorHandler(errorHandler);
+    device.setInterruptHandler(irqHandler);
+
+    device.bulkWrite(OUTPUTS, OUTPUTS, 0, FunctionPointer0<void>());
+    device.bulkSetInterrupt(INPUTS, INPUTS, FunctionPointer0<void>());
+
+    if (shadow)
+    {
+        device.enableShadowRegisters(FunctionPointer0<void>());
+    }
+
+    sim::EventLoop::get().runUntilIdle();
+
+    reported = model.levels() & INPUTS;
+
+    clock_t wallStart = clock();
+    sim::time_ns_t simStart = now();
+
+    for (uint64_t operation = 0; operation < operations; operation++)
+    {
+        sim::EventLoop::get().runUntil(now() + randomBelow(400) * sim::NS_PER_US);
+
+        uint32_t action = randomBelow(1000);
+
+        if (action < 400)
+        {
+            toggleInput();
+        }
+        else if (action < 550)
+        {
+            uint32_t pins = random32() & OUTPUTS;
+            submit(OP_WRITE, pins ? pins : 1, random32());
+        }
+        else if (action < 650)
+        {
+            uint32_t pins = random32() & OUTPUTS;
+            submit(OP_TOGGLE, pins ? pins : 1, 0);
+        }
+        else if (action < 850)
+        {
+            submit(OP_READ, 0, 0);
+        }
+        else if (action < 990)
+        {
+            submit(OP_READ_STATUS, 0, 0);
+        }
+        else
+        {
+            injectFault();
+        }
+    }
+
+    /* Settle. A fault armed last may still catch one transfer, retries
+       and timeouts end it within a bounded time.
+    */
+    sim::time_ns_t settleStart = now();
+
+    if (!sim::EventLoop::get().runUntilIdle(now() + 1000 * sim::NS_PER_MS))
+    {
+        VIOLATION("driver did not go idle");
+    }
+
+    sim::time_ns_t settle = now() - settleStart;
+
+    if (!outstanding.empty())
+    {
+        VIOLATION("%u commands never ended", (unsigned) outstanding.size());
+    }
+
+    if (bus().busy() || (sim::pendingCallbacks() != 0))
+    {
+        VIOLATION("bus busy or callbacks left after settling");
+    }
+
+    if (!sim::Net::get(SDA).read())
+    {
+        VIOLATION("SDA held low");
+    }
+
+    /* lost edges: every input level has been reported */
+    uint32_t levels = model.levels() & INPUTS;
+
+    if (levels != reported)
+    {
+        VIOLATION("inputs at %04X, last reported %04X", levels, reported);
+    }
+
+    /* final register contents */
+    uint32_t known = OUTPUTS & ~uncertain;
+
+    if ((model.peekBank(0x02) ^ expected) & known)
+    {
+        VIOLATION("output register %04X, expected %04X on %04X",
+                  (unsigned) model.peekBank(0x02), expected, known);
+    }
+
+    if ((model.peekBank(0x06) & OUTPUTS) != 0)
+    {
+        VIOLATION("output pins configured as inputs: %04X", (unsigned) model.peekBank(0x06));
+    }
+
+    if ((model.peekBank(0x4A) & INPUTS) != 0)
+    {
+        VIOLATION("input interrupts masked: %04X", (unsigned) model.peekBank(0x4A));
+    }
+
+    /* and the driver still works */
+    submit(OP_READ, 0, 0);
+    sim::EventLoop::get().runUntilIdle();
+
+    if (!outstanding.empty())
+    {
+        VIOLATION("final read did not complete");
+    }
+
+    double wall = (double) (clock() - wallStart) / CLOCKS_PER_SEC;
+    double simulated = (double) (settleStart - simStart) / 1e9;
+    uint64_t ended = completed + abandoned;
+
+    PCAL64::statistics_t statistics;
+    device.getStatistics(statistics);
+
+    printf("{\"stress\":\"random\",\"shadow\":%s,\"seed\":%u,\"operations\":%llu",
+           shadow ? "true" : "false", seed, (unsigned long long) operations);
+    printf(",\"commands\":%llu,\"refused\":%llu,\"completed\":%llu,\"abandoned\":%llu",
+           (unsigned long long) issued, (unsigned long long) refused,
+           (unsigned long long) completed, (unsigned long long) abandoned);
+    printf(",\"retries\":%u,\"timeouts\":%u,\"stale\":%u,\"irq_failures\":%llu",
+           (unsigned) statistics.retries, (unsigned) shared.getTimeouts(),
+           (unsigned) shared.getStaleCompletions(), (unsigned long long) interruptFailures);
+    printf(",\"edges\":%llu,\"irqs\":%llu,\"transactions\":%llu",
+           (unsigned long long) edges, (unsigned long long) irqs,
+           (unsigned long long) bus().counters().transactions);
+    printf(",\"commands_per_s\":%.0f,\"wall_operations_per_s\":%.0f",
+           simulated > 0 ? ended / simulated : 0.0, wall > 0 ? operations / wall : 0.0);
+    printf(",\"command_latency_avg_us\":%.1f,\"command_latency_max_us\":%.1f",
+           ended ? (double) commandLatencySum / ended / 1000 : 0.0, (double) commandLatencyMax / 1000);
+    printf(",\"irq_latency_max_us\":%.1f,\"settle_us\":%.1f,\"violations\":%llu}\n",
+           (double) irqLatencyMax / 1000, (double) settle / 1000, (unsigned long long) violations);
+}
+
+/*****************************************************************************/
+/* Feature pass                                                              */
+/*****************************************************************************/
+
+/* A 24-pin part with every feature in use. Port 0 is written by commands,
+   staged writes and sequences, port 1 is driven from outside with the same
+   pins as INPUTS, port 2 is a 4x4 key matrix.
+*/
+static const uint32_t WRITTEN   = 0x00000F;
+static const uint32_t STAGED    = 0x000030;
+static const uint32_t SEQUENCED = 0x0000C0;
+static const uint32_t DRIVEN    = 0x00FF00;
+static const uint32_t ROWS      = 0x0F0000;
+static const uint32_t COLUMNS   = 0xF00000;
+
+static const uint8_t PINS = 24;
+static const uint8_t FIRST_DRIVEN = 8;
+static const uint8_t FIRST_ROW = 16;
+static const uint8_t FIRST_COLUMN = 20;
+static const uint8_t KEYS = 4;
+
+static const uint16_t STORM_WINDOW = 10;
+static const uint16_t STORM_POLL = 2;
+static const uint16_t KEYPAD_PERIOD = 5;
+
+/* with faults this far apart every command gets through on a retry */
+static const sim::time_ns_t FAULT_SPACING = 20 * sim::NS_PER_MS;
+
+/* an edge this recent may still be serviced while a restore runs */
+static const sim::time_ns_t QUIET = 5 * sim::NS_PER_MS;
+
+/* debounced reports may come this much early, timers run in microseconds */
+static const sim::time_ns_t DEBOUNCE_SLACK = 100 * sim::NS_PER_US;
+
+static PCAL6524* wide;
+static PCAL6524::snapshot_t baseline;
+
+static sim::time_ns_t lastFault;
+static uint64_t disturbances;
+static sim::time_ns_t lastDisturbance;
+
+/* orders callbacks posted at the same time */
+static uint64_t ticket;
+
+/* interrupt enables as the completed commands left them */
+static uint32_t enabled;
+
+/* pins whose level may have changed while masked, until reported again */
+static uint32_t dirty;
+
+/* pins reported at least once, the driver compares against the same level */
+static uint32_t reportedValid;
+static uint32_t lastIrqPins;
+static sim::time_ns_t lastIrq;
+
+/* debounce periods as set, and when the pin's debouncing last changed */
+static uint16_t debouncePeriod[PINS];
+static sim::time_ns_t debounceSince[PINS];
+static sim::time_ns_t lastReport[PINS];
+
+/* pins polled as the storm callbacks tell, and pins whose polling a
+   command may end without a report
+*/
+static uint32_t stormState;
+static uint32_t stormReset;
+
+/* pull and drive settings of port 0 */
+typedef struct {
+    uint16_t drive;
+    uint8_t latch;
+    uint8_t pullEnable;
+    uint8_t pullSelection;
+} port_config_t;
+
+static const uint8_t CONFIG_SLOTS = 4;
+
+/* the driver does not copy a config, each stays in its slot until done */
+static PCAL6524::Config configs[CONFIG_SLOTS];
+static port_config_t configMask[CONFIG_SLOTS];
+static port_config_t configValue[CONFIG_SLOTS];
+static bool configBusy[CONFIG_SLOTS];
+
+static port_config_t configModel;
+static port_config_t baselineConfig;
+
+class Subscriber
+{
+public:
+    void changed(uint8_t pin, PCAL6524::edge_t edge);
+
+    int8_t handle;
+    uint8_t pin;
+    uint8_t edge;
+    uint8_t awaiting;           // edge due from the event being delivered
+    sim::time_ns_t since;
+    bool live;
+};
+
+/* one spare, to see that a full table refuses */
+static const uint8_t SUBSCRIBERS = YOTTA_CFG_GPIO_PCAL64_SUBSCRIPTIONS;
+
+static Subscriber subscribers[SUBSCRIBERS + 1];
+static uint8_t subscribed;
+
+static const uint8_t FRAMES = 4;
+static const uint8_t PLAYERS = 8;
+
+class Player
+{
+public:
+    Player(void) : sequence(steps, FRAMES) {}
+
+    void done(void);
+
+    PCAL6524::Sequence::step_t steps[FRAMES];
+    PCAL6524::Sequence sequence;
+    uint32_t last;              // values of the last frame
+    bool loop;
+    uint32_t calls;
+    uint64_t finished;          // ticket of the callback
+};
+
+/* a superseded player keeps its slot until its callback has surely run */
+static Player players[PLAYERS];
+static uint8_t playerNext;
+static Player* playing;
+
+/* ticket of the last restore, it writes the sequence pins low */
+static uint64_t restored;
+
+static uint32_t stagedValues;
+static bool stagedValid;
+
+/* closed switches and keys down as reported, bit row * KEYS + column */
+static uint16_t switches;
+static uint16_t keysDown;
+static bool keypadRunning;
+static bool keypadTrusted;      // started with every switch open
+static sim::time_ns_t keypadStopped;
+
+/* counters */
+static uint64_t subscriptionCalls;
+static uint64_t debounceChecks;
+static uint64_t storms;
+static uint64_t keyEvents;
+static uint64_t plays;
+static uint64_t restores;
+static uint64_t restoreMismatches;
+
+static port_config_t chipConfig(void)
+{
+    const sim::pcal_layout_t& layout = chip->getLayout();
+
+    port_config_t config;
+    config.drive = chip->peek(layout.driveStrength) | (chip->peek(layout.driveStrength + 1) << 8);
+    config.latch = chip->peek(layout.inputLatch);
+    config.pullEnable = chip->peek(layout.pullEnable);
+    config.pullSelection = chip->peek(layout.pullSelection);
+
+    return config;
+}
+
+static bool sameConfig(const port_config_t& first, const port_config_t& second)
+{
+    return (first.drive == second.drive) &&
+           (first.latch == second.latch) &&
+           (first.pullEnable == second.pullEnable) &&
+           (first.pullSelection == second.pullSelection);
+}
+
+static bool pending(op_t op)
+{
+    for (std::deque<command_t>::const_iterator command = outstanding.begin();
+         command != outstanding.end();
+         ++command)
+    {
+        if (command->op == op)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* interrupt pins that commands still outstanding will set */
+static uint32_t pendingMasks(void)
+{
+    uint32_t pins = 0;
+
+    for (std::deque<command_t>::const_iterator command = outstanding.begin();
+         command != outstanding.end();
+         ++command)
+    {
+        if (command->op == OP_MASK)
+        {
+            pins |= command->pins;
+        }
+        else if (command->op == OP_RESTORE)
+        {
+            pins |= DRIVEN;
+        }
+    }
+
+    return pins;
+}
+
+static void disturb(void)
+{
+    disturbances++;
+    lastDisturbance = now();
+}
+
+static void readFeatureDone(uint32_t values)
+{
+    command_t command;
+
+    if (end(OP_READ, command))
+    {
+        completed++;
+
+        if ((values ^ expected) & WRITTEN)
+        {
+            VIOLATION("read %06X, expected %06X on %06X", values, expected, WRITTEN);
+        }
+    }
+}
+
+static void maskDone(void)
+{
+    command_t command;
+
+    if (!end(OP_MASK, command))
+    {
+        return;
+    }
+
+    completed++;
+
+    enabled = (enabled & ~command.pins) | (command.values & command.pins);
+    dirty |= command.pins & ~command.values;
+
+    /* debounce, storm polling and later commands may mask more, never less */
+    uint32_t masked = chip->peekBank(chip->getLayout().interruptMask);
+    uint32_t disabled = DRIVEN & ~enabled & ~pendingMasks();
+
+    if (disabled & ~masked)
+    {
+        VIOLATION("interrupts disabled on %06X, mask %06X", disabled, masked);
+    }
+}
+
+static void configDone(void)
+{
+    command_t command;
+
+    if (!end(OP_CONFIGURE, command))
+    {
+        return;
+    }
+
+    completed++;
+
+    uint8_t slot = command.values;
+    const port_config_t& mask = configMask[slot];
+    const port_config_t& value = configValue[slot];
+
+    configBusy[slot] = false;
+
+    configModel.drive = (configModel.drive & ~mask.drive) | (value.drive & mask.drive);
+    configModel.latch = (configModel.latch & ~mask.latch) | (value.latch & mask.latch);
+    configModel.pullEnable = (configModel.pullEnable & ~mask.pullEnable) | (value.pullEnable & mask.pullEnable);
+    configModel.pullSelection = (configModel.pullSelection & ~mask.pullSelection) | (value.pullSelection & mask.pullSelection);
+
+    if (!pending(OP_CONFIGURE) && !pending(OP_RESTORE) && !sameConfig(chipConfig(), configModel))
+    {
+        VIOLATION("port 0 configuration differs from the configures that completed");
+    }
+}
+
+static void restoreDone(bool match)
+{
+    command_t command;
+
+    if (!end(OP_RESTORE, command))
+    {
+        return;
+    }
+
+    completed++;
+    restores++;
+
+    /* read back differs only if interrupt service masked a pin in between */
+    if (!match)
+    {
+        restoreMismatches++;
+
+        if (!command.values)
+        {
+            VIOLATION("restore without verify failed");
+        }
+        else if (command.mark == disturbances)
+        {
+            VIOLATION("restore read back changed with no edge since %llu ns",
+                      (unsigned long long) command.submitted);
+        }
+    }
+
+    /* the baseline: outputs low, every driven pin interrupting */
+    expected = 0;
+    dirty |= DRIVEN & ~enabled;
+    enabled = DRIVEN;
+    configModel = baselineConfig;
+    restored = ++ticket;
+}
+
+static void featureErrorHandler(uint16_t, PCAL6524::failure_t failure)
+{
+    if (failure == PCAL6524::FAILURE_INTERRUPT)
+    {
+        interruptFailures++;
+        return;
+    }
+
+    abandoned++;
+
+    VIOLATION("failure %d although every fault is retried", failure);
+}
+
+/* the calls due from the event delivered last have all been made */
+static void awaitSubscriptions(void)
+{
+    for (uint8_t index = 0; index <= SUBSCRIBERS; index++)
+    {
+        Subscriber& subscriber = subscribers[index];
+
+        if (subscriber.awaiting)
+        {
+            VIOLATION("subscription %d missed edge %u on pin %u",
+                      subscriber.handle, subscriber.awaiting, subscriber.pin);
+
+            subscriber.awaiting = 0;
+        }
+    }
+}
+
+void Subscriber::changed(uint8_t _pin, PCAL6524::edge_t _edge)
+{
+    subscriptionCalls++;
+
+    if (!live)
+    {
+        VIOLATION("call for removed subscription %d", handle);
+    }
+    else if ((_pin != pin) || !(_edge & edge))
+    {
+        VIOLATION("subscription %d to edge %u on pin %u called for edge %u on pin %u",
+                  handle, edge, pin, _edge, _pin);
+    }
+    else if (!(lastIrqPins & (1UL << _pin)))
+    {
+        VIOLATION("edge on pin %u outside the reported event", _pin);
+    }
+
+    if (awaiting == _edge)
+    {
+        awaiting = 0;
+    }
+}
+
+static void featureIrqHandler(uint16_t, uint32_t pins, uint32_t values)
+{
+    irqs++;
+
+    awaitSubscriptions();
+
+    pins &= DRIVEN;
+
+    for (uint32_t remaining = pins; remaining; remaining &= remaining - 1)
+    {
+        uint8_t pin = __builtin_ctz(remaining);
+        uint32_t mask = 1UL << pin;
+
+        /* a debounced pin is reported once per period at most */
+        if (debouncePeriod[pin] && !(stormState & mask) && (lastReport[pin] > debounceSince[pin]))
+        {
+            debounceChecks++;
+
+            if (now() - lastReport[pin] + DEBOUNCE_SLACK < debouncePeriod[pin] * sim::NS_PER_MS)
+            {
+                VIOLATION("pin %u reported after %llu ns, debounced for %u ms", pin,
+                          (unsigned long long) (now() - lastReport[pin]), debouncePeriod[pin]);
+            }
+        }
+
+        lastReport[pin] = now();
+
+        /* subscribed before the previous event was delivered, so before
+           this one was captured: the edge is due
+        */
+        if ((reportedValid & mask) && ((values ^ reported) & mask))
+        {
+            uint8_t edge = (values & mask) ? PCAL6524::EDGE_RISING : PCAL6524::EDGE_FALLING;
+
+            for (uint8_t index = 0; index <= SUBSCRIBERS; index++)
+            {
+                Subscriber& subscriber = subscribers[index];
+
+                if (subscriber.live && (subscriber.pin == pin) &&
+                    (subscriber.edge & edge) && (subscriber.since < lastIrq))
+                {
+                    subscriber.awaiting = edge;
+                }
+            }
+        }
+    }
+
+    dirty &= ~pins;
+    reported = (reported & ~pins) | (values & pins);
+    reportedValid |= pins;
+    lastIrqPins = pins;
+    lastIrq = now();
+}
+
+static void stormHandler(uint16_t, PCAL6524::storm_t transition, uint32_t pins)
+{
+    for (uint32_t remaining = pins; remaining; remaining &= remaining - 1)
+    {
+        uint8_t pin = __builtin_ctz(remaining);
+        uint32_t mask = 1UL << pin;
+
+        if (transition == PCAL6524::STORM_DETECTED)
+        {
+            storms++;
+
+            if ((stormState & mask) && !(stormReset & mask))
+            {
+                VIOLATION("storm on pin %u detected twice", pin);
+            }
+
+            /* a mask command still queued may end this storm too */
+            stormState |= mask;
+            stormReset &= ~(mask & ~pendingMasks());
+        }
+        else
+        {
+            if (!(stormState & mask))
+            {
+                VIOLATION("storm on pin %u cleared while not detected", pin);
+            }
+
+            stormState &= ~mask;
+        }
+
+        /* reports while polled are not debounced */
+        debounceSince[pin] = now();
+    }
+}
+
+static void keyHandler(uint8_t row, uint8_t column, PCAL6524::keypad_event_t event)
+{
+    keyEvents++;
+
+    if (!keypadRunning || (event == PCAL6524::KEY_GHOSTING))
+    {
+        return;
+    }
+
+    if ((row >= KEYS) || (column >= KEYS))
+    {
+        VIOLATION("key %u,%u outside the matrix", row, column);
+        return;
+    }
+
+    uint16_t key = 1 << (row * KEYS + column);
+
+    if (event == PCAL6524::KEY_DOWN)
+    {
+        if (keysDown & key)
+        {
+            VIOLATION("key %u,%u down twice", row, column);
+        }
+
+        keysDown |= key;
+    }
+    else
+    {
+        if (!(keysDown & key))
+        {
+            VIOLATION("key %u,%u up while not down", row, column);
+        }
+
+        keysDown &= ~key;
+    }
+}
+
+void Player::done(void)
+{
+    calls++;
+
+    if (loop)
+    {
+        VIOLATION("looping sequence called back");
+    }
+    else if (calls > 1)
+    {
+        VIOLATION("sequence called back %u times", calls);
+    }
+
+    finished = ++ticket;
+}
+
+/*****************************************************************************/
+/* Feature operations                                                        */
+/*****************************************************************************/
+
+static void burstInput(void)
+{
+    uint8_t pin = FIRST_DRIVEN + randomBelow(8);
+    uint32_t mask = 1UL << pin;
+
+    /* well above the storm limit within a window */
+    for (uint32_t count = 6 + randomBelow(7); count > 0; count--)
+    {
+        chip->drive(mask, (chip->levels() & mask) ^ mask);
+
+        edges++;
+        disturb();
+
+        sim::EventLoop::get().runUntil(now() + (150 + randomBelow(150)) * sim::NS_PER_US);
+    }
+}
+
+static void toggleKey(void)
+{
+    uint8_t row = randomBelow(KEYS);
+    uint8_t column = randomBelow(KEYS);
+    uint16_t key = 1 << (row * KEYS + column);
+
+    /* three keys are enough for ghosting */
+    if (!(switches & key) && (__builtin_popcount(switches) >= 3))
+    {
+        return;
+    }
+
+    switches ^= key;
+    chip->setSwitch(FIRST_ROW + row, FIRST_COLUMN + column, switches & key);
+
+    disturb();
+}
+
+static void setMask(void)
+{
+    uint32_t pins = (1UL << (FIRST_DRIVEN + randomBelow(8))) | (random32() & random32() & DRIVEN);
+    uint32_t values = random32() | random32();
+
+    /* the command ends debouncing and polling on its pins */
+    for (uint32_t remaining = pins; remaining; remaining &= remaining - 1)
+    {
+        debounceSince[__builtin_ctz(remaining)] = now();
+    }
+
+    stormReset |= pins;
+    dirty |= pins & ~values;
+
+    track(wide->bulkSetInterrupt(pins, values, maskDone), OP_MASK, pins, values & pins);
+}
+
+static void configurePort(void)
+{
+    uint8_t slot = 0;
+
+    while ((slot < CONFIG_SLOTS) && configBusy[slot])
+    {
+        slot++;
+    }
+
+    if (slot == CONFIG_SLOTS)
+    {
+        return;
+    }
+
+    PCAL6524::Config& config = configs[slot] = PCAL6524::Config();
+    port_config_t& mask = configMask[slot];
+    port_config_t& value = configValue[slot];
+
+    memset(&mask, 0, sizeof(mask));
+    memset(&value, 0, sizeof(value));
+
+    for (uint32_t settings = 1 + randomBelow(2); settings > 0; settings--)
+    {
+        uint8_t pins = 1 + randomBelow(255);
+
+        switch (randomBelow(3))
+        {
+            case 0:
+                {
+                    uint8_t strength = randomBelow(4);
+
+                    config.drive(pins, (PCAL6524::drive_t) strength);
+
+                    for (uint8_t pin = 0; pin < 8; pin++)
+                    {
+                        if ((pins >> pin) & 1)
+                        {
+                            mask.drive |= 3 << (2 * pin);
+                            value.drive = (value.drive & ~(3 << (2 * pin))) | (strength << (2 * pin));
+                        }
+                    }
+                }
+                break;
+
+            case 1:
+                {
+                    PCAL6524::pull_t pull = (PCAL6524::pull_t) randomBelow(3);
+
+                    config.pull(pins, pull);
+
+                    mask.pullEnable |= pins;
+                    value.pullEnable = (pull == PCAL6524::PULL_NONE) ? (value.pullEnable & ~pins) : (value.pullEnable | pins);
+
+                    if (pull != PCAL6524::PULL_NONE)
+                    {
+                        mask.pullSelection |= pins;
+                        value.pullSelection = (pull == PCAL6524::PULL_UP) ? (value.pullSelection | pins) : (value.pullSelection & ~pins);
+                    }
+                }
+                break;
+
+            default:
+                {
+                    /* not on the pins that are read back */
+                    bool enable = random32() & 1;
+
+                    pins &= ~WRITTEN;
+
+                    config.latch(pins, enable);
+
+                    mask.latch |= pins;
+                    value.latch = enable ? (value.latch | pins) : (value.latch & ~pins);
+                }
+                break;
+        }
+    }
+
+    bool result = wide->configure(config, configDone);
+
+    configBusy[slot] = result;
+
+    track(result, OP_CONFIGURE, 0, slot);
+}
+
+static void toggleSubscription(void)
+{
+    if (subscribed && (random32() & 1))
+    {
+        uint8_t skip = randomBelow(subscribed);
+
+        for (uint8_t index = 0; index <= SUBSCRIBERS; index++)
+        {
+            Subscriber& subscriber = subscribers[index];
+
+            if (subscriber.live && (skip-- == 0))
+            {
+                wide->unsubscribe(subscriber.handle);
+
+                subscriber.live = false;
+                subscribed--;
+                break;
+            }
+        }
+
+        return;
+    }
+
+    Subscriber* subscriber = subscribers;
+
+    while (subscriber->live)
+    {
+        subscriber++;
+    }
+
+    uint8_t pin = FIRST_DRIVEN + randomBelow(8);
+    PCAL6524::edge_t edge = (PCAL6524::edge_t) (1 + randomBelow(3));
+
+    int8_t handle = wide->subscribe(pin, edge, PCAL6524::PinCallback_t(subscriber, &Subscriber::changed));
+
+    if ((handle < 0) != (subscribed == SUBSCRIBERS))
+    {
+        VIOLATION("subscribe returned %d with %u of %u entries in use", handle, subscribed, SUBSCRIBERS);
+    }
+
+    if (handle >= 0)
+    {
+        subscriber->handle = handle;
+        subscriber->pin = pin;
+        subscriber->edge = edge;
+        subscriber->awaiting = 0;
+        subscriber->since = now();
+        subscriber->live = true;
+
+        subscribed++;
+    }
+}
+
+static void setDebounce(void)
+{
+    uint8_t pin = FIRST_DRIVEN + randomBelow(8);
+    uint16_t period = randomBelow(3) ? 2 + randomBelow(5) : 0;
+
+    wide->setDebounce(1UL << pin, period);
+
+    debouncePeriod[pin] = period;
+    debounceSince[pin] = now();
+}
+
+static void setStormLimit(void)
+{
+    static const uint16_t limits[] = { 0, 4, 6, 8 };
+
+    wide->setStormProtection(limits[randomBelow(4)], STORM_WINDOW, STORM_POLL, stormHandler);
+}
+
+static void restore(void)
+{
+    bool verify = random32() & 1;
+
+    /* never equal to the count at completion if an edge may interfere */
+    uint64_t mark = (now() - lastDisturbance > QUIET) ? disturbances : ~(uint64_t) 0;
+
+    /* a staged write still waiting may go out after the restore */
+    stagedValid = false;
+
+    for (uint8_t pin = FIRST_DRIVEN; pin < FIRST_DRIVEN + 8; pin++)
+    {
+        debounceSince[pin] = now();
+    }
+
+    track(wide->restoreSnapshot(baseline, verify, restoreDone), OP_RESTORE, 0, verify, mark);
+}
+
+static void stage(void)
+{
+    uint32_t pins = (random32() & 1) ? STAGED : ((random32() & STAGED) | 0x10);
+    uint32_t values = random32();
+
+    wide->stageWrite(pins, values);
+
+    stagedValues = (stagedValues & ~pins) | (values & pins);
+    stagedValid |= (pins == STAGED);
+}
+
+static void play(void)
+{
+    if (playing && (randomBelow(4) == 0))
+    {
+        wide->stopSequence();
+        playing = NULL;
+        return;
+    }
+
+    Player& player = players[playerNext];
+    playerNext = (playerNext + 1) % PLAYERS;
+
+    PCAL6524::Sequence::frame_t frames[FRAMES];
+    uint16_t count = 1 + randomBelow(FRAMES);
+
+    for (uint16_t frame = 0; frame < count; frame++)
+    {
+        frames[frame].delay = 1 + randomBelow(3);
+        frames[frame].values = random32() & SEQUENCED;
+    }
+
+    player.sequence.prepare(frames, count, SEQUENCED);
+    player.last = frames[count - 1].values;
+    player.loop = (randomBelow(4) == 0);
+    player.calls = 0;
+    player.finished = 0;
+
+    if (!wide->playSequence(player.sequence, player.loop, FunctionPointer0<void>(&player, &Player::done)))
+    {
+        VIOLATION("sequence refused with the shadow enabled");
+        return;
+    }
+
+    playing = &player;
+    plays++;
+}
+
+static void toggleKeypad(void)
+{
+    if (keypadRunning)
+    {
+        wide->stopKeypad();
+
+        keypadRunning = false;
+        keypadStopped = now();
+    }
+    else if (now() - keypadStopped >= sim::NS_PER_MS)
+    {
+        /* events posted before the stop have been delivered */
+        keysDown = 0;
+        keypadTrusted = (switches == 0);
+
+        /* the columns command ends polling on the columns */
+        stormReset |= COLUMNS;
+
+        keypadRunning = wide->startKeypad(ROWS, COLUMNS, KEYPAD_PERIOD, keyHandler);
+    }
+}
+
+static void featurePass(uint64_t operations, uint32_t seed)
+{
+    sim::reset();
+    bus().forceClock(400000);
+
+    randomState = seed ? seed : 1;
+    shadow = true;
+    violations = 0;
+
+    sim::PCALModel model(sim::PCAL6524_LAYOUT, SDA, SCL, ADDRESS, IRQ);
+    PCAL64Bus shared(SDA, SCL);
+    PCAL6524 device(shared, ADDRESS, IRQ);
+    sim::EventLoop& loop = sim::EventLoop::get();
+
+    chip = &model;
+    wide = &device;
+
+    outstanding.clear();
+    expected = 0;
+    uncertain = 0;
+    resyncsPending = 0;
+    issued = refused = completed = abandoned = interruptFailures = 0;
+    edges = irqs = 0;
+    commandLatencyMax = commandLatencySum = irqLatencyMax = 0;
+    edgePending = 0;
+
+    lastFault = lastDisturbance = lastIrq = 0;
+    disturbances = ticket = restored = 0;
+    dirty = reportedValid = lastIrqPins = 0;
+    stormState = stormReset = 0;
+    subscribed = 0;
+    playing = NULL;
+    playerNext = 0;
+    stagedValues = 0;
+    stagedValid = true;
+    switches = keysDown = 0;
+    keypadTrusted = true;
+    keypadStopped = 0;
+    subscriptionCalls = debounceChecks = storms = keyEvents = plays = 0;
+    restores = restoreMismatches = 0;
+
+    memset(debouncePeriod, 0, sizeof(debouncePeriod));
+    memset(debounceSince, 0, sizeof(debounceSince));
+    memset(lastReport, 0, sizeof(lastReport));
+    memset(configBusy, 0, sizeof(configBusy));
+    memset(subscribers, 0, sizeof(subscribers));
+
+    /* fault free start: port 0 low, interrupts on the driven pins, pull-ups
+       on the columns, then the baseline for the restores
+    */
+    shared.setTimeout(TIMEOUT);
+    device.setRetryPolicy(3, 0);
+    device.setErrorHandler(featureErrorHandler);
+    device.setInterruptHandler(featureIrqHandler);
+    device.setStormProtection(6, STORM_WINDOW, STORM_POLL, stormHandler);
+
+    PCAL6524::Config pullUps;
+    pullUps.pull(COLUMNS, PCAL6524::PULL_UP);
+
+    device.enableShadowRegisters(FunctionPointer0<void>());
+    device.bulkWrite(WRITTEN | STAGED | SEQUENCED, WRITTEN | STAGED | SEQUENCED, 0, FunctionPointer0<void>());
+    device.bulkSetInterrupt(DRIVEN, DRIVEN, FunctionPointer0<void>());
+    device.configure(pullUps, FunctionPointer0<void>());
+    loop.runUntilIdle();
+
+    keypadRunning = device.startKeypad(ROWS, COLUMNS, KEYPAD_PERIOD, keyHandler);
+    loop.runUntilIdle();
+
+    if (!keypadRunning || !device.exportSnapshot(baseline))
+    {
+        VIOLATION("feature setup failed");
+    }
+
+    enabled = DRIVEN;
+    reported = model.levels() & DRIVEN;
+    baselineConfig = configModel = chipConfig();
+
+    clock_t wallStart = clock();
+
+    for (uint64_t operation = 0; operation < operations; operation++)
+    {
+        loop.runUntil(now() + randomBelow(400) * sim::NS_PER_US);
+
+        uint32_t action = randomBelow(1000);
+
+        if (action < 350)
+        {
+            toggleInput();
+            disturb();
+        }
+        else if (action < 355)
+        {
+            burstInput();
+        }
+        else if (action < 385)
+        {
+            toggleKey();
+        }
+        else if (action < 475)
+        {
+            uint32_t pins = random32() & WRITTEN;
+            uint32_t values = random32();
+
+            track(device.bulkWrite(pins ? pins : 1, pins ? pins : 1, values, writeDone),
+                  OP_WRITE, pins ? pins : 1, values);
+        }
+        else if (action < 535)
+        {
+            uint32_t pins = random32() & WRITTEN;
+
+            track(device.bulkToggle(pins ? pins : 1, toggleDone), OP_TOGGLE, pins ? pins : 1, 0);
+        }
+        else if (action < 635)
+        {
+            track(device.bulkRead(readFeatureDone), OP_READ, 0, 0);
+        }
+        else if (action < 685)
+        {
+            setMask();
+        }
+        else if (action < 715)
+        {
+            configurePort();
+        }
+        else if (action < 765)
+        {
+            toggleSubscription();
+        }
+        else if (action < 790)
+        {
+            setDebounce();
+        }
+        else if (action < 795)
+        {
+            setStormLimit();
+        }
+        else if (action < 805)
+        {
+            restore();
+        }
+        else if (action < 885)
+        {
+            stage();
+        }
+        else if (action < 905)
+        {
+            play();
+        }
+        else if (action < 908)
+        {
+            toggleKeypad();
+        }
+        else if ((action < 918) && (now() - lastFault >= FAULT_SPACING))
+        {
+            injectFault();
+            lastFault = now();
+        }
+    }
+
+    /* Settle in two steps. Held keys are scanned every period, so first
+       wait with the switches as they are, then open them and wait for idle.
+    */
+    sim::time_ns_t settleStart = now();
+
+    loop.runUntil(now() + 100 * sim::NS_PER_MS);
+
+    bool keypadChecked = keypadRunning && keypadTrusted && (__builtin_popcount(switches) <= 2);
+
+    if (keypadChecked && (keysDown != switches))
+    {
+        VIOLATION("keys %04X down, switches %04X closed", keysDown, switches);
+    }
+
+    if (playing && playing->loop)
+    {
+        device.stopSequence();
+        playing = NULL;
+    }
+
+    for (uint8_t key = 0; key < KEYS * KEYS; key++)
+    {
+        model.setSwitch(FIRST_ROW + key / KEYS, FIRST_COLUMN + key % KEYS, false);
+    }
+
+    switches = 0;
+
+    if (!loop.runUntilIdle(now() + 1000 * sim::NS_PER_MS))
+    {
+        VIOLATION("driver did not go idle");
+    }
+
+    sim::time_ns_t settle = now() - settleStart;
+
+    if (keypadChecked && keysDown)
+    {
+        VIOLATION("keys %04X still down with every switch open", keysDown);
+    }
+
+    if (!outstanding.empty())
+    {
+        VIOLATION("%u commands never ended", (unsigned) outstanding.size());
+    }
+
+    if (bus().busy() || (sim::pendingCallbacks() != 0))
+    {
+        VIOLATION("bus busy or callbacks left after settling");
+    }
+
+    if (!sim::Net::get(SDA).read())
+    {
+        VIOLATION("SDA held low");
+    }
+
+    awaitSubscriptions();
+
+    /* lost edges: the levels of the pins left interrupting are reported */
+    uint32_t levels = model.levels() & DRIVEN;
+    uint32_t known = enabled & ~dirty;
+
+    if ((levels ^ reported) & known)
+    {
+        VIOLATION("inputs at %06X, last reported %06X on %06X", levels, reported, known);
+    }
+
+    /* masks as the commands left them, debouncing and polling are over */
+    const sim::pcal_layout_t& layout = model.getLayout();
+    uint32_t masked = model.peekBank(layout.interruptMask) & DRIVEN;
+
+    if (masked != (DRIVEN & ~enabled))
+    {
+        VIOLATION("interrupt mask %06X, expected %06X", masked, DRIVEN & ~enabled);
+    }
+
+    if (stormState & ~stormReset)
+    {
+        VIOLATION("storm on %06X never cleared", stormState & ~stormReset);
+    }
+
+    if (!sameConfig(chipConfig(), configModel))
+    {
+        VIOLATION("port 0 configuration differs from the configures that completed");
+    }
+
+    /* output register: commands, the staged writes and the last sequence */
+    uint32_t outputs = model.peekBank(layout.output);
+
+    if ((outputs ^ expected) & WRITTEN)
+    {
+        VIOLATION("output register %06X, expected %06X on %06X", outputs, expected, WRITTEN);
+    }
+
+    if (stagedValid && ((outputs ^ stagedValues) & STAGED))
+    {
+        VIOLATION("output register %06X, staged %06X", outputs, stagedValues);
+    }
+
+    if (playing && (playing->calls != 1))
+    {
+        VIOLATION("sequence called back %u times", playing->calls);
+    }
+    else if (playing && (playing->finished > restored) && ((outputs ^ playing->last) & SEQUENCED))
+    {
+        VIOLATION("output register %06X, last frame %06X", outputs, playing->last);
+    }
+
+    /* and the driver still works */
+    track(device.bulkRead(readFeatureDone), OP_READ, 0, 0);
+    loop.runUntilIdle();
+
+    if (!outstanding.empty())
+    {
+        VIOLATION("final read did not complete");
+    }
+
+    double wall = (double) (clock() - wallStart) / CLOCKS_PER_SEC;
+
+    printf("{\"stress\":\"features\",\"seed\":%u,\"operations\":%llu", seed, (unsigned long long) operations);
+    printf(",\"commands\":%llu,\"refused\":%llu,\"completed\":%llu",
+           (unsigned long long) issued, (unsigned long long) refused, (unsigned long long) completed);
+    printf(",\"timeouts\":%u,\"irq_failures\":%llu,\"edges\":%llu,\"irqs\":%llu",
+           (unsigned) shared.getTimeouts(), (unsigned long long) interruptFailures,
+           (unsigned long long) edges, (unsigned long long) irqs);
+    printf(",\"subscription_calls\":%llu,\"debounce_checks\":%llu,\"storms\":%llu,\"key_events\":%llu",
+           (unsigned long long) subscriptionCalls, (unsigned long long) debounceChecks,
+           (unsigned long long) storms, (unsigned long long) keyEvents);
+    printf(",\"sequences\":%llu,\"restores\":%llu,\"restore_mismatches\":%llu",
+           (unsigned long long) plays, (unsigned long long) restores, (unsigned long long) restoreMismatches);
+    printf(",\"wall_operations_per_s\":%.0f,\"settle_us\":%.1f,\"violations\":%llu}\n",
+           wall > 0 ? operations / wall : 0.0, (double) settle / 1000, (unsigned long long) violations);
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t operations = (argc > 1) ? strtoull(argv[1], NULL, 0) : 200000;
+    uint32_t seed = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+
+    uint64_t total = 0;
+
+    pass(operations, seed, false);
+    total += violations;
+
+    pass(operations, seed, true);
+    total += violations;
+
+    featurePass(operations, seed);
+    total += violations;
+
+    return total ? EXIT_FAILURE : EXIT_SUCCESS;
+}
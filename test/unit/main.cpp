@@ -76,17 +76,245 @@ void button1ISR()
     minar::Scheduler::postCallback(button1Task);
 }
 
+/*****************************************************************************/
+/* Self test                                                                 */
+/*****************************************************************************/
+
+/* The checks run one after the other on ioexpander1 and print their
+   result. They use the pin the demo toggles, so the demo only starts once
+   they are done, or as soon as one of them cannot go on.
+*/
+#define SELFTEST_PIN PCAL64::P0_6
+
+static void selftestReport(const char* name, bool ok)
+{
+    printf("%s: %s\r\n", name, ok ? "ok" : "FAIL");
+}
+
+static void selftestQueue(void);
+static void selftestCoalesce(void);
+static void selftestPark(void);
+static void demoStart(void);
+
+/* shadow: a write that goes through the shadow reaches the device */
+
+static void shadowReadDone(uint32_t values)
+{
+    selftestReport("shadow", (values & SELFTEST_PIN) == 0);
+
+    selftestQueue();
+}
+
+static void shadowToggleDone(void)
+{
+    ioexpander1.bulkRead(shadowReadDone);
+}
+
+static void shadowWriteDone(void)
+{
+    /* without the shadow the toggle reads the direction and output from
+       the device, the pin only goes low if the write got there
+    */
+    ioexpander1.disableShadowRegisters();
+    ioexpander1.bulkToggle(SELFTEST_PIN, shadowToggleDone);
+}
+
+static void shadowEnabled(void)
+{
+    ioexpander1.bulkWrite(SELFTEST_PIN, SELFTEST_PIN, SELFTEST_PIN, shadowWriteDone);
+}
+
+static void selftestShadow(void)
+{
+    ioexpander1.enableShadowRegisters(shadowEnabled);
+}
+
+/* queue: commands issued while the expander is busy run in order */
+
+static uint8_t queueStep;
+static bool queueOk;
+
+static void queueExpect(uint8_t step)
+{
+    queueOk = queueOk && (queueStep == step);
+    queueStep++;
+}
+
+static void queueWriteDone(void)
+{
+    queueExpect(1);
+}
+
+static void queueToggleDone(void)
+{
+    queueExpect(3);
+}
+
+static void queueReadDone(uint32_t values)
+{
+    /* reads are steps 0, 2 and 4, after the write and after the toggle */
+    switch (queueStep)
+    {
+        case 0:
+            break;
+        case 2:
+            queueOk = queueOk && (values & SELFTEST_PIN);
+            break;
+        case 4:
+            queueOk = queueOk && !(values & SELFTEST_PIN);
+            break;
+        default:
+            queueOk = false;
+            break;
+    }
+
+    queueStep++;
+
+    if (queueStep == 5)
+    {
+        selftestReport("queue", queueOk);
+
+        selftestCoalesce();
+    }
+}
+
+static void selftestQueue(void)
+{
+    queueStep = 0;
+
+    /* one runs, the others wait in the queue */
+    queueOk = ioexpander1.bulkRead(queueReadDone);
+    queueOk = ioexpander1.bulkWrite(SELFTEST_PIN, SELFTEST_PIN, SELFTEST_PIN, queueWriteDone) && queueOk;
+    queueOk = ioexpander1.bulkRead(queueReadDone) && queueOk;
+    queueOk = ioexpander1.bulkToggle(SELFTEST_PIN, queueToggleDone) && queueOk;
+    queueOk = ioexpander1.bulkRead(queueReadDone) && queueOk;
+
+    if (!queueOk)
+    {
+        selftestReport("queue", false);
+
+        demoStart();
+    }
+}
+
+/* coalesce: output commands queued behind each other merge into one */
+
+static uint8_t coalesceDone;
+static bool coalesceOk;
+
+static void coalesceToggleDone(void)
+{
+    coalesceDone++;
+}
+
+static void coalesceReadDone(uint32_t values)
+{
+    /* written low, then toggled an odd number of times */
+    coalesceOk = coalesceOk && (coalesceDone == 2) && (values & SELFTEST_PIN);
+
+    selftestReport("coalesce", coalesceOk);
+
+    selftestPark();
+}
+
+static void selftestCoalesce(void)
+{
+    coalesceDone = 0;
+
+    /* more commands than the queue holds, they fit because they merge */
+    coalesceOk = ioexpander1.bulkRead(NULL);
+    coalesceOk = ioexpander1.bulkWrite(SELFTEST_PIN, SELFTEST_PIN, 0, coalesceToggleDone) && coalesceOk;
+
+    for (uint8_t index = 0; index < 2 * YOTTA_CFG_GPIO_PCAL64_QUEUE_SIZE; index++)
+    {
+        coalesceOk = ioexpander1.bulkToggle(SELFTEST_PIN, NULL) && coalesceOk;
+    }
+
+    coalesceOk = ioexpander1.bulkToggle(SELFTEST_PIN, coalesceToggleDone) && coalesceOk;
+
+    if (!coalesceOk || !ioexpander1.bulkRead(coalesceReadDone))
+    {
+        selftestReport("coalesce", false);
+
+        demoStart();
+    }
+}
+
+/* park: an interrupt during a command is serviced before the command ends */
+
+static PCAL64::Config parkPullUp = PCAL64::Config()
+    .pull(SELFTEST_PIN, PCAL64::PULL_UP);
+
+/* the pull-down lands first, the port configuration read comes after */
+static PCAL64::Config parkPullDown = PCAL64::Config()
+    .pull(SELFTEST_PIN, PCAL64::PULL_DOWN)
+    .openDrain(0x01, false);
+
+static bool parkIrqSeen;
+static bool parkOk;
+
+static void parkIrqHandler(uint16_t, uint32_t pins, uint32_t values)
+{
+    parkOk = parkOk && (pins & SELFTEST_PIN) && !(values & SELFTEST_PIN);
+    parkIrqSeen = true;
+}
+
+static void parkRestored(void)
+{
+    ioexpander1.setInterruptHandler(irqHandler);
+
+    selftestReport("park", parkOk);
+
+    demoStart();
+}
+
+static void parkConfigured(void)
+{
+    /* the interrupt was handled ahead of the command it arrived in */
+    parkOk = parkOk && parkIrqSeen;
+
+    /* the demo drives the pin again */
+    ioexpander1.bulkSetInterrupt(SELFTEST_PIN, 0, NULL);
+    ioexpander1.bulkWrite(SELFTEST_PIN, SELFTEST_PIN, 0, parkRestored);
+}
+
+static void parkArmed(uint32_t)
+{
+    parkIrqSeen = false;
+    parkOk = true;
+
+    ioexpander1.setInterruptHandler(parkIrqHandler);
+    ioexpander1.configure(parkPullDown, parkConfigured);
+}
+
+static void selftestPark(void)
+{
+    /* an input held high by its pull-up, with the interrupt enabled; the
+       read clears the status before the pin is pulled down
+    */
+    ioexpander1.bulkWrite(SELFTEST_PIN, 0, 0, NULL);
+    ioexpander1.configure(parkPullUp, NULL);
+    ioexpander1.bulkSetInterrupt(SELFTEST_PIN, SELFTEST_PIN, NULL);
+    ioexpander1.bulkRead(parkArmed);
+}
+
 /*****************************************************************************/
 /* App start                                                                 */
 /*****************************************************************************/
 
-void app_start(int, char *[])
+static void demoStart(void)
 {
     // setup buttons
     button1.fall(button1ISR);
 
+    ioexpander0.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, irqDone);
+}
+
+void app_start(int, char *[])
+{
     ioexpander0.setInterruptHandler(irqHandler);
     ioexpander1.setInterruptHandler(irqHandler);
 
-    ioexpander0.bulkSetInterrupt(PCAL64::P0_0, PCAL64::P0_0, irqDone);
+    // the demo starts when the self test is done
+    selftestShadow();
 }